@@ -0,0 +1,537 @@
+/*	$NetBSD$	*/
+
+/*
+ * Copyright (c) 1999 Mark Brinicombe & Neil A. Carson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * X11 driver code for VIDC20
+ */
+
+/*
+ * Linux frame buffer and evdev console.
+ *
+ * Stands in for rpccons.c on machines that aren't RiscPCs: the screen
+ * geometry and mapping come from a fbdev device and the mouse and
+ * keyboard are evdev devices. As with wscons, input is read a batch
+ * of input_events per read() and decoded in one pass.
+ *
+ * -fbdev may also name a plain file, or a memfd inherited from the
+ * parent as /proc/self/fd/N. The geometry then comes from -fbsize and
+ * the file is grown to fit. -evmouse and -evkbd may be fifos, so the
+ * server can be run and fed input without any hardware.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/fb.h>
+#endif
+
+/* X11 headers
+ */
+#include "X.h"
+#include "Xproto.h"
+#include "misc.h"
+#include "input.h"
+#include "scrnintstr.h"
+
+/* Keymap, from XFree86*/
+#include "atKeynames.h"
+
+/* Our private definitions */
+#include "private.h"
+#include "fbdevcons.h"
+
+extern struct _private private;
+
+/*#define DEBUG*/
+
+#ifdef DEBUG
+#define DPRINTF(x) ErrorF x
+#else
+#define DPRINTF(x)
+#endif
+
+#define FB_BATCH	64		/* events per read */
+
+#define TVTOMILLI(tv)	((tv).tv_usec / 1000 + (tv).tv_sec * 1000)
+
+char *vidc_fbdev_path;
+char *vidc_evmouse_path = "/dev/input/event0";
+char *vidc_evkbd_path = "/dev/input/event1";
+
+/* Geometry to use when -fbdev isn't a frame buffer device */
+int vidc_fb_xres = 640;
+int vidc_fb_yres = 480;
+int vidc_fb_depth = 8;
+
+/* FALSE if -fbdev turned out to be a plain file */
+static Bool fb_is_device;
+
+static struct fb_input_event fb_buf[FB_BATCH];
+
+/* Linux keycodes past F12 and the XFree86 AT keycodes they become */
+static struct {
+	int	ev;
+	int	at;
+} fb_extkeys[] = {
+	{ 96, KEY_KP_Enter },	{ 97, KEY_RCtrl },
+	{ 98, KEY_KP_Divide },	{ 99, KEY_Print },
+	{ 100, KEY_AltLang },	{ 102, KEY_Home },
+	{ 103, KEY_Up },	{ 104, KEY_PgUp },
+	{ 105, KEY_Left },	{ 106, KEY_Right },
+	{ 107, KEY_End },	{ 108, KEY_Down },
+	{ 109, KEY_PgDown },	{ 110, KEY_Insert },
+	{ 111, KEY_Delete },	{ 119, KEY_Pause },
+	{ 125, KEY_LMeta },	{ 126, KEY_RMeta },
+	{ 127, KEY_Menu },
+};
+
+/* Linux keycode to AT keycode, 0 for keys we don't know */
+static CARD8 fb_keymap[128];
+
+#ifdef FBIOGET_VSCREENINFO
+/* Turn one colour's bitfield into a mask within a 16 bit pixel */
+static Bool fb_get_mask(struct fb_bitfield *f, unsigned long *mask)
+{
+	if (f->length == 0 || f->msb_right || f->offset + f->length > 16)
+		return FALSE;
+	*mask = ((1UL << f->length) - 1) << f->offset;
+	return TRUE;
+}
+#endif
+
+/*
+ * Read the geometry from the frame buffer device. Returns 1 if it is
+ * one we can draw on, 0 if the fd isn't a frame buffer device at all
+ * and -1 if it is one laid out in a way we can't draw.
+ */
+static int fb_get_geometry(int fd)
+{
+#ifdef FBIOGET_VSCREENINFO
+	struct fb_var_screeninfo var;
+	struct fb_fix_screeninfo fix;
+
+	if (ioctl(fd, FBIOGET_VSCREENINFO, &var) != 0 ||
+	    ioctl(fd, FBIOGET_FSCREENINFO, &fix) != 0)
+		return 0;
+
+	switch (var.bits_per_pixel) {
+	case 1:
+	case 2:
+	case 4:
+	case 8:
+		private.red_mask = private.green_mask = private.blue_mask = 0;
+		break;
+	case 16:
+		/* The visual is given these masks once cfb16 has made it */
+		if (!fb_get_mask(&var.red, &private.red_mask) ||
+		    !fb_get_mask(&var.green, &private.green_mask) ||
+		    !fb_get_mask(&var.blue, &private.blue_mask) ||
+		    (private.red_mask & private.green_mask) ||
+		    (private.red_mask & private.blue_mask) ||
+		    (private.green_mask & private.blue_mask)) {
+			ErrorF("%s: can't use the 16bpp pixel layout "
+			    "red %d/%d green %d/%d blue %d/%d\n",
+			    vidc_fbdev_path, var.red.length, var.red.offset,
+			    var.green.length, var.green.offset,
+			    var.blue.length, var.blue.offset);
+			return -1;
+		}
+		break;
+	default:
+		ErrorF("%s: %d bits per pixel isn't supported, only 1, 2, 4, "
+		    "8 and 16\n", vidc_fbdev_path, var.bits_per_pixel);
+		return -1;
+	}
+
+	/* We draw at the start of the mapping, so show that */
+	if (var.xoffset != 0 || var.yoffset != 0) {
+		var.xoffset = var.yoffset = 0;
+		if (ioctl(fd, FBIOPAN_DISPLAY, &var) != 0)
+			ErrorF("Couldn't pan the frame buffer to 0,0\n");
+	}
+	private.xres = var.xres;
+	private.yres = var.yres;
+	private.depth = var.bits_per_pixel;
+	private.width = fix.line_length;
+
+	/* cfb wants lines of whole pixels with no gap between them */
+	if (private.width != private.xres * private.depth / 8) {
+		private.xres = private.width * 8 / private.depth;
+		ErrorF("Frame buffer lines are padded, using a width of %d\n",
+		    private.xres);
+	}
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+int fb_init_screen(ScreenPtr screen, int argc, char **argv)
+{
+	struct stat st;
+	int size;
+
+	private.rpc_origvc = -1;
+	private.con_fd = -1;
+
+	if ((private.vram_fd = open(vidc_fbdev_path, O_RDWR)) < 0) {
+		ErrorF("Unable to open %s\n", vidc_fbdev_path);
+		return FALSE;
+	}
+	vidc_startup_phase("fbdev-open");
+
+	switch (fb_get_geometry(private.vram_fd)) {
+	case -1:
+		close(private.vram_fd);
+		return FALSE;
+	case 0:
+		fb_is_device = FALSE;
+		break;
+	default:
+		fb_is_device = TRUE;
+		break;
+	}
+	if (!fb_is_device) {
+		private.xres = vidc_fb_xres;
+		private.yres = vidc_fb_yres;
+		private.depth = vidc_fb_depth;
+		private.width = (private.xres * private.depth) / 8;
+
+		/* Make sure there is something behind the mapping */
+		size = private.width * private.yres;
+		if (fstat(private.vram_fd, &st) != 0 ||
+		    (st.st_size < size &&
+		    ftruncate(private.vram_fd, size) != 0)) {
+			ErrorF("Can't size %s to %d bytes\n", vidc_fbdev_path,
+			    size);
+			close(private.vram_fd);
+			return FALSE;
+		}
+	}
+	ErrorF("Frame buffer %d x %d x %d%s\n", private.xres, private.yres,
+	    private.depth, fb_is_device ? "" : " (file)");
+
+	/* Whatever was in the palette before is no longer ours */
+	vidc_palette_forget();
+
+	return TRUE;
+}
+
+/*
+ * Called on a server reset instead of fb_init_screen(). A file can't
+ * change under us; a device is checked as the console is in rpccons.c.
+ */
+int fb_revalidate_screen(void)
+{
+	int xres = private.xres, yres = private.yres;
+	int depth = private.depth, width = private.width;
+
+	if (!fb_is_device)
+		return TRUE;
+	if (fb_get_geometry(private.vram_fd) > 0 && private.xres == xres &&
+	    private.yres == yres && private.depth == depth &&
+	    private.width == width)
+		return TRUE;
+
+	ErrorF("Frame buffer changed over reset, reinitialising\n");
+	munmap(private.vram_base, width * yres);
+	private.vram_base = NULL;
+	close(private.vram_fd);
+	return FALSE;
+}
+
+/*
+ * Switch to another mode for vidcmode.c. A file is just resized; a
+ * device may not take the mode, in which case the geometry is left as
+ * whatever it is showing now and FALSE returned.
+ */
+int fb_set_mode(int xres, int yres, int depth)
+{
+	struct stat st;
+	int size;
+
+	if (!fb_is_device) {
+		size = (xres * depth) / 8 * yres;
+		if (fstat(private.vram_fd, &st) != 0 ||
+		    (st.st_size < size &&
+		    ftruncate(private.vram_fd, size) != 0)) {
+			ErrorF("Can't size %s to %d bytes\n", vidc_fbdev_path,
+			    size);
+			return FALSE;
+		}
+		private.xres = xres;
+		private.yres = yres;
+		private.depth = depth;
+		private.width = (xres * depth) / 8;
+		return TRUE;
+	}
+#ifdef FBIOPUT_VSCREENINFO
+	{
+		struct fb_var_screeninfo var;
+
+		if (ioctl(private.vram_fd, FBIOGET_VSCREENINFO, &var) != 0)
+			return FALSE;
+		var.xres = var.xres_virtual = xres;
+		var.yres = var.yres_virtual = yres;
+		var.xoffset = var.yoffset = 0;
+		var.bits_per_pixel = depth;
+		var.activate = FB_ACTIVATE_NOW;
+		if (ioctl(private.vram_fd, FBIOPUT_VSCREENINFO, &var) != 0)
+			DPRINTF(("fb_set_mode: FBIOPUT_VSCREENINFO failed\n"));
+		if (fb_get_geometry(private.vram_fd) <= 0)
+			return FALSE;
+		return (private.xres == xres && private.yres == yres &&
+		    private.depth == depth);
+	}
+#else
+	return FALSE;
+#endif
+}
+
+void fb_closedown(void)
+{
+	/* We never switched consoles, so there is nothing to give back */
+}
+
+void fb_set_palette(int c, int r, int g, int b)
+{
+#ifdef FBIOPUTCMAP
+	struct fb_cmap cmap;
+	unsigned short red, green, blue;
+
+	/* Files get their palette through -export, if at all */
+	if (!fb_is_device || private.depth > 8)
+		return;
+	red = r * 0x101;
+	green = g * 0x101;
+	blue = b * 0x101;
+	cmap.start = c;
+	cmap.len = 1;
+	cmap.red = &red;
+	cmap.green = &green;
+	cmap.blue = &blue;
+	cmap.transp = NULL;
+	if (ioctl(private.vram_fd, FBIOPUTCMAP, &cmap) != 0)
+		DPRINTF(("fb_set_palette: FBIOPUTCMAP failed\n"));
+#endif
+}
+
+/*
+ * The bell is the keyboard's: evdev takes EV_SND events written to it.
+ */
+int fb_init_bell(void)
+{
+	return open(vidc_evkbd_path, O_WRONLY | O_NONBLOCK);
+}
+
+static void fb_send(int fd, int type, int code, int value)
+{
+	struct fb_input_event ev[2];
+
+	memset(ev, 0, sizeof(ev));
+	gettimeofday(&ev[0].time, 0);
+	ev[0].type = type;
+	ev[0].code = code;
+	ev[0].value = value;
+	ev[1].time = ev[0].time;
+	ev[1].type = FB_EV_SYN;
+	(void)write(fd, ev, sizeof(ev));
+}
+
+/* Called from the bell thread, like rpc_beep() */
+void fb_beep(int percent, int pitch, int duration)
+{
+	if (private.beep_fd == VIDC_FD_DEFERRED)
+		private.beep_fd = fb_init_bell();
+	if (private.beep_fd < 0 || percent <= 0)
+		return;
+
+	fb_send(private.beep_fd, FB_EV_SND, FB_SND_BELL, 1);
+	if (duration > 0)
+		usleep(duration * 1000);
+	fb_send(private.beep_fd, FB_EV_SND, FB_SND_BELL, 0);
+}
+
+/*
+ * Read as many events as are waiting, up to a batch. Returns the
+ * number read, which is 0 once the device is empty.
+ */
+static int fb_read(int fd, int type)
+{
+	int i, n;
+
+	n = read(fd, fb_buf, sizeof(fb_buf));
+	if (n <= 0)
+		return 0;
+	n /= sizeof(struct fb_input_event);
+	if (vidc_record_mode)
+		for (i = 0; i < n; i++)
+			vidc_record_input(type, &fb_buf[i], sizeof(fb_buf[i]));
+	return n;
+}
+
+/*
+ * Motion is gathered up across everything read and only flushed ahead
+ * of a button, as for the other mice. The wheel is buttons 4 and 5.
+ */
+void fb_mouse_io(void)
+{
+	struct fb_input_event *ev, *end;
+	int dx = 0, dy = 0, n;
+	CARD32 motion_time = 0;
+	xEvent x_event;
+
+	while ((n = fb_read(private.mouse_fd, VIDC_REC_MOUSE)) > 0) {
+		for (ev = fb_buf, end = fb_buf + n; ev < end; ev++) {
+			x_event.u.keyButtonPointer.time = TVTOMILLI(ev->time);
+			if (ev->type == FB_EV_REL) {
+				switch (ev->code) {
+				case FB_REL_X:
+					dx += ev->value;
+					break;
+				case FB_REL_Y:
+					dy += ev->value;
+					break;
+				case FB_REL_WHEEL:
+					if (ev->value == 0)
+						continue;
+					vidc_pointer_moved(&dx, &dy,
+					    motion_time);
+					x_event.u.u.detail =
+					    (ev->value > 0) ? 4 : 5;
+					x_event.u.u.type = ButtonPress;
+					vidc_enqueue(&x_event);
+					x_event.u.u.type = ButtonRelease;
+					vidc_enqueue(&x_event);
+					continue;
+				default:
+					continue;
+				}
+				motion_time = x_event.u.keyButtonPointer.time;
+			} else if (ev->type == FB_EV_KEY && ev->value != 2) {
+				switch (ev->code) {
+				case FB_BTN_LEFT:
+					x_event.u.u.detail = 1;
+					break;
+				case FB_BTN_MIDDLE:
+					x_event.u.u.detail = 2;
+					break;
+				case FB_BTN_RIGHT:
+					x_event.u.u.detail = 3;
+					break;
+				default:
+					continue;
+				}
+				vidc_pointer_moved(&dx, &dy, motion_time);
+				x_event.u.u.type = ev->value ? ButtonPress :
+				    ButtonRelease;
+				vidc_enqueue(&x_event);
+			}
+		}
+		if (n < FB_BATCH)
+			break;
+	}
+	vidc_pointer_moved(&dx, &dy, motion_time);
+}
+
+/*
+ * Keys. Autorepeat (value 2) is dropped as X does its own.
+ */
+void fb_kbd_io(void)
+{
+	struct fb_input_event *ev, *end;
+	xEvent x_event;
+	int n, code;
+
+	while ((n = fb_read(private.kbd_fd, VIDC_REC_KBD)) > 0) {
+		for (ev = fb_buf, end = fb_buf + n; ev < end; ev++) {
+			if (ev->type != FB_EV_KEY || ev->value == 2 ||
+			    ev->code >= 128 || (code = fb_keymap[ev->code]) == 0)
+				continue;
+			x_event.u.keyButtonPointer.time = TVTOMILLI(ev->time);
+			x_event.u.u.type = ev->value ? KeyPress : KeyRelease;
+			if (vidc_hot_key(x_event.u.u.type, code))
+				continue;
+			x_event.u.u.detail = code + MIN_KEYCODE;
+			vidc_enqueue(&x_event);
+		}
+		if (n < FB_BATCH)
+			break;
+	}
+}
+
+int fb_open_input(char *path)
+{
+	struct fb_input_event ev;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY | O_NONBLOCK)) < 0)
+		return -1;
+
+	/* SIGIO is only sent to an owner */
+	fcntl(fd, F_SETOWN, getpid());
+
+#ifdef FB_EVIOCGRAB
+	{
+		int on = 1;
+
+		/* Keep the text console from acting on our input too */
+		if (ioctl(fd, FB_EVIOCGRAB, &on) != 0)
+			DPRINTF(("fb_open_input: can't grab %s\n", path));
+	}
+#endif
+
+	/* Drain anything left over */
+	while (read(fd, &ev, sizeof(ev)) > 0)
+		;
+	return fd;
+}
+
+int fb_init_mouse(void)
+{
+	return fb_open_input(vidc_evmouse_path);
+}
+
+int fb_init_kbd(void)
+{
+	int i;
+
+	/* Up to F12, Linux keycodes are the AT keycodes */
+	for (i = 1; i <= KEY_F12; i++)
+		fb_keymap[i] = i;
+	for (i = 0; i < sizeof(fb_extkeys) / sizeof(fb_extkeys[0]); i++)
+		fb_keymap[fb_extkeys[i].ev] = fb_extkeys[i].at;
+
+	return fb_open_input(vidc_evkbd_path);
+}
@@ -0,0 +1,90 @@
+/*	$NetBSD$	*/
+
+/*
+ * Copyright (c) 1999 Mark Brinicombe & Neil A. Carson 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * X11 driver code for VIDC20
+ */
+
+/*
+ * The evdev definitions shared by the fbdev console and the tablet.
+ *
+ * <linux/input.h> can't be used alongside atKeynames.h (both define
+ * KEY_ names), so this is the part of it we need.
+ */
+
+#ifndef _FBDEVCONS_H_
+#define _FBDEVCONS_H_
+
+struct fb_input_event {
+	struct timeval	time;
+	unsigned short	type;
+	unsigned short	code;
+	int		value;
+};
+
+struct fb_absinfo {
+	int		value;
+	int		minimum;
+	int		maximum;
+	int		fuzz;
+	int		flat;
+	int		resolution;
+};
+
+#define FB_EV_SYN	0x00
+#define FB_EV_KEY	0x01
+#define FB_EV_REL	0x02
+#define FB_EV_ABS	0x03
+#define FB_EV_SND	0x12
+
+#define FB_SYN_REPORT	0x00
+
+#define FB_REL_X	0x00
+#define FB_REL_Y	0x01
+#define FB_REL_WHEEL	0x08
+
+#define FB_ABS_X	0x00
+#define FB_ABS_Y	0x01
+#define FB_ABS_PRESSURE	0x18
+
+#define FB_BTN_LEFT	0x110
+#define FB_BTN_RIGHT	0x111
+#define FB_BTN_MIDDLE	0x112
+#define FB_BTN_TOOL_PEN	0x140
+#define FB_BTN_TOUCH	0x14a
+#define FB_BTN_STYLUS	0x14b
+#define FB_BTN_STYLUS2	0x14c
+
+#define FB_SND_BELL	0x01
+
+#ifdef __linux__
+#define FB_EVIOCGABS(a)	_IOR('E', 0x40 + (a), struct fb_absinfo)
+#define FB_EVIOCGRAB	_IOW('E', 0x90, int)
+#endif
+
+int fb_open_input(char *path);
+
+#endif /* _FBDEVCONS_H_ */
@@ -29,6 +29,14 @@
  *
  */
 
+#include <pthread.h>
+#include <signal.h>
+
+/* For the types used in the prototypes below */
+#include "input.h"
+#include "scrnintstr.h"
+#include "gcstruct.h"
+
 /*
  * For each screen, we should allocate the following and store it in the
  * private area. To get something working, however, we don't :-(
@@ -46,13 +54,237 @@ struct _private
 	int con_fd;		/* File descriptor for the console */
 	int beep_fd;		/* File descriptor for beep */
 	char *vram_base;	/* Where the screen has been mapped to */
+	char *shadow_base;	/* RAM shadow X draws into, or NULL */
+	int shadow_width;	/* width of shadow in bytes */
+	int shadow_depth;	/* depth X renders at in the shadow */
 	DevicePtr mouse_dev;	/* X device for mouse */
 	DevicePtr kbd_dev;	/* X device for keyboard */
 	ColormapPtr colour_map;	/* Active colour map for this screen */
 	int rpc_origvc;
+	int (*init_mouse)(void);	/* Input backend: open the mouse */
+	int (*init_kbd)(void);		/* open the keyboard */
+	void (*mouse_io)(void);		/* read what the mouse has */
+	void (*kbd_io)(void);		/* read what the keyboard has */
+	int (*init_screen)(ScreenPtr screen, int argc, char **argv);
+					/* Screen backend: set up and open */
+	int (*revalidate_screen)(void);	/* check it over a reset */
+	void (*closedown)(void);	/* give the console back */
+	void (*set_palette)(int c, int r, int g, int b);
+					/* load one palette entry */
+	int (*init_bell)(void);		/* open the bell */
+	void (*beep)(int percent, int pitch, int duration);
+					/* sound it */
+	int (*set_mode)(int xres, int yres, int depth);
+					/* switch mode, or NULL */
+	unsigned long red_mask;		/* 16bpp pixel layout the device */
+	unsigned long green_mask;	/* wants, or 0 for cfb16's own */
+	unsigned long blue_mask;
 };
 
+/* An fd we have put off opening until it is first used */
+#define VIDC_FD_DEFERRED	(-2)
+
+/* Number of palette entries the frame buffer depth can use */
+#define VIDC_PALETTE_SIZE	(private.depth < 8 ? 1 << private.depth : 256)
+
 /* Prototypes */
 void vidc_mousectrl();
 void vidc_kbdctrl();
 void vidc_bell();
+
+/* vidc.c */
+extern volatile sig_atomic_t vidc_input_held;
+#define VIDC_HOLD_INPUT()	(vidc_input_held++)
+void vidc_release_input(void);
+void vidc_startup_phase(char *phase);
+void vidc_dump_stats(void);
+int mouse_accel(DeviceIntPtr device, int delta);
+void vidc_pointer_moved(int *dx, int *dy, CARD32 time);
+Bool vidc_hot_key(int type, int code);
+void write_palette(int c, int r, int g, int b);
+void vidc_palette_forget(void);
+void vidc_load_colour_map(ColormapPtr map);
+int vidc_thread_create(pthread_t *thread, void *(*func)(void *), void *arg);
+
+/* vidcpool.c */
+typedef void (*VidcPoolFunc)(void *arg, int band, int nbands);
+extern int vidc_pool_threads;
+Bool vidc_pool_init(void);
+int vidc_pool_size(void);
+void vidc_pool_run(VidcPoolFunc func, void *arg, int nbands);
+void vidc_pool_stats(void);
+
+/* rpccons.c */
+int rpc_init_mouse(void);
+int rpc_init_kbd(void);
+int rpc_init_bell(void);
+int rpc_init_screen(ScreenPtr screen, int argc, char **argv);
+void rpc_mouse_io(void);
+void rpc_kbd_io(void);
+int rpc_revalidate_screen(void);
+void rpc_closedown(void);
+void rpc_set_palette(int c, int r, int g, int b);
+void rpc_beep(int percent, int pitch, int duration);
+
+/* fbdevcons.c */
+extern char *vidc_fbdev_path;
+extern char *vidc_evmouse_path;
+extern char *vidc_evkbd_path;
+extern int vidc_fb_xres, vidc_fb_yres, vidc_fb_depth;
+int fb_init_screen(ScreenPtr screen, int argc, char **argv);
+int fb_revalidate_screen(void);
+void fb_closedown(void);
+void fb_set_palette(int c, int r, int g, int b);
+int fb_set_mode(int xres, int yres, int depth);
+int fb_init_bell(void);
+void fb_beep(int percent, int pitch, int duration);
+int fb_init_mouse(void);
+int fb_init_kbd(void);
+void fb_mouse_io(void);
+void fb_kbd_io(void);
+
+/* wscons.c */
+extern Bool vidc_wscons;
+extern char *vidc_wsmouse_path;
+extern char *vidc_wskbd_path;
+extern Bool vidc_ws_bench_wanted;
+int ws_init_mouse(void);
+int ws_init_kbd(void);
+void ws_mouse_io(void);
+void ws_kbd_io(void);
+void vidc_ws_bench(void);
+
+/* vidcmotion.c */
+extern int vidc_motion_lag_ms;
+Bool vidc_motion_init(void);
+void vidc_motion(int dx, int dy, CARD32 time);
+void vidc_enqueue(xEvent *event);
+void vidc_motion_caught_up(void);
+void vidc_motion_stats(void);
+
+/* vidctablet.c */
+extern char *vidc_tablet_path;
+void vidc_tablet_io(void);
+void vidc_tablet_process(void);
+void vidc_tablet_stats(void);
+
+/* vidcrecord.c */
+#define VIDC_REC_OFF	0
+#define VIDC_REC_RECORD	1
+#define VIDC_REC_REPLAY	2
+
+#define VIDC_REC_MOUSE	1
+#define VIDC_REC_KBD	2
+
+extern int vidc_record_mode;
+extern char *vidc_record_file;
+extern Bool vidc_replay_fast;
+void vidc_record_input(int type, void *data, int len);
+Bool vidc_record_open(void);
+void vidc_record_sync(void);
+void vidc_record_close(void);
+Bool vidc_replay_open(int *mouse_fd, int *kbd_fd);
+void vidc_replay_io(void);
+void vidc_replay_check(void);
+
+/* vidcaccel.c */
+extern Bool vidc_accel_wanted;
+Bool vidc_accel_init(ScreenPtr screen, int depth);
+extern Bool vidc_accel_bench_wanted;
+void vidc_accel_bench(ScreenPtr screen);
+GCOps *vidc_accel_cfb_ops(GCPtr pGC);
+RegionPtr vidc_accel_clip(GCPtr pGC);
+
+/* vidcglyph.c */
+extern int vidc_glyph_cache_kb;
+Bool vidc_glyph_init(ScreenPtr screen);
+void vidc_glyph_image_blt(DrawablePtr pDraw, GCPtr pGC, int x, int y,
+    unsigned int nglyph, CharInfoPtr *ppci, pointer pglyphBase);
+void vidc_glyph_poly_blt(DrawablePtr pDraw, GCPtr pGC, int x, int y,
+    unsigned int nglyph, CharInfoPtr *ppci, pointer pglyphBase);
+void vidc_glyph_stats(void);
+extern Bool vidc_glyph_bench_wanted;
+void vidc_glyph_bench(ScreenPtr screen);
+
+/* vidctile.c */
+typedef struct _VidcTiles *VidcTilesPtr;
+extern Bool vidc_tile_bench_wanted;
+VidcTilesPtr vidc_tile_create(unsigned char *base, int stride, int width,
+    int height, int depth);
+void vidc_tile_destroy(VidcTilesPtr t);
+int vidc_tile_max_boxes(VidcTilesPtr t);
+int vidc_tile_scan(VidcTilesPtr t, BoxPtr boxes);
+void vidc_tile_bench(void);
+
+/* vidcrfb.c */
+extern int vidc_rfb_port;
+extern Bool vidc_rfb_any;
+extern Bool vidc_rfb_active;
+Bool vidc_rfb_init(void);
+void vidc_rfb_damage(int x1, int y1, int x2, int y2);
+void vidc_rfb_colours_changed(void);
+void vidc_rfb_mode_changed(void);
+void vidc_rfb_stats(void);
+
+/* vidcbstore.c */
+extern int vidc_bs_pool_kb;
+Bool vidc_bs_init(ScreenPtr screen);
+void vidc_bs_stats(void);
+
+/* vidcprof.c */
+extern Bool vidc_profile;
+Bool vidc_prof_init(ScreenPtr screen);
+void vidc_prof_dump(void);
+
+/* vidctrace.c */
+#define VIDC_TRACE_MAIN		0
+#define VIDC_TRACE_INPUT	1
+extern Bool vidc_tracing;
+extern char *vidc_trace_file;
+unsigned long long vidc_trace_now(void);
+void vidc_trace_event(int ring, char *name, int arg,
+    unsigned long long start);
+void vidc_trace_check(void);
+void vidc_trace_alloc(void);
+void vidc_trace_init(void);
+
+/* vidcbell.c */
+extern int vidc_bell_merge_ms;
+void vidc_bell_control(KeybdCtrl *ctrl);
+
+/* vidcshadow.c */
+#define VIDC_DAMAGE_OPS		0	/* wrap the drawing ops */
+#define VIDC_DAMAGE_FAULT	1	/* write protect the shadow */
+extern Bool vidc_shadow_wanted;
+extern int vidc_shadow_damage_mode;
+Bool vidc_shadow_alloc(int depth);
+Bool vidc_shadow_init(ScreenPtr screen);
+void vidc_shadow_damage(BoxPtr box);
+void vidc_shadow_flush(void);
+void vidc_shadow_stats(void);
+Bool vidc_shadow_resize(void);
+extern Bool vidc_shadow_bench_wanted;
+void vidc_shadow_bench(void);
+
+/* vidcmode.c */
+extern char *vidc_modes_spec;
+void vidc_mode_init(ScreenPtr screen);
+int vidc_mode_min_depth(void);
+Bool vidc_mode_next(int step);
+void vidc_mode_check(void);
+void vidc_mode_stats(void);
+
+/* vidcexport.c */
+extern char *vidc_export_file;
+char *vidc_export_map(int size, int depth, int stride);
+void vidc_export_init(ScreenPtr screen);
+void vidc_export_span(int y, int x1, int x2);
+void vidc_export_commit(void);
+void vidc_export_palette(int index, int r, int g, int b);
+
+/* vidccmap.c */
+extern Bool vidc_cmap_bench_wanted;
+Bool vidc_cmap_init(ScreenPtr screen);
+void vidc_cmap_bench(ScreenPtr screen);
+void vidc_cmap_notify(ScreenPtr screen, Colormap mid,
+    int (*func)(WindowPtr, pointer));
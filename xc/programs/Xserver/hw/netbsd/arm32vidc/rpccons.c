@@ -47,6 +47,7 @@
 #include <sys/ioctl.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <string.h>
 #include <errno.h>
 
 /* X11 headers
@@ -97,15 +98,10 @@
 
 extern struct _private private;
 
-void write_palette(c, r, g, b)
-	int	c;
-	int	r;
-	int	g;
-	int	b;
+void rpc_set_palette(int c, int r, int g, int b)
 {
 	struct console_palette pal;
 
-	DPRINTF(("write_palette: %d %d %d %d\n", c, r, g, b));
 	pal.entry = c;
 	pal.red = r;
 	pal.green = g;
@@ -121,18 +117,27 @@ void vidc_mousectrl(DeviceIntPtr device, PtrCtrl *ctrl)
 void vidc_kbdctrl(DeviceIntPtr device, KeybdCtrl *ctrl)
 {
 	DPRINTF(("kbdmousectrl\n"));
+	vidc_bell_control(ctrl);
 }
 
-void vidc_bell(int percent, DeviceIntPtr device, pointer ctrl, int unused)
+/*
+ * Sound the beep. Called from the bell thread, never the dispatch loop.
+ *
+ * The beep device only plays its one sample, so the volume can only
+ * turn it off and the pitch is ignored. We do hold on for the duration
+ * so that queued bells come out as separate beeps.
+ */
+void rpc_beep(int percent, int pitch, int duration)
 {
-	KeybdCtrl *kctrl = (KeybdCtrl *)ctrl;
-	DPRINTF(("Bell\n"));
-
-	if (percent == 0 || kctrl->bell == 0)
+	/* With -faststart the beep device isn't opened until needed */
+	if (private.beep_fd == VIDC_FD_DEFERRED)
+		private.beep_fd = rpc_init_bell();
+	if (private.beep_fd < 0 || percent <= 0)
 		return;
 
-	if (private.beep_fd >= 0)
-		ioctl(private.beep_fd, BEEP_GENERATE);
+	ioctl(private.beep_fd, BEEP_GENERATE);
+	if (duration > 0)
+		usleep(duration * 1000);
 }
 
 /* Map wsmouse button codes to X button codes
@@ -145,64 +150,69 @@ void vidc_bell(int percent, DeviceIntPtr device, pointer ctrl, int unused)
  */
 #define TVTOMILLI(tv)   ((tv).tv_usec / 1000 + (tv).tv_sec * 1000)
 
+/*
+ * Motion is coalesced across the records read in one go, but only up
+ * to the next button change: the motion so far is flushed before the
+ * button events are queued so that clicks land where they happened
+ * and drags keep their shape.
+ */
 void rpc_mouse_io(void)
 {
 	int dy = 0, dx = 0;
 	struct mousebufrec mb;
 	static int buttons = 0;
-	int was_mouse = 0;
+	CARD32 motion_time = 0;
 	xEvent x_event;
 
 	/* Try the mouse */
 	while (read(private.mouse_fd, &mb, sizeof(mb)) > 0)
 	{
+		if (vidc_record_mode)
+			vidc_record_input(VIDC_REC_MOUSE, &mb, sizeof(mb));
+
 		/* Was it an ioctl acknowledge ? */
 		if (mb.status & IOC_ACK)
 			continue;
-		/* It was the mouse */
-		was_mouse = 1;
 
 		/* Get the time of the event as near as possible */
-		x_event.u.keyButtonPointer.time = TVTOMILLI(mb.event_time);;
+		x_event.u.keyButtonPointer.time = TVTOMILLI(mb.event_time);
 
 		/* Process the mouse event */
-		dx += mb.x;
-		dy -= mb.y;
+		if (mb.x || mb.y) {
+			dx += mb.x;
+			dy -= mb.y;
+			motion_time = x_event.u.keyButtonPointer.time;
+		}
 
 		/* Have the buttons changed ? */
 		if (buttons != mb.status) {
+			/* Get the pointer to where the buttons changed */
+			vidc_pointer_moved(&dx, &dy, motion_time);
+
 			if(LEFTB(buttons) != LEFTB(mb.status)){
 				x_event.u.u.detail = 1;	/* leftmost */
 				x_event.u.u.type = LEFTB(mb.status) ?
 				    ButtonRelease : ButtonPress;
-				mieqEnqueue(&x_event);
+				vidc_enqueue(&x_event);
 			}
 			if(MIDDLEB(buttons) != MIDDLEB(mb.status)){
 				x_event.u.u.detail = 2;	/* middle */
 				x_event.u.u.type = MIDDLEB(mb.status) ?
 				    ButtonRelease : ButtonPress;
-				mieqEnqueue(&x_event);
+				vidc_enqueue(&x_event);
 			}
 			if(RIGHTB(buttons) != RIGHTB(mb.status)){
 				x_event.u.u.detail = 3;	/* right */
 				x_event.u.u.type = RIGHTB(mb.status) ?
 				    ButtonRelease : ButtonPress;
-				mieqEnqueue(&x_event);
+				vidc_enqueue(&x_event);
 			}
 			buttons = mb.status;
 		}
 	}
 
 	/* Once we have processed all the pending mouse events ... */
-	if (was_mouse) {
-		DeviceIntPtr device = (DeviceIntPtr)LookupPointerDevice();
-		dx = mouse_accel(device, dx);
-		dy = mouse_accel(device, dy);
-		if (dy || dx)
-			miPointerDeltaCursor(dx, dy,
-			    x_event.u.keyButtonPointer.time);
-	}
-
+	vidc_pointer_moved(&dx, &dy, motion_time);
 }
 
 void rpc_kbd_io(void)
@@ -210,7 +220,6 @@ void rpc_kbd_io(void)
 	int was_kbd = 0;
 	xEvent x_event;
 	struct kbd_data kb;
-	static int controlmask = 0;
 
 	/*
 	 * If it wasn't the mouse, try the keyboard and see what joys we have
@@ -218,6 +227,9 @@ void rpc_kbd_io(void)
 	 */
 	while (read(private.kbd_fd, &kb, sizeof(kb)) > 0)
 	{
+		if (vidc_record_mode)
+			vidc_record_input(VIDC_REC_KBD, &kb, sizeof(kb));
+
 		/* The user walloped a key */
 		was_kbd = 1;
 
@@ -257,33 +269,13 @@ void rpc_kbd_io(void)
 		} else
 			continue;
 
-		/*
-		 * Bit of hackery to provide a Xserver kill hot key
-		 *
-		 * Could also be used to enable debug etc.etc.
-		 */
-		if (x_event.u.u.type == KeyPress) {
-			if (x_event.u.u.detail == KEY_BackSpace)
-				controlmask |= 1;
-			else if (x_event.u.u.detail == KEY_RCtrl)
-				controlmask |= 2;
-			else if (x_event.u.u.detail == KEY_AltLang)
-				controlmask |= 4;
-		} else if (x_event.u.u.type == KeyRelease) {
-			if (x_event.u.u.detail == KEY_BackSpace)
-				controlmask &= ~1;
-			else if (x_event.u.u.detail == KEY_RCtrl)
-				controlmask &= ~2;
-			else if (x_event.u.u.detail == KEY_AltLang)
-				controlmask &= ~4;
-		}
-
-		if ((controlmask & 7) == 7)
-			GiveUp(0);
+		/* Server kill and mode switch hot keys */
+		if (vidc_hot_key(x_event.u.u.type, x_event.u.u.detail))
+			continue;
 
 		/* Enqueue the event */
 		x_event.u.u.detail += MIN_KEYCODE;
-		mieqEnqueue(&x_event);
+		vidc_enqueue(&x_event);
 	}
 }
 
@@ -326,7 +318,7 @@ int rpc_init_kbd(void)
 
 	/* Drain the keyboard buffer */
 	do {
-		len = read(private.kbd_fd, &kb, sizeof(kb));
+		len = read(fd, &kb, sizeof(kb));
 	} while (len > 0);
 
 	return fd;
@@ -350,6 +342,7 @@ int rpc_init_screen(ScreenPtr screen, int argc, char **argv)
 
 	if ((private.con_fd = open(CON_PATH, O_RDONLY | O_NONBLOCK)) < 0)
 		return FALSE;
+	vidc_startup_phase("console-open");
 
 	if (ioctl(private.con_fd, CONSOLE_GETVC, &private.rpc_origvc) != 0)
 		FatalError("Couldn't get console number.\n");
@@ -361,11 +354,13 @@ int rpc_init_screen(ScreenPtr screen, int argc, char **argv)
 		FatalError("Couldn't spawn new console\n");
 
 	ErrorF("Spawned console %d\n", nconsole);
+	vidc_startup_phase("console-spawn");
 
 	if (ioctl(private.con_fd, CONSOLE_SWITCHTO, &nconsole) != 0) {
 		ErrorF("Couldn't switch to console %d\n", nconsole);
 		FatalError((char *)sys_errlist[errno]);
 	}
+	vidc_startup_phase("console-switch");
 
 	if (ioctl(private.con_fd, CONSOLE_GETINFO, &consinfo) != 0) {
 		ErrorF("Couldn't get console info for console\n");
@@ -381,10 +376,12 @@ int rpc_init_screen(ScreenPtr screen, int argc, char **argv)
 
 	if (ioctl(private.con_fd, CONSOLE_RESETSCREEN) != 0)
 		FatalError("Couldn't reset console (%d).\n", errno);
+	vidc_startup_phase("console-reset");
 
 	btime = 1;
 	if (ioctl(private.con_fd, CONSOLE_BLANKTIME, &btime) != 0)
 		FatalError("Couldn't set blanktime for console (%d)\n", errno);
+	vidc_startup_phase("console-blanktime");
 
 	if ((private.vram_fd = open(CON_PATH, O_RDWR | O_NONBLOCK, 0)) < 0) {
 		FatalError("Unable to open %s\n", CON_PATH);
@@ -396,9 +393,37 @@ int rpc_init_screen(ScreenPtr screen, int argc, char **argv)
 	private.depth = consinfo.bpp;
 	private.width = (consinfo.width * consinfo.bpp) / 8;
 
+	/* Whatever was in the palette before is no longer ours */
+	vidc_palette_forget();
+
 	return TRUE;
 }
 
+/*
+ * Called on a server reset instead of rpc_init_screen() when we still
+ * have the console from the last generation. If anything has changed
+ * the fds and mapping are dropped and FALSE returned so the caller
+ * does a full initialisation.
+ */
+int rpc_revalidate_screen(void)
+{
+	struct console_info consinfo;
+
+	if (ioctl(private.con_fd, CONSOLE_GETINFO, &consinfo) == 0 &&
+	    consinfo.width == private.xres &&
+	    consinfo.height == private.yres &&
+	    consinfo.bpp == private.depth)
+		return TRUE;
+
+	ErrorF("Console changed over reset, reinitialising\n");
+	munmap(private.vram_base, private.width * private.yres);
+	private.vram_base = NULL;
+	rpc_closedown();
+	close(private.vram_fd);
+	close(private.con_fd);
+	return FALSE;
+}
+
 void rpc_closedown(void)
 {
 	if (private.rpc_origvc != -1) {
@@ -0,0 +1,291 @@
+/*	$NetBSD$	*/
+
+/*
+ * Copyright (c) 1999 Mark Brinicombe & Neil A. Carson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * X11 driver code for VIDC20
+ */
+
+/*
+ * Replay check for the RiscPC mouse's motion coalescing.
+ *
+ * Records a log of motion, button, motion batches through the input
+ * recorder, replays it through rpc_mouse_io() in one read batch and
+ * checks that every button change is preceded by exactly one pointer
+ * move, holding the motion of its own segment and stamped with the
+ * time of that segment's last moving record, and that the motion after
+ * the last change comes out as one final move.
+ *
+ * Logs are in the native record layout, so the log is written by the
+ * test itself before it is replayed; it is left behind in the file
+ * named on the command line (rpcmotion.log by default) to be looked
+ * at or replayed into a real server with -inputreplay.
+ *
+ *	make rpcmotiontest && ./rpcmotiontest
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* X11 headers
+ */
+#include "X.h"
+#include "Xproto.h"
+#include "input.h"
+#include "misc.h"
+
+/* NetBSD headers RiscPC specific */
+#include <machine/mouse.h>
+
+/* Our private definitions */
+#include "private.h"
+
+void rpc_mouse_io(void);
+
+/* What the driver would have been given for each record */
+typedef struct {
+	int	status;		/* button bits */
+	int	x, y;
+	int	ms;		/* time of the record */
+} TestRec;
+
+/* What should come out: a move, or a button change */
+typedef struct {
+	int	type;		/* MotionNotify, ButtonPress, ButtonRelease */
+	int	detail;		/* button */
+	int	dx, dy;
+	int	ms;
+} TestEvent;
+
+/*
+ * A status bit is set while its button is up, and the driver starts
+ * out taking every button as down, so records with no bits set change
+ * nothing. Two moves then the left button going up; three moves, the
+ * last in the same record as the left button going down and the right
+ * going up; a move; the right button going down with no move before
+ * it in its segment; and two trailing moves.
+ */
+static TestRec test_recs[] = {
+	{ 0,		 3,  1, 10 },
+	{ 0,		 2, -4, 20 },
+	{ BUT1STAT,	 0,  0, 30 },
+	{ BUT1STAT,	 5,  0, 40 },
+	{ BUT1STAT,	-1,  2, 50 },
+	{ BUT3STAT,	 1,  1, 60 },
+	{ BUT3STAT,	 4,  4, 70 },
+	{ 0,		 0,  0, 80 },
+	{ 0,		 7,  0, 90 },
+	{ 0,		 1, -1, 100 },
+};
+
+static TestEvent test_expect[] = {
+	{ MotionNotify,	 0,  5,  3, 20 },
+	{ ButtonRelease, 1,  0,  0, 30 },
+	{ MotionNotify,	 0,  5, -3, 60 },
+	{ ButtonPress,	 1,  0,  0, 60 },
+	{ ButtonRelease, 3,  0,  0, 60 },
+	{ MotionNotify,	 0,  4, -4, 70 },
+	{ ButtonPress,	 3,  0,  0, 80 },
+	{ MotionNotify,	 0,  8,  1, 100 },
+};
+
+#define NRECS		(sizeof(test_recs) / sizeof(test_recs[0]))
+#define NEXPECT		(sizeof(test_expect) / sizeof(test_expect[0]))
+
+static TestEvent test_seen[NRECS * 4];
+static int test_nseen;
+
+/*
+ * The parts of the server rpccons.c and vidcrecord.c lean on.
+ */
+struct _private private;
+volatile sig_atomic_t vidc_input_held = 0;
+
+void ErrorF(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+}
+
+void FatalError(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	exit(2);
+}
+
+void vidc_release_input(void)
+{
+	vidc_input_held--;
+}
+
+void vidc_startup_phase(char *phase)
+{
+}
+
+void vidc_palette_forget(void)
+{
+}
+
+void vidc_bell_control(KeybdCtrl *ctrl)
+{
+}
+
+Bool vidc_hot_key(int type, int code)
+{
+	return FALSE;
+}
+
+int vidc_thread_create(pthread_t *thread, void *(*func)(void *), void *arg)
+{
+	return pthread_create(thread, NULL, func, arg);
+}
+
+void vidc_pointer_moved(int *dx, int *dy, CARD32 time)
+{
+	TestEvent *ev;
+
+	if (*dx == 0 && *dy == 0)
+		return;
+	ev = &test_seen[test_nseen++];
+	ev->type = MotionNotify;
+	ev->detail = 0;
+	ev->dx = *dx;
+	ev->dy = *dy;
+	ev->ms = time;
+	*dx = *dy = 0;
+}
+
+void vidc_enqueue(xEvent *event)
+{
+	TestEvent *ev = &test_seen[test_nseen++];
+
+	ev->type = event->u.u.type;
+	ev->detail = event->u.u.detail;
+	ev->dx = ev->dy = 0;
+	ev->ms = event->u.keyButtonPointer.time;
+}
+
+/*
+ * The test proper.
+ */
+static void test_record(char *file)
+{
+	struct mousebufrec mb;
+	int i;
+
+	vidc_record_file = file;
+	vidc_record_mode = VIDC_REC_RECORD;
+	if (!vidc_record_open())
+		FatalError("Can't record to %s\n", file);
+	for (i = 0; i < NRECS; i++) {
+		memset(&mb, 0, sizeof(mb));
+		mb.status = test_recs[i].status;
+		mb.x = test_recs[i].x;
+		mb.y = test_recs[i].y;
+		mb.event_time.tv_sec = test_recs[i].ms / 1000;
+		mb.event_time.tv_usec = test_recs[i].ms % 1000 * 1000;
+		vidc_record_input(VIDC_REC_MOUSE, &mb, sizeof(mb));
+	}
+	vidc_record_close();
+}
+
+static void test_replay(void)
+{
+	int mouse_fd, kbd_fd, queued = 0, tries;
+
+	vidc_record_mode = VIDC_REC_REPLAY;
+	vidc_replay_fast = TRUE;
+	if (!vidc_replay_open(&mouse_fd, &kbd_fd))
+		FatalError("Can't replay %s\n", vidc_record_file);
+	private.mouse_fd = mouse_fd;
+	fcntl(mouse_fd, F_SETFL, O_NONBLOCK);
+
+	/* Let the whole log queue up so it is read as one batch */
+	for (tries = 0; tries < 500; tries++) {
+		if (ioctl(mouse_fd, FIONREAD, &queued) == 0 &&
+		    queued >= NRECS * sizeof(struct mousebufrec))
+			break;
+		usleep(10000);
+	}
+	if (queued < NRECS * sizeof(struct mousebufrec))
+		FatalError("Only %d bytes of the log came through\n", queued);
+	rpc_mouse_io();
+}
+
+static char *test_name(int type)
+{
+	return type == MotionNotify ? "move" :
+	    type == ButtonPress ? "press" : "release";
+}
+
+int main(int argc, char **argv)
+{
+	TestEvent *want, *got;
+	int i, bad = 0;
+
+	test_record(argc > 1 ? argv[1] : "rpcmotion.log");
+	test_replay();
+
+	for (i = 0; i < NEXPECT || i < test_nseen; i++) {
+		want = i < NEXPECT ? &test_expect[i] : NULL;
+		got = i < test_nseen ? &test_seen[i] : NULL;
+		if (want && got && want->type == got->type &&
+		    want->detail == got->detail && want->dx == got->dx &&
+		    want->dy == got->dy && want->ms == got->ms)
+			continue;
+		bad++;
+		if (want)
+			printf("event %d: wanted %s %d %d,%d at %d", i,
+			    test_name(want->type), want->detail, want->dx,
+			    want->dy, want->ms);
+		else
+			printf("event %d: wanted nothing", i);
+		if (got)
+			printf(", got %s %d %d,%d at %d\n",
+			    test_name(got->type), got->detail, got->dx,
+			    got->dy, got->ms);
+		else
+			printf(", got nothing\n");
+	}
+	printf("rpcmotiontest: %d records, %d events, %s\n", NRECS,
+	    test_nseen, bad ? "FAILED" : "ok");
+	return bad ? 1 : 0;
+}
@@ -42,12 +42,16 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <signal.h>
+#include <pthread.h>
 #include <sys/types.h>
+#include <sys/time.h>
 #include <sys/mman.h>
 #include <sys/ioctl.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <string.h>
 #include <errno.h>
 
 /* X11 headers
@@ -65,6 +69,8 @@
 #include "colormap.h"
 #include "colormapst.h"
 #include "resource.h"
+#include "dix.h"
+#include "os.h"
 
 /*#define DEBUG*/
 
@@ -75,6 +81,7 @@
 #endif
 
 /* Keymap, from XFree86*/
+#include "atKeynames.h"
 #include "xf86_keymap.h"
 
 /* Our private definitions */
@@ -85,6 +92,10 @@
 #define SCREEN_DPI_X	75		/* Horizontal dots per inch */
 #define SCREEN_DPI_Y	75		/* Vertical dots per inch */
 
+#ifdef MITSHM
+extern void ShmRegisterFbFuncs(ScreenPtr pScreen);
+#endif
+
 /* Macro to make a null function, given a name! */
 #define NULL_FUNC(_n)void _n(){}
 
@@ -94,29 +105,133 @@ NULL_FUNC(OsVendorInit);
 
 struct _private private;
 
+/* -faststart: overlap device opening with console setup etc. */
+static Bool vidc_fast_start = FALSE;
+
+/* -tracestartup: time stamp each phase of server start up */
+static Bool vidc_trace_startup = FALSE;
+
+/* Set from SIGUSR1 to have the statistics dumped */
+static volatile sig_atomic_t stats_requested = 0;
+
 /*
- * Install a colour map
+ * Held (nested) while the main thread is in something the SIGIO
+ * handler mustn't run in the middle of. The handler just notes that
+ * input came in and vidc_release_input() reads it instead.
  */
-static void install_colour_map(ColormapPtr map)
+volatile sig_atomic_t vidc_input_held = 0;
+static volatile sig_atomic_t input_deferred = 0;
+static unsigned long input_deferrals;
+
+/* -holdbench: time holding input off against masking SIGIO */
+static Bool vidc_hold_bench = FALSE;
+
+/* Thread opening the input devices for -faststart */
+static pthread_t input_open_thread;
+static Bool input_open_started = FALSE;
+
+/*
+ * Log the end of a start up phase, one key=value line per phase so
+ * the output can be picked out of the log and fed to a script. Times
+ * are in microseconds from the first phase logged.
+ */
+void vidc_startup_phase(char *phase)
 {
-	unsigned int cnt;
+	static struct timeval start, last;
+	struct timeval now;
 
-	DPRINTF(("install_colour_map visual %d %d\n", map->pVisual->class,
-	map->pVisual->nplanes));
-	/* If this colour map is already installed, bail */
-	if ((map == private.colour_map) && private.colour_map)
+	if (!vidc_trace_startup)
 		return;
+	gettimeofday(&now, 0);
+	if (start.tv_sec == 0 && start.tv_usec == 0)
+		start = last = now;
+	ErrorF("vidc-startup: gen=%ld phase=%s t_us=%ld dt_us=%ld\n",
+	    (long)serverGeneration, phase,
+	    (long)((now.tv_sec - start.tv_sec) * 1000000 +
+	    (now.tv_usec - start.tv_usec)),
+	    (long)((now.tv_sec - last.tv_sec) * 1000000 +
+	    (now.tv_usec - last.tv_usec)));
+	last = now;
+}
 
-	/* Chuck an event if we're losing a currently installed map */
-	if (private.colour_map)
-		WalkTree(private.colour_map->pScreen, TellLostMap,
-		    (pointer) &private.colour_map->mid);
+/*
+ * Start a helper thread. Signals are blocked while it is created so
+ * it inherits a mask that keeps SIGIO and friends on the main thread;
+ * the input handlers aren't safe to run alongside it.
+ */
+int vidc_thread_create(pthread_t *thread, void *(*func)(void *), void *arg)
+{
+	sigset_t all, old;
+	int ret;
+
+	sigfillset(&all);
+	sigdelset(&all, SIGSEGV);
+	sigdelset(&all, SIGBUS);
+	sigdelset(&all, SIGFPE);
+	sigdelset(&all, SIGILL);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	ret = pthread_create(thread, NULL, func, arg);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	return ret;
+}
+
+/*
+ * The first time the server blocks waiting for clients, the screen
+ * has been painted, which is as near to "first frame" as we can get.
+ */
+static void first_frame_block(pointer data, pointer pTimeout,
+    pointer pReadmask)
+{
+	vidc_startup_phase("first-frame");
+	RemoveBlockAndWakeupHandlers(first_frame_block,
+	    (void (*)())NoopDDA, data);
+}
+
+/*
+ * What we last wrote to each palette entry. The palette survives a
+ * server reset, so this saves reloading it entry by entry each time.
+ */
+static struct {
+	int	valid;
+	int	r, g, b;
+} palette_cache[256];
+
+void write_palette(int c, int r, int g, int b)
+{
+	DPRINTF(("write_palette: %d %d %d %d\n", c, r, g, b));
+	if (c >= 0 && c < 256) {
+		if (palette_cache[c].valid && palette_cache[c].r == r &&
+		    palette_cache[c].g == g && palette_cache[c].b == b)
+			return;
+		palette_cache[c].valid = 1;
+		palette_cache[c].r = r;
+		palette_cache[c].g = g;
+		palette_cache[c].b = b;
+	}
+	if (vidc_export_file)
+		vidc_export_palette(c, r, g, b);
+	private.set_palette(c, r, g, b);
+}
+
+/* Called by a backend when the hardware palette is no longer ours */
+void vidc_palette_forget(void)
+{
+	memset(palette_cache, 0, sizeof(palette_cache));
+}
+
+/*
+ * Load a colour map into the palette. Also used to put the installed
+ * one back after a mode switch.
+ */
+void vidc_load_colour_map(ColormapPtr map)
+{
+	unsigned int cnt;
 
-	/* Set the colours*/
 	if ((map->pVisual->class == PseudoColor
 	    || map->pVisual->class == GrayScale)
 	    && map->pVisual->nplanes == 8) {
-		for (cnt = 0; cnt < map->pVisual->ColormapEntries; cnt ++)
+		for (cnt = 0; cnt < map->pVisual->ColormapEntries &&
+		    cnt < VIDC_PALETTE_SIZE; cnt ++)
 			if (map->red->fShared) {
 				write_palette(cnt,
 				    map->red[cnt].co.shco.red->color >> 8,
@@ -147,10 +262,39 @@ static void install_colour_map(ColormapPtr map)
 			write_palette(cnt, (cnt & 0x3f) << 2,
 			     (cnt & 0x7c) << 1, (cnt & 0xf8));
 	}
+}
+
+/*
+ * Install a colour map
+ */
+static void install_colour_map(ColormapPtr map)
+{
+	unsigned long long start;
+
+	DPRINTF(("install_colour_map visual %d %d\n", map->pVisual->class,
+	map->pVisual->nplanes));
+	/* If this colour map is already installed, bail */
+	if ((map == private.colour_map) && private.colour_map)
+		return;
+
+	/* Chuck an event if we're losing a currently installed map */
+	if (private.colour_map)
+		vidc_cmap_notify(private.colour_map->pScreen,
+		    private.colour_map->mid, TellLostMap);
+
+	if (vidc_tracing)
+		start = vidc_trace_now();
+
+	/* Set the colours*/
+	vidc_load_colour_map(map);
+	if (vidc_tracing)
+		vidc_trace_event(VIDC_TRACE_MAIN, "InstallColormap", -1, start);
 
 	/* Change private colour map pointer, communicate chances and return. */
 	private.colour_map = map;
-	WalkTree(map->pScreen, TellGainedMap, (pointer) &map->mid);
+	if (vidc_rfb_active)
+		vidc_rfb_colours_changed();
+	vidc_cmap_notify(map->pScreen, map->mid, TellGainedMap);
 }
 
 /* Remove a colour map, plopping back the default one if needed.
@@ -190,16 +334,26 @@ static int list_installed_colour_maps(ScreenPtr screen, Colormap *map_list)
  */
 static void store_colours(ColormapPtr map, int colours, xColorItem *defs)
 {
+	unsigned long long start;
+
 	DPRINTF(("store_colours\n"));
 	if (private.colour_map && private.colour_map != map)
 		return;
+	if (vidc_tracing)
+		start = vidc_trace_now();
 
 	while (colours --)
 	{
-		write_palette(defs->pixel, defs->red >> 8, defs->green >> 8,
-		    defs->blue >> 8);
+		/* Packed modes only have the bottom few entries */
+		if (defs->pixel < VIDC_PALETTE_SIZE)
+			write_palette(defs->pixel, defs->red >> 8,
+			    defs->green >> 8, defs->blue >> 8);
 		defs ++;
 	}
+	if (vidc_tracing)
+		vidc_trace_event(VIDC_TRACE_MAIN, "StoreColors", -1, start);
+	if (vidc_rfb_active)
+		vidc_rfb_colours_changed();
 }
 
 #ifdef DPMSExtension
@@ -230,18 +384,14 @@ static Bool mouse_off_screen(ScreenPtr *screen, int *x, int *y)
 }
 
 /* Call the MI pointer warp function, as we're not using a hardware
- * cursor. Block the SIGIO signal while doing this in order make
- * sure we don't get any races.
+ * cursor. Hold input off while doing this in order make sure we
+ * don't get any races.
  */
 static void mouse_warp_cursor(ScreenPtr screen, int x, int y)
 {
-	sigset_t newsigmask;
-
-	sigemptyset(&newsigmask);
-	sigaddset(&newsigmask, SIGIO);
-	sigprocmask(SIG_BLOCK, &newsigmask, 0);
+	VIDC_HOLD_INPUT();
 	miPointerWarpCursor(screen, x, y);
-	sigprocmask(SIG_UNBLOCK, &newsigmask, 0);
+	vidc_release_input();
 }
 
 miPointerScreenFuncRec vidc_mouse_funcs =
@@ -274,7 +424,8 @@ int vidc_mouse(DevicePtr dev, int what)
 		dev->on = FALSE;
 		break;
 	case DEVICE_CLOSE:
-		/* nothing! */
+		/* The fd stays open across a reset, stop feeding this one */
+		private.mouse_dev = NULL;
 		break;
 	default:
 		break;
@@ -347,6 +498,9 @@ static int vidc_kbd(DevicePtr dev, int what)
 		case DEVICE_OFF:
 			dev->on = FALSE;
 			break;
+		case DEVICE_CLOSE:
+			private.kbd_dev = NULL;
+			break;
 		default:
 			break;
 	}
@@ -376,15 +530,206 @@ int mouse_accel(DeviceIntPtr device, int delta)
 }
 
 /*
- * Handler for SIGIO. Called when either the mouse or keyboard fd are
- * read for I/O
+ * Apply motion a backend has gathered up as a single accelerated move
+ * and zero it.
  */
-static void sigio_handler(int flags)
+void vidc_pointer_moved(int *dx, int *dy, CARD32 time)
+{
+	DeviceIntPtr device;
+	int x, y;
+
+	if (*dx == 0 && *dy == 0)
+		return;
+	device = (DeviceIntPtr)LookupPointerDevice();
+	x = mouse_accel(device, *dx);
+	y = mouse_accel(device, *dy);
+	if (x || y)
+		vidc_motion(x, y, time);
+	*dx = *dy = 0;
+}
+
+/*
+ * Hot keys, for backends that produce AT keycodes: BackSpace, right
+ * Ctrl and AltGr kill the server and Ctrl+Alt+keypad plus or minus
+ * step through the -modes list. type is KeyPress or KeyRelease.
+ * Returns TRUE if the key was taken and shouldn't go to clients; the
+ * release of a key whose press was taken is taken too.
+ */
+Bool vidc_hot_key(int type, int code)
+{
+	static int controlmask = 0;
+	static int swallowed = 0;	/* key whose press we took */
+	int bit;
+	Bool taken = FALSE;
+
+	bit = (code == KEY_BackSpace) ? 1 : (code == KEY_RCtrl) ? 2 :
+	    (code == KEY_AltLang) ? 4 : (code == KEY_LCtrl) ? 8 :
+	    (code == KEY_Alt) ? 16 : 0;
+	if (type == KeyPress)
+		controlmask |= bit;
+	else
+		controlmask &= ~bit;
+	if ((controlmask & 7) == 7)
+		GiveUp(0);
+
+	/* Clients that never saw the press mustn't see the release */
+	if (type != KeyPress) {
+		if (code != swallowed)
+			return FALSE;
+		swallowed = 0;
+		return TRUE;
+	}
+	if ((controlmask & (2 | 8)) && (controlmask & (4 | 16))) {
+		if (code == KEY_KP_Plus)
+			taken = vidc_mode_next(1);
+		else if (code == KEY_KP_Minus)
+			taken = vidc_mode_next(-1);
+	}
+	if (taken)
+		swallowed = code;
+	else if (code == swallowed)
+		swallowed = 0;
+	return taken;
+}
+
+/*
+ * Read the mouse and keyboard. Called from SIGIO when either fd is
+ * ready for I/O, or on release if that happened while input was held.
+ */
+static void input_io(void)
 {
+	unsigned long long start;
+
+	/* Between server generations there is nowhere to put events */
+	if (!private.mouse_dev || !private.kbd_dev)
+		return;
+	if (vidc_record_mode == VIDC_REC_REPLAY) {
+		vidc_replay_io();
+		return;
+	}
+	if (vidc_tracing) {
+		if (private.mouse_fd) {
+			start = vidc_trace_now();
+			private.mouse_io();
+			vidc_trace_event(VIDC_TRACE_INPUT, "mouse_io", -1,
+			    start);
+		}
+		if (private.kbd_fd) {
+			start = vidc_trace_now();
+			private.kbd_io();
+			vidc_trace_event(VIDC_TRACE_INPUT, "kbd_io", -1,
+			    start);
+		}
+		vidc_tablet_io();
+		return;
+	}
 	if (private.mouse_fd)
-		rpc_mouse_io();
+		private.mouse_io();
 	if (private.kbd_fd)
-		rpc_kbd_io();
+		private.kbd_io();
+	vidc_tablet_io();
+}
+
+/* Handler for SIGIO */
+static void sigio_handler(int flags)
+{
+	if (vidc_input_held) {
+		input_deferred = 1;
+		return;
+	}
+	input_io();
+}
+
+/*
+ * Let go of input. If any came in while it was held, it is read now,
+ * still held so that another SIGIO can't run the handlers over us.
+ */
+void vidc_release_input(void)
+{
+	while (--vidc_input_held == 0 && input_deferred) {
+		vidc_input_held++;
+		input_deferred = 0;
+		input_deferrals++;
+		input_io();
+	}
+}
+
+/*
+ * Time a hold and release against the pair of sigprocmask() calls it
+ * replaces, and log both.
+ */
+static void hold_bench(void)
+{
+	sigset_t newsigmask, oldsigmask;
+	unsigned long long start, masked, held;
+	int i;
+
+	sigemptyset(&newsigmask);
+	sigaddset(&newsigmask, SIGIO);
+	start = vidc_trace_now();
+	for (i = 0; i < 100000; i++) {
+		sigprocmask(SIG_BLOCK, &newsigmask, &oldsigmask);
+		sigprocmask(SIG_SETMASK, &oldsigmask, 0);
+	}
+	masked = vidc_trace_now() - start;
+	start = vidc_trace_now();
+	for (i = 0; i < 100000; i++) {
+		VIDC_HOLD_INPUT();
+		vidc_release_input();
+	}
+	held = vidc_trace_now() - start;
+	ErrorF("vidc-hold: sigprocmask_ns=%llu hold_ns=%llu\n",
+	    masked / 100000, held / 100000);
+}
+
+/*
+ * Check that an fd kept from the previous server generation is still
+ * usable.
+ */
+static Bool fd_still_open(int fd)
+{
+	return (fd > 0 && fcntl(fd, F_GETFL) != -1);
+}
+
+/*
+ * SIGUSR1 asks for the statistics. They are dumped from the main loop
+ * rather than from the handler.
+ */
+static void stats_handler(int sig)
+{
+	stats_requested = 1;
+}
+
+/* Dump whatever statistics we have to the log
+ */
+void vidc_dump_stats(void)
+{
+	ErrorF("vidc-input: deferred=%lu\n", input_deferrals);
+	vidc_motion_stats();
+	vidc_tablet_stats();
+	vidc_shadow_stats();
+	vidc_mode_stats();
+	vidc_glyph_stats();
+	vidc_bs_stats();
+	vidc_rfb_stats();
+	vidc_pool_stats();
+	vidc_prof_dump();
+}
+
+static void vidc_block_handler(pointer data, pointer pTimeout,
+    pointer pReadmask)
+{
+	if (stats_requested) {
+		stats_requested = 0;
+		vidc_dump_stats();
+	}
+	if (vidc_record_mode == VIDC_REC_REPLAY)
+		vidc_replay_check();
+	else if (vidc_record_mode == VIDC_REC_RECORD)
+		vidc_record_sync();
+	if (vidc_tracing)
+		vidc_trace_check();
+	vidc_mode_check();
 }
 
 /* Start input devices
@@ -392,31 +737,55 @@ static void sigio_handler(int flags)
 void InitInput(int argc, char *argv[])
 {
 	DeviceIntPtr mouse, keyboard;
+	Bool regen = (serverGeneration > 1);
+	Bool reopen;
 
 	DPRINTF(("InitInput\n"));
 
 	/*
-	 * When we support wscons on the RiscPC we need to try
-	 * and open the wsmouse and wskbd devices here
+	 * The devices are left open over a server reset, so only open
+	 * (and drain) them the first time round or if they went away.
 	 */
 
-	/* Try and init the old rpc mouse device */
-	private.mouse_fd = rpc_init_mouse();
-	if (private.mouse_fd == -1) {
-		FatalError("Cannot open mouse device\n");
+	/* With -faststart the devices have already been opened */
+	reopen = !regen;
+	if (vidc_record_mode == VIDC_REC_REPLAY && !regen) {
+		/* Pipes from the input log stand in for the devices */
+		if (!vidc_replay_open(&private.mouse_fd, &private.kbd_fd))
+			FatalError("Cannot replay input log\n");
+		reopen = FALSE;
+	} else if (input_open_started) {
+		pthread_join(input_open_thread, NULL);
+		input_open_started = FALSE;
+		reopen = FALSE;
+		vidc_startup_phase("input-open-join");
+	}
+
+	/* Open the mouse and keyboard through the chosen backend */
+	if (reopen || !fd_still_open(private.mouse_fd)) {
+		private.mouse_fd = private.init_mouse();
+		if (private.mouse_fd == -1) {
+			FatalError("Cannot open mouse device\n");
+		}
 	}
 	
-	/* Try and init the old rpc kbd device */
-	private.kbd_fd = rpc_init_kbd();
-	if (private.kbd_fd == -1) {
-		FatalError("Cannot open kbd device\n");
+	if (reopen || !fd_still_open(private.kbd_fd)) {
+		private.kbd_fd = private.init_kbd();
+		if (private.kbd_fd == -1) {
+			FatalError("Cannot open kbd device\n");
+		}
 	}
 
 	/* Try and init the old rpc beep device */
-	private.beep_fd = rpc_init_bell();
-	if (private.beep_fd == -1) {
-		ErrorF("Cannot open beep device\n");
+	if (vidc_fast_start && !fd_still_open(private.beep_fd))
+		private.beep_fd = VIDC_FD_DEFERRED;
+	else if (!regen || !fd_still_open(private.beep_fd)) {
+		private.beep_fd = private.init_bell();
+		if (private.beep_fd == -1) {
+			ErrorF("Cannot open beep device\n");
+		}
 	}
+	vidc_startup_phase("input-open");
 
 	/* Add the input devices */
 	mouse = AddInputDevice((DeviceProc) vidc_mouse, TRUE);
@@ -432,11 +801,31 @@ void InitInput(int argc, char *argv[])
 	miRegisterPointerDevice(screenInfo.screens[0], mouse);
 	if (!mieqInit(keyboard, mouse))
 		FatalError("mieqInit failed!!\n");
+	if (!vidc_motion_init())
+		FatalError("Can't set up motion delivery\n");
+	RegisterBlockAndWakeupHandlers(vidc_block_handler,
+	    (void (*)())NoopDDA, NULL);
+
+	if (vidc_record_mode == VIDC_REC_RECORD && !regen &&
+	    !vidc_record_open())
+		FatalError("Cannot record input\n");
+
+	if (vidc_tracing)
+		vidc_trace_init();
+
+	if (vidc_rfb_port && !vidc_rfb_init())
+		ErrorF("Cannot export the screen over RFB\n");
 
 	/* Start taking some SIGIOs on input device file descriptors. */
 	fcntl(private.mouse_fd, F_SETFL, O_ASYNC | O_NONBLOCK);
 	fcntl(private.kbd_fd, F_SETFL, O_ASYNC | O_NONBLOCK);
 	signal(SIGIO, sigio_handler);
+	signal(SIGUSR1, stats_handler);
+	if (vidc_hold_bench && !regen)
+		hold_bench();
+	if (vidc_ws_bench_wanted && !regen)
+		vidc_ws_bench();
+	vidc_startup_phase("InitInput");
 }
 
 /* Screen saver. Yeah, right :-)
@@ -448,25 +837,109 @@ static Bool vidc_save_screen(ScreenPtr screen, int on)
 	return FALSE;
 }
 
+/*
+ * A 2 or 4bpp frame buffer shows only the first 4 or 16 of the 8bpp
+ * shadow's colours, so don't let the colour visuals offer any more.
+ * With -modes this has to hold for the shallowest mode too.
+ */
+static void limit_visual_entries(ScreenPtr screen)
+{
+	VisualPtr v;
+	int i, depth = vidc_mode_min_depth();
+
+	if (depth >= 8)
+		return;
+	for (i = 0, v = screen->visuals; i < screen->numVisuals; i++, v++)
+		if (v->nplanes == 8 && (v->class | DynamicClass) != DirectColor)
+			v->ColormapEntries = 1 << depth;
+}
+
+/*
+ * Give cfb16's TrueColor and DirectColor visuals the pixel layout the
+ * screen backend found, if it found one.
+ */
+static void set_visual_masks(ScreenPtr screen)
+{
+	VisualPtr v;
+	unsigned long masks[3];
+	int offsets[3], bits, maxbits = 0;
+	int i, c;
+
+	if (!private.red_mask)
+		return;
+	masks[0] = private.red_mask;
+	masks[1] = private.green_mask;
+	masks[2] = private.blue_mask;
+	for (c = 0; c < 3; c++) {
+		for (offsets[c] = 0; !(masks[c] & (1UL << offsets[c]));
+		    offsets[c]++)
+			;
+		for (bits = 0; masks[c] & (1UL << (offsets[c] + bits)); bits++)
+			;
+		if (bits > maxbits)
+			maxbits = bits;
+	}
+	for (i = 0, v = screen->visuals; i < screen->numVisuals; i++, v++) {
+		if ((v->class | DynamicClass) != DirectColor)
+			continue;
+		v->redMask = masks[0];
+		v->greenMask = masks[1];
+		v->blueMask = masks[2];
+		v->offsetRed = offsets[0];
+		v->offsetGreen = offsets[1];
+		v->offsetBlue = offsets[2];
+		v->ColormapEntries = 1 << maxbits;
+	}
+}
+
+/*
+ * Touch every page of a mapping so the faults are taken up front.
+ */
+static void prefault(char *base, size_t len)
+{
+	volatile char *p;
+	long pagesize = getpagesize();
+
+	madvise(base, len, MADV_WILLNEED);
+	for (p = base; p < base + len; p += pagesize)
+		(void)*p;
+}
+
 /*
  * 
  */
 int vidc_init_screen(int index, ScreenPtr screen, int argc, char **argv)
 {
 	extern int defaultColorVisualClass;
+	int render_depth;
+	char *fb_base;
+
 	/*
-	 * When we support wscons on the RiscPC we need to try
-	 * and open the wsmouse and wskbd devices here
+	 * On a server reset the console, the mapping and the palette are
+	 * all still set up from the last generation, so just check the
+	 * console hasn't changed under us and carry on.
 	 */
+	if (serverGeneration > 1 && private.vram_base &&
+	    private.revalidate_screen()) {
+		DPRINTF(("vidc_init_screen: reusing frame buffer\n"));
+	} else {
+		if (!private.init_screen(screen, argc, argv))
+			FatalError("Unabled to initialize frame buffer\n");
+
+		if ((private.vram_base = mmap(0, private.width * private.yres,
+			PROT_READ | PROT_WRITE, MAP_FILE | MAP_SHARED,
+			private.vram_fd, 0)) == MAP_FAILED) {
+			FatalError("Unable to mmap frame buffer\n");
+			return FALSE;
+		}
+		vidc_startup_phase("mmap");
 
-	if (!rpc_init_screen(screen, argc, argv))
-		FatalError("Unabled to initialize frame buffer\n");
-
-	if ((private.vram_base = mmap(0, private.width * private.yres,
-		PROT_READ | PROT_WRITE, MAP_FILE | MAP_SHARED, private.vram_fd,
-		0)) == MAP_FAILED) {
-		FatalError("Unable to mmap frame buffer\n");
-		return FALSE;
+		/* Take the page faults now rather than on first draw */
+		if (vidc_fast_start) {
+			prefault(private.vram_base,
+			    private.width * private.yres);
+			vidc_startup_phase("prefault");
+		}
 	}
 
 	/* Set the palette for blackpixel and whitepixel */
@@ -474,10 +947,28 @@ int vidc_init_screen(int index, ScreenPtr screen, int argc, char **argv)
 	write_palette(0, 255, 255, 255);*/
 	private.colour_map = 0;
 
-	switch (private.depth) {
+	/*
+	 * cfb can't draw at 2 or 4 bpp so for those modes we render at
+	 * 8bpp into a shadow and pack it down into the frame buffer.
+	 */
+	render_depth = private.depth;
+	private.shadow_base = NULL;
+	if (private.depth == 2 || private.depth == 4)
+		render_depth = 8;
+	if (render_depth != private.depth ||
+	    (vidc_shadow_wanted && render_depth != 1)) {
+		if (!vidc_shadow_alloc(render_depth))
+			FatalError("Unable to allocate shadow frame buffer\n");
+		fb_base = private.shadow_base;
+	} else
+		fb_base = private.vram_base;
+
+	vidc_startup_phase("shadow");
+
+	switch (render_depth) {
 	case 1:
 		DPRINTF(("mfbScreenInit\n"));
-		if (!mfbScreenInit(screen, (pointer) private.vram_base,
+		if (!mfbScreenInit(screen, (pointer) fb_base,
 		    private.xres, private.yres, SCREEN_DPI_X, SCREEN_DPI_Y,
 		    private.xres)) {
 			close(private.vram_fd);
@@ -487,7 +978,7 @@ int vidc_init_screen(int index, ScreenPtr screen, int argc, char **argv)
 		break;	
 	case 8:
 		DPRINTF(("cfbScreenInit\n"));
-		if (!cfbScreenInit(screen, (pointer) private.vram_base,
+		if (!cfbScreenInit(screen, (pointer) fb_base,
 		    private.xres, private.yres, SCREEN_DPI_X, SCREEN_DPI_Y,
 		    private.xres)) {
 			close(private.vram_fd);
@@ -498,18 +989,57 @@ int vidc_init_screen(int index, ScreenPtr screen, int argc, char **argv)
 	case 16:
 		DPRINTF(("cfb16ScreenInit\n"));
 		defaultColorVisualClass = TrueColor;
-		if (!cfb16ScreenInit(screen, (pointer) private.vram_base,
+		if (!cfb16ScreenInit(screen, (pointer) fb_base,
 		    private.xres, private.yres, SCREEN_DPI_X, SCREEN_DPI_Y,
 		    private.xres)) {
 			close(private.vram_fd);
 			return FALSE;
 		}
+		set_visual_masks(screen);
 		DPRINTF(("cfb16ScreenInit done\n"));
 		break;
 	default:
 		FatalError("%d bpp not supported\n", private.depth);
 		break;
 	}
+	vidc_startup_phase("fb-screen-init");
+
+	/* Before the default colour map is made to the visual's size */
+	vidc_mode_init(screen);
+	if (render_depth == 8)
+		limit_visual_entries(screen);
+
+	/* Threads to share big flushes and fills out over */
+	if (vidc_pool_threads > 1 && !vidc_pool_init())
+		ErrorF("Can't start helper threads, drawing on one\n");
+
+	/* Faster solid fills and copies than cfb's own */
+	if (vidc_accel_wanted && render_depth != 1 &&
+	    !vidc_accel_init(screen, render_depth)) {
+		ErrorF("Can't install accelerated ops, using cfb's\n");
+		vidc_accel_wanted = FALSE;
+	}
+
+#ifdef MITSHM
+	/*
+	 * Shared memory images are laid out just like our pixmaps, so let
+	 * MIT-SHM use the segments in place: ShmPutImage becomes a single
+	 * CopyArea from the segment and shared pixmaps are drawn directly.
+	 */
+	ShmRegisterFbFuncs(screen);
+#endif
+
+	/* Backing store and save-unders out of a bounded pool */
+	if (!vidc_bs_init(screen))
+		ErrorF("Can't set up backing store\n");
+
+	/*
+	 * Profile the drawing ops. This goes on after accel, MIT-SHM and
+	 * backing store, so the times include those layers as well as
+	 * cfb; the shadow's damage tracking goes on later and isn't in.
+	 */
+	if ((vidc_profile || vidc_tracing) && !vidc_prof_init(screen))
+		ErrorF("Can't install profiling, carrying on without\n");
 	
 	screen->InstallColormap = install_colour_map;
 	screen->UninstallColormap = uninstall_colour_map;
@@ -517,11 +1047,26 @@ int vidc_init_screen(int index, ScreenPtr screen, int argc, char **argv)
 	screen->StoreColors = store_colours;
 	screen->SaveScreen = vidc_save_screen;
 
+	/* Index windows by colour map so installs needn't walk the tree */
+	if (!vidc_cmap_init(screen))
+		ErrorF("Can't index colour maps, falling back to tree walks\n");
+
 	if (!miDCInitialize(screen, &vidc_mouse_funcs)) {
 		FatalError("Can't initialise MI pointer device context\n");
 		return FALSE;
 	}
-	switch (private.depth) {
+	vidc_startup_phase("pointer-init");
+	if (private.shadow_base && !vidc_shadow_init(screen)) {
+		FatalError("Can't initialise shadow frame buffer\n");
+		return FALSE;
+	}
+	if (vidc_export_file) {
+		if (private.shadow_base)
+			vidc_export_init(screen);
+		else
+			ErrorF("No shadow at 1bpp, so nothing to export\n");
+	}
+	switch (render_depth) {
 	case 1:
 		if (!mfbCreateDefColormap(screen)) {
 			FatalError("Can't create default colour map\n");
@@ -536,15 +1081,97 @@ int vidc_init_screen(int index, ScreenPtr screen, int argc, char **argv)
 		}
 		break;
 	}
+	vidc_startup_phase("colormap");
+
+	if (vidc_tile_bench_wanted && serverGeneration == 1)
+		vidc_tile_bench();
+	if (vidc_cmap_bench_wanted && serverGeneration == 1)
+		vidc_cmap_bench(screen);
+	if (vidc_accel_bench_wanted && vidc_accel_wanted &&
+	    render_depth != 1 && serverGeneration == 1)
+		vidc_accel_bench(screen);
+	if (vidc_glyph_bench_wanted && vidc_accel_wanted &&
+	    vidc_glyph_cache_kb > 0 && render_depth != 1 &&
+	    serverGeneration == 1)
+		vidc_glyph_bench(screen);
+	if (vidc_shadow_bench_wanted && private.shadow_base &&
+	    serverGeneration == 1)
+		vidc_shadow_bench();
+
+	if (vidc_trace_startup)
+		RegisterBlockAndWakeupHandlers(first_frame_block,
+		    (void (*)())NoopDDA, NULL);
 	return TRUE;
 }
 
+/*
+ * Open the input devices for -faststart. Runs in its own thread while
+ * the console is being set up; the results are picked up by InitInput().
+ */
+static void *open_input_devices(void *arg)
+{
+	private.mouse_fd = private.init_mouse();
+	private.kbd_fd = private.init_kbd();
+	return NULL;
+}
+
 /*
  * Main output init call
  */
 void InitOutput(ScreenInfo *info, int argc, char **argv)
 {
 	DPRINTF(("InitOutput\n"));
+	vidc_startup_phase("InitOutput");
+
+	if (vidc_tracing)
+		vidc_trace_alloc();
+
+	/* Pick the console and input backends */
+	if (vidc_fbdev_path) {
+		private.init_screen = fb_init_screen;
+		private.revalidate_screen = fb_revalidate_screen;
+		private.closedown = fb_closedown;
+		private.set_palette = fb_set_palette;
+		private.init_bell = fb_init_bell;
+		private.beep = fb_beep;
+		private.set_mode = fb_set_mode;
+		private.init_mouse = fb_init_mouse;
+		private.init_kbd = fb_init_kbd;
+		private.mouse_io = fb_mouse_io;
+		private.kbd_io = fb_kbd_io;
+	} else {
+		private.init_screen = rpc_init_screen;
+		private.revalidate_screen = rpc_revalidate_screen;
+		private.closedown = rpc_closedown;
+		private.set_palette = rpc_set_palette;
+		private.init_bell = rpc_init_bell;
+		private.beep = rpc_beep;
+		private.set_mode = NULL;
+		private.init_mouse = rpc_init_mouse;
+		private.init_kbd = rpc_init_kbd;
+		private.mouse_io = rpc_mouse_io;
+		private.kbd_io = rpc_kbd_io;
+	}
+	if (vidc_wscons) {
+		private.init_mouse = ws_init_mouse;
+		private.init_kbd = ws_init_kbd;
+		private.mouse_io = ws_mouse_io;
+		private.kbd_io = ws_kbd_io;
+	}
+
+	/*
+	 * Opening and draining the input devices doesn't depend on the
+	 * console, so with -faststart do it alongside the console set up.
+	 * InitInput() waits for it to finish.
+	 */
+	if (vidc_fast_start && serverGeneration == 1 &&
+	    vidc_record_mode != VIDC_REC_REPLAY) {
+		if (vidc_thread_create(&input_open_thread,
+		    open_input_devices, NULL) == 0)
+			input_open_started = TRUE;
+		else
+			ErrorF("Can't start input open thread\n");
+	}
 
 	/* Set up the screen information record */
 	info->imageByteOrder = IMAGE_BYTE_ORDER;
@@ -573,7 +1200,9 @@ void AbortDDX(void)
 {
 	DPRINTF(("AbortDDX\n"));
 
-	rpc_closedown();
+	if (private.closedown)
+		private.closedown();
+	vidc_record_close();
 
 	if (private.vram_fd != 0)
 		close(private.vram_fd);
@@ -603,7 +1232,9 @@ Bool LegalModifier(unsigned int key, DevicePtr device)
  */
 void ProcessInputEvents(void)
 {
+	vidc_motion_caught_up();
 	mieqProcessInputEvents();
+	vidc_tablet_process();
 	miPointerUpdate();
 }
 
@@ -613,13 +1244,229 @@ void ddxUseMsg(void)
 {
 	ErrorF("\nvidc dependent information:-\n");
 	ErrorF("- *** PRE-RELEASE SERVER, USE AT YOUR OWN RISK ***\n");
+	ErrorF("-shadow                draw into a RAM shadow at 8/16bpp\n");
+	ErrorF("-shadowfault           shadow, finding damage by write faults\n");
+	ErrorF("-export file           share the shadow with other programs\n");
+	ErrorF("-flushthreads n        spread big flushes and fills over n threads\n");
+	ErrorF("-flushbench            time shadow flushes on 1 to n threads\n");
+	ErrorF("-faststart             overlap device set up, defer the bell\n");
+	ErrorF("-tracestartup          log timestamps for each start up phase\n");
+	ErrorF("-bellmerge ms          merge bells closer together than this\n");
+	ErrorF("-motionlag ms          merge motion when input is this far behind\n");
+	ErrorF("-inputrecord file      log raw input records to file\n");
+	ErrorF("-inputreplay file      take input from a log instead of devices\n");
+	ErrorF("-replayfast            replay as fast as possible, not real time\n");
+	ErrorF("-noaccel               use cfb for all drawing\n");
+	ErrorF("-glyphcache kb         memory for expanded glyphs, 0 for none\n");
+	ErrorF("-bspool kb             memory for backing store, 0 for none\n");
+	ErrorF("-tilebench             time tile hash scans at start up\n");
+	ErrorF("-cmapbench             time colour map notifies on a big tree\n");
+	ErrorF("-accelbench            time accelerated fills and copies\n");
+	ErrorF("-glyphbench            time ImageText through the glyph cache\n");
+	ErrorF("-rfb port              serve the screen to an RFB viewer on port\n");
+	ErrorF("-rfball                accept RFB viewers from anywhere\n");
+	ErrorF("-holdbench             time input holds against sigprocmask\n");
+	ErrorF("-wscons                read input from wsmouse and wskbd\n");
+	ErrorF("-wsmouse file          wsmouse device (or fifo) to use\n");
+	ErrorF("-wskbd file            wskbd device (or fifo) to use\n");
+	ErrorF("-wsbench               time batched wscons event reads\n");
+	ErrorF("-fbdev file            use a Linux frame buffer device (or file)\n");
+	ErrorF("-fbsize WxHxD          geometry when -fbdev is a plain file\n");
+	ErrorF("-evmouse file          evdev mouse (or fifo) for -fbdev\n");
+	ErrorF("-evkbd file            evdev keyboard (or fifo) for -fbdev\n");
+	ErrorF("-modes WxHxD,...       modes Ctrl+Alt+keypad +/- switch between\n");
+	ErrorF("-tablet file           evdev tablet (or fifo) as an XInput device\n");
+	ErrorF("-profile               count time spent in drawing ops\n");
+	ErrorF("-trace file            write a timeline trace to file on SIGUSR2\n");
 }
 
 /* Process a command line argument in case we want to support
- * some extra ones. We don't :-)
+ * some extra ones.
  */
 int ddxProcessArgument(int argc, char **argv, int i)
 {
+	if (strcmp(argv[i], "-shadow") == 0) {
+		vidc_shadow_wanted = TRUE;
+		return 1;
+	}
+	if (strcmp(argv[i], "-shadowfault") == 0) {
+		vidc_shadow_wanted = TRUE;
+		vidc_shadow_damage_mode = VIDC_DAMAGE_FAULT;
+		return 1;
+	}
+	if (strcmp(argv[i], "-export") == 0) {
+		if (++i >= argc)
+			UseMsg();
+		vidc_shadow_wanted = TRUE;
+		vidc_export_file = argv[i];
+		return 2;
+	}
+	if (strcmp(argv[i], "-flushthreads") == 0) {
+		if (++i >= argc)
+			UseMsg();
+		vidc_pool_threads = atoi(argv[i]);
+		return 2;
+	}
+	if (strcmp(argv[i], "-flushbench") == 0) {
+		vidc_shadow_bench_wanted = TRUE;
+		return 1;
+	}
+	if (strcmp(argv[i], "-faststart") == 0) {
+		vidc_fast_start = TRUE;
+		return 1;
+	}
+	if (strcmp(argv[i], "-tracestartup") == 0) {
+		vidc_trace_startup = TRUE;
+		return 1;
+	}
+	if (strcmp(argv[i], "-bellmerge") == 0) {
+		if (++i >= argc)
+			UseMsg();
+		vidc_bell_merge_ms = atoi(argv[i]);
+		return 2;
+	}
+	if (strcmp(argv[i], "-motionlag") == 0) {
+		if (++i >= argc)
+			UseMsg();
+		vidc_motion_lag_ms = atoi(argv[i]);
+		return 2;
+	}
+	if (strcmp(argv[i], "-inputrecord") == 0) {
+		if (++i >= argc)
+			UseMsg();
+		vidc_record_mode = VIDC_REC_RECORD;
+		vidc_record_file = argv[i];
+		return 2;
+	}
+	if (strcmp(argv[i], "-inputreplay") == 0) {
+		if (++i >= argc)
+			UseMsg();
+		vidc_record_mode = VIDC_REC_REPLAY;
+		vidc_record_file = argv[i];
+		return 2;
+	}
+	if (strcmp(argv[i], "-replayfast") == 0) {
+		vidc_replay_fast = TRUE;
+		return 1;
+	}
+	if (strcmp(argv[i], "-noaccel") == 0) {
+		vidc_accel_wanted = FALSE;
+		return 1;
+	}
+	if (strcmp(argv[i], "-glyphcache") == 0) {
+		if (++i >= argc)
+			UseMsg();
+		vidc_glyph_cache_kb = atoi(argv[i]);
+		return 2;
+	}
+	if (strcmp(argv[i], "-bspool") == 0) {
+		if (++i >= argc)
+			UseMsg();
+		vidc_bs_pool_kb = atoi(argv[i]);
+		return 2;
+	}
+	if (strcmp(argv[i], "-tilebench") == 0) {
+		vidc_tile_bench_wanted = TRUE;
+		return 1;
+	}
+	if (strcmp(argv[i], "-cmapbench") == 0) {
+		vidc_cmap_bench_wanted = TRUE;
+		return 1;
+	}
+	if (strcmp(argv[i], "-accelbench") == 0) {
+		vidc_accel_bench_wanted = TRUE;
+		return 1;
+	}
+	if (strcmp(argv[i], "-glyphbench") == 0) {
+		vidc_glyph_bench_wanted = TRUE;
+		return 1;
+	}
+	if (strcmp(argv[i], "-rfb") == 0) {
+		if (++i >= argc)
+			UseMsg();
+		vidc_rfb_port = atoi(argv[i]);
+		return 2;
+	}
+	if (strcmp(argv[i], "-rfball") == 0) {
+		vidc_rfb_any = TRUE;
+		return 1;
+	}
+	if (strcmp(argv[i], "-holdbench") == 0) {
+		vidc_hold_bench = TRUE;
+		return 1;
+	}
+	if (strcmp(argv[i], "-wscons") == 0) {
+		vidc_wscons = TRUE;
+		return 1;
+	}
+	if (strcmp(argv[i], "-wsmouse") == 0) {
+		if (++i >= argc)
+			UseMsg();
+		vidc_wscons = TRUE;
+		vidc_wsmouse_path = argv[i];
+		return 2;
+	}
+	if (strcmp(argv[i], "-wskbd") == 0) {
+		if (++i >= argc)
+			UseMsg();
+		vidc_wscons = TRUE;
+		vidc_wskbd_path = argv[i];
+		return 2;
+	}
+	if (strcmp(argv[i], "-fbdev") == 0) {
+		if (++i >= argc)
+			UseMsg();
+		vidc_fbdev_path = argv[i];
+		return 2;
+	}
+	if (strcmp(argv[i], "-fbsize") == 0) {
+		if (++i >= argc)
+			UseMsg();
+		if (sscanf(argv[i], "%dx%dx%d", &vidc_fb_xres, &vidc_fb_yres,
+		    &vidc_fb_depth) != 3)
+			UseMsg();
+		return 2;
+	}
+	if (strcmp(argv[i], "-modes") == 0) {
+		if (++i >= argc)
+			UseMsg();
+		vidc_shadow_wanted = TRUE;
+		vidc_modes_spec = argv[i];
+		return 2;
+	}
+	if (strcmp(argv[i], "-evmouse") == 0) {
+		if (++i >= argc)
+			UseMsg();
+		vidc_evmouse_path = argv[i];
+		return 2;
+	}
+	if (strcmp(argv[i], "-evkbd") == 0) {
+		if (++i >= argc)
+			UseMsg();
+		vidc_evkbd_path = argv[i];
+		return 2;
+	}
+	if (strcmp(argv[i], "-tablet") == 0) {
+		if (++i >= argc)
+			UseMsg();
+		vidc_tablet_path = argv[i];
+		return 2;
+	}
+	if (strcmp(argv[i], "-wsbench") == 0) {
+		vidc_ws_bench_wanted = TRUE;
+		return 1;
+	}
+	if (strcmp(argv[i], "-profile") == 0) {
+		vidc_profile = TRUE;
+		return 1;
+	}
+	if (strcmp(argv[i], "-trace") == 0) {
+		if (++i >= argc)
+			UseMsg();
+		vidc_tracing = TRUE;
+		vidc_trace_file = argv[i];
+		return 2;
+	}
 	return 0;
 }
 
@@ -636,69 +1483,3 @@ GetTimeInMillis()
     gettimeofday(&tp, 0);
     return(tp.tv_sec * 1000) + (tp.tv_usec / 1000);
 }
-
-/* dummy functions to link X server with X input Extension */
-void
-AddOtherInputDevices ()    
-{
-}
-
-void
-OpenInputDevice (dev, client, status)
-    DeviceIntPtr dev;
-    ClientPtr client;
-    int *status;
-{
-}
-int
-SetDeviceValuators (client, dev, valuators, first_valuator, num_valuators)
-     register ClientPtr client;
-     DeviceIntPtr       dev;
-     int                *valuators;
-     int                first_valuator;
-     int                num_valuators;
-{
-	return BadMatch;
-}
-
-int
-SetDeviceMode (client, dev, mode)
-     register   ClientPtr       client;
-     DeviceIntPtr dev;
-     int                mode;
-{    
-	return BadMatch;
-}
-
-int
-ChangeKeyboardDevice (old_dev, new_dev) 
-     DeviceIntPtr       old_dev;
-     DeviceIntPtr       new_dev;
-{
-  /**********************************************************************
-   * DeleteFocusClassDeviceStruct(old_dev);      * defined in xchgptr.c *
-   **********************************************************************/
-  return !Success;
-} 
-
-int ChangePointerDevice (old_dev, new_dev, x, y)
-     DeviceIntPtr       old_dev, new_dev;
-     unsigned char      x, y;
-{     
-	return !Success;
-}
-
-void CloseInputDevice (d, client)
-     DeviceIntPtr d;
-     ClientPtr client;
-{     
-}   
-
- 
-int ChangeDeviceControl (client, dev, control)
-     register ClientPtr client;
-     DeviceIntPtr       dev;
-     void         *control;  
-{    
-	return (BadMatch);
-}
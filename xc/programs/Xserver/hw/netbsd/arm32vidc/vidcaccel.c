@@ -0,0 +1,957 @@
+/*	$NetBSD$	*/
+
+/*
+ * Copyright (c) 1999 Mark Brinicombe & Neil A. Carson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * X11 driver code for VIDC20
+ */
+
+/*
+ * Solid fills and copies for 8 and 16bpp.
+ *
+ * cfb's general code does a read-modify-write per word and works a
+ * pixel at a time at the edges. For the common case of a GXcopy GC
+ * with all planes enabled we can do better: fills never read the
+ * frame buffer and store four words at a time, and copies go a whole
+ * row at a time through memmove, which is tuned for the CPU.
+ *
+ * We wrap the GC funcs above mi's backing store, which wraps cfb's.
+ * After they have validated a GC we give it a private copy of cfb's
+ * ops with FillSpans, PolyFillRect and CopyArea swapped for ours, or
+ * leave the ops alone if the GC isn't one we can handle. Those below
+ * us only ever see their own ops. The glyph ops from vidcglyph.c are
+ * put in the same way. GCs drawing to a window with backing store
+ * have mi's backing store ops, which also draw into the saved
+ * pixmaps, so those are always left alone.
+ *
+ * Tiled fills, window backgrounds and big ZPixmap PutImages are done
+ * here too. Anything covering enough pixels is cut into bands of lines
+ * and painted by the pool threads (-flushthreads), each band walking
+ * the same boxes clipped to its own lines, so no two threads touch the
+ * same pixels; the op returns once every band is done.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+
+/* X11 headers
+ */
+#include "X.h"
+#include "Xproto.h"
+#include "misc.h"
+#include "scrnintstr.h"
+#include "windowstr.h"
+#include "pixmapstr.h"
+#include "regionstr.h"
+#include "gcstruct.h"
+#include "mi.h"
+#include "cfb.h"
+
+/* Our private definitions */
+#include "private.h"
+
+/*#define DEBUG*/
+
+#ifdef DEBUG
+#define DPRINTF(x) ErrorF x
+#else
+#define DPRINTF(x)
+#endif
+
+Bool vidc_accel_wanted = TRUE;
+
+/* cfb16's names for the things we borrow from cfb */
+extern int cfb16GCPrivateIndex;
+extern RegionPtr cfb16BitBlt();
+
+/* Ops covering more pixels than this are split over the pool threads */
+#define ACCEL_PARALLEL_PIXELS	(64 * 1024)
+
+/* Lines in each band handed to the pool */
+#define ACCEL_BAND_LINES	8
+
+/* Wrapped screen functions */
+static CloseScreenProcPtr		accel_close_screen_wrap;
+static CreateGCProcPtr			accel_create_gc_wrap;
+static PaintWindowBackgroundProcPtr	accel_paint_background_wrap;
+
+static int accel_gc_index;
+static int accel_cfb_gc_index;
+static RegionPtr (*accel_bitblt)();
+
+typedef struct {
+	GCFuncs	*wrapFuncs;
+	GCOps	*cfbOps;	/* cfb's ops for the GC */
+	GCOps	ops;		/* cfb's ops with ours put in */
+	Bool	fast;		/* ops is in use */
+} AccelGCRec, *AccelGCPtr;
+
+#define ACCEL_GC(pGC) \
+	((AccelGCPtr)(pGC)->devPrivates[accel_gc_index].ptr)
+
+#define ACCEL_CLIP(pGC) \
+	(((cfbPrivGCPtr)(pGC)->devPrivates[accel_cfb_gc_index].ptr)-> \
+	    pCompositeClip)
+
+/* Where to draw and what with */
+typedef struct {
+	unsigned char	*base;
+	int		stride;
+	int		bpp;	/* bytes per pixel */
+	CARD32		fill;	/* pixel replicated across a word */
+} AccelDst;
+
+static void accel_drawable_bits(DrawablePtr pDraw, unsigned char **base,
+    int *stride)
+{
+	PixmapPtr pPix;
+
+	if (pDraw->type == DRAWABLE_WINDOW)
+		pPix = (PixmapPtr)pDraw->pScreen->devPrivate;
+	else
+		pPix = (PixmapPtr)pDraw;
+	*base = (unsigned char *)pPix->devPrivate.ptr;
+	*stride = pPix->devKind;
+}
+
+static void accel_setup(AccelDst *dst, DrawablePtr pDraw,
+    unsigned long pixel)
+{
+	accel_drawable_bits(pDraw, &dst->base, &dst->stride);
+	dst->bpp = pDraw->bitsPerPixel >> 3;
+	if (dst->bpp == 1) {
+		dst->fill = pixel & 0xff;
+		dst->fill |= dst->fill << 8;
+	} else
+		dst->fill = pixel & 0xffff;
+	dst->fill |= dst->fill << 16;
+}
+
+/*
+ * Fill a row of bytes. The byte stores at the ends pick their part
+ * of the (little endian) word by address so 16bpp comes out right.
+ */
+static void accel_fill_row(unsigned char *dst, int bytes, CARD32 fill)
+{
+	CARD32 *wdst;
+
+	while (((unsigned long)dst & 3) && bytes) {
+		*dst = fill >> (((unsigned long)dst & 3) << 3);
+		dst++;
+		bytes--;
+	}
+	wdst = (CARD32 *)dst;
+	for (; bytes >= 16; bytes -= 16) {
+		wdst[0] = fill;
+		wdst[1] = fill;
+		wdst[2] = fill;
+		wdst[3] = fill;
+		wdst += 4;
+	}
+	for (; bytes >= 4; bytes -= 4)
+		*wdst++ = fill;
+	dst = (unsigned char *)wdst;
+	while (bytes--) {
+		*dst = fill >> (((unsigned long)dst & 3) << 3);
+		dst++;
+	}
+}
+
+static void accel_fill_box(AccelDst *dst, BoxPtr pbox)
+{
+	unsigned char *p;
+	int bytes = (pbox->x2 - pbox->x1) * dst->bpp;
+	int h;
+
+	p = dst->base + pbox->y1 * dst->stride + pbox->x1 * dst->bpp;
+	for (h = pbox->y2 - pbox->y1; h--; p += dst->stride)
+		accel_fill_row(p, bytes, dst->fill);
+}
+
+/*
+ * A fill or image, as a list of rectangles (or the whole of the clip
+ * if there are none) clipped to a region, and how to paint each box.
+ */
+typedef struct _AccelJob AccelJob;
+struct _AccelJob {
+	AccelDst	dst;
+	void		(*paint)(AccelJob *job, BoxPtr pbox);
+	ScreenPtr	screen;
+	RegionPtr	clip;
+	xRectangle	*prect;		/* drawable relative, or NULL */
+	int		nrect;
+	int		xorg, yorg;	/* drawable origin */
+	int		y1, y2;		/* lines painted */
+
+	/* Tiles: the tile and the screen position of its origin */
+	unsigned char	*tile;
+	int		tile_stride, tile_w, tile_h;
+	int		tile_x, tile_y;
+
+	/* Images: the bits and the screen position of their origin */
+	unsigned char	*image;
+	int		image_stride;
+	int		image_x, image_y;
+};
+
+static void accel_paint_solid(AccelJob *job, BoxPtr pbox)
+{
+	accel_fill_box(&job->dst, pbox);
+}
+
+/* Bytes of a tile row built up in RAM to copy out from */
+#define ACCEL_TILE_ROW		512
+
+/*
+ * Copy bytes of a row of a tile period bytes wide to d, starting at
+ * offset start into it.
+ */
+static void accel_tile_row(unsigned char *d, unsigned char *s, int period,
+    int start, int bytes)
+{
+	int n;
+
+	while (bytes > 0) {
+		n = min(period - start, bytes);
+		memcpy(d, s + start, n);
+		d += n;
+		bytes -= n;
+		start = 0;
+	}
+}
+
+/*
+ * Tile a box. Narrow tiles are repeated out into a row in RAM, which
+ * is then copied out as often as it fits; wide ones are copied
+ * straight from the tile. Neither reads the destination, which may
+ * be the frame buffer.
+ */
+static void accel_paint_tile(AccelJob *job, BoxPtr pbox)
+{
+	int bpp = job->dst.bpp;
+	int bytes = (pbox->x2 - pbox->x1) * bpp;
+	int period = job->tile_w * bpp;
+	int chunk = ACCEL_TILE_ROW / period * period;
+	int tx, ty, h, len, done, n;
+	unsigned char *d, *s;
+	unsigned char row[ACCEL_TILE_ROW];
+
+	tx = (pbox->x1 - job->tile_x) % job->tile_w;
+	if (tx < 0)
+		tx += job->tile_w;
+	ty = (pbox->y1 - job->tile_y) % job->tile_h;
+	if (ty < 0)
+		ty += job->tile_h;
+	len = min(chunk, bytes);
+	d = job->dst.base + pbox->y1 * job->dst.stride + pbox->x1 * bpp;
+	for (h = pbox->y2 - pbox->y1; h--; d += job->dst.stride) {
+		s = job->tile + ty * job->tile_stride;
+		if (chunk > period) {
+			/* len is whole periods, so each copy starts at tx */
+			accel_tile_row(row, s, period, tx * bpp, len);
+			for (done = 0; done < bytes; done += n) {
+				n = min(len, bytes - done);
+				memcpy(d + done, row, n);
+			}
+		} else
+			accel_tile_row(d, s, period, tx * bpp, bytes);
+		if (++ty == job->tile_h)
+			ty = 0;
+	}
+}
+
+static void accel_paint_image(AccelJob *job, BoxPtr pbox)
+{
+	int bpp = job->dst.bpp;
+	int bytes = (pbox->x2 - pbox->x1) * bpp;
+	unsigned char *d, *s;
+	int h;
+
+	d = job->dst.base + pbox->y1 * job->dst.stride + pbox->x1 * bpp;
+	s = job->image + (pbox->y1 - job->image_y) * job->image_stride +
+	    (pbox->x1 - job->image_x) * bpp;
+	for (h = pbox->y2 - pbox->y1; h--; d += job->dst.stride,
+	    s += job->image_stride)
+		memcpy(d, s, bytes);
+}
+
+/*
+ * Paint the part of a job that falls in lines ylo to yhi.
+ */
+static void accel_walk(AccelJob *job, int ylo, int yhi)
+{
+	BoxPtr extents = REGION_EXTENTS(job->screen, job->clip);
+	BoxPtr pclip;
+	BoxRec box, part;
+	xRectangle *prect;
+	int n, nclip;
+
+	if (job->prect == NULL) {
+		nclip = REGION_NUM_RECTS(job->clip);
+		for (pclip = REGION_RECTS(job->clip); nclip--; pclip++) {
+			if (pclip->y1 >= yhi)
+				break;
+			part.x1 = pclip->x1;
+			part.x2 = pclip->x2;
+			part.y1 = max(pclip->y1, ylo);
+			part.y2 = min(pclip->y2, yhi);
+			if (part.y1 < part.y2)
+				(*job->paint)(job, &part);
+		}
+		return;
+	}
+
+	for (prect = job->prect, n = job->nrect; n--; prect++) {
+		box.x1 = max(prect->x + job->xorg, extents->x1);
+		box.y1 = max(prect->y + job->yorg, max(extents->y1, ylo));
+		box.x2 = min(prect->x + job->xorg + (int)prect->width,
+		    extents->x2);
+		box.y2 = min(prect->y + job->yorg + (int)prect->height,
+		    min(extents->y2, yhi));
+		if (box.x1 >= box.x2 || box.y1 >= box.y2)
+			continue;
+
+		nclip = REGION_NUM_RECTS(job->clip);
+		if (nclip == 1) {
+			(*job->paint)(job, &box);
+			continue;
+		}
+		/* The clip is in y-x bands so we can stop below the box */
+		for (pclip = REGION_RECTS(job->clip); nclip--; pclip++) {
+			if (pclip->y1 >= box.y2)
+				break;
+			part.x1 = max(box.x1, pclip->x1);
+			part.y1 = max(box.y1, pclip->y1);
+			part.x2 = min(box.x2, pclip->x2);
+			part.y2 = min(box.y2, pclip->y2);
+			if (part.x1 < part.x2 && part.y1 < part.y2)
+				(*job->paint)(job, &part);
+		}
+	}
+}
+
+static void accel_band(void *arg, int band, int nbands)
+{
+	AccelJob *job = (AccelJob *)arg;
+	int ylo = job->y1 + band * ACCEL_BAND_LINES;
+
+	accel_walk(job, ylo, min(ylo + ACCEL_BAND_LINES, job->y2));
+}
+
+/*
+ * Work out roughly how many pixels a job covers and which lines, and
+ * paint it, on the pool threads if it is big enough.
+ */
+static void accel_run(AccelJob *job)
+{
+	BoxPtr extents = REGION_EXTENTS(job->screen, job->clip);
+	BoxPtr pbox;
+	xRectangle *prect;
+	unsigned long pixels = 0;
+	int n, x1, y1, x2, y2;
+
+	job->y1 = MAXSHORT;
+	job->y2 = MINSHORT;
+	if (job->prect == NULL) {
+		n = REGION_NUM_RECTS(job->clip);
+		for (pbox = REGION_RECTS(job->clip); n--; pbox++)
+			pixels += (pbox->x2 - pbox->x1) *
+			    (pbox->y2 - pbox->y1);
+		job->y1 = extents->y1;
+		job->y2 = extents->y2;
+	} else {
+		for (prect = job->prect, n = job->nrect; n--; prect++) {
+			x1 = max(prect->x + job->xorg, extents->x1);
+			y1 = max(prect->y + job->yorg, extents->y1);
+			x2 = min(prect->x + job->xorg + (int)prect->width,
+			    extents->x2);
+			y2 = min(prect->y + job->yorg + (int)prect->height,
+			    extents->y2);
+			if (x1 >= x2 || y1 >= y2)
+				continue;
+			pixels += (x2 - x1) * (y2 - y1);
+			job->y1 = min(job->y1, y1);
+			job->y2 = max(job->y2, y2);
+		}
+	}
+	if (job->y1 >= job->y2)
+		return;
+
+	if (pixels < ACCEL_PARALLEL_PIXELS || vidc_pool_size() < 2)
+		accel_walk(job, job->y1, job->y2);
+	else
+		vidc_pool_run(accel_band, job, (job->y2 - job->y1 +
+		    ACCEL_BAND_LINES - 1) / ACCEL_BAND_LINES);
+}
+
+static void accel_job_init(AccelJob *job, DrawablePtr pDraw,
+    RegionPtr clip, unsigned long pixel)
+{
+	accel_setup(&job->dst, pDraw, pixel);
+	job->paint = accel_paint_solid;
+	job->screen = pDraw->pScreen;
+	job->clip = clip;
+	job->prect = NULL;
+	job->nrect = 0;
+	job->xorg = pDraw->x;
+	job->yorg = pDraw->y;
+}
+
+static void accel_job_tile(AccelJob *job, PixmapPtr tile, int x, int y)
+{
+	job->paint = accel_paint_tile;
+	job->tile = (unsigned char *)tile->devPrivate.ptr;
+	job->tile_stride = tile->devKind;
+	job->tile_w = tile->drawable.width;
+	job->tile_h = tile->drawable.height;
+	job->tile_x = x;
+	job->tile_y = y;
+}
+
+/*
+ * GC ops
+ */
+static void accel_fill_spans(DrawablePtr pDraw, GCPtr pGC, int nInit,
+    DDXPointPtr pptInit, int *pwidthInit, int fSorted)
+{
+	RegionPtr clip = ACCEL_CLIP(pGC);
+	AccelDst dst;
+	DDXPointPtr ppt;
+	int *pwidth;
+	int n, i;
+
+	if (!REGION_NOTEMPTY(pDraw->pScreen, clip))
+		return;
+
+	n = nInit * miFindMaxBand(clip);
+	pwidth = (int *)ALLOCATE_LOCAL(n * sizeof(int));
+	ppt = (DDXPointPtr)ALLOCATE_LOCAL(n * sizeof(DDXPointRec));
+	if (!ppt || !pwidth) {
+		if (ppt)
+			DEALLOCATE_LOCAL(ppt);
+		if (pwidth)
+			DEALLOCATE_LOCAL(pwidth);
+		return;
+	}
+	n = miClipSpans(clip, pptInit, pwidthInit, nInit, ppt, pwidth,
+	    fSorted);
+
+	accel_setup(&dst, pDraw, pGC->fgPixel);
+	for (i = 0; i < n; i++)
+		accel_fill_row(dst.base + ppt[i].y * dst.stride +
+		    ppt[i].x * dst.bpp, pwidth[i] * dst.bpp, dst.fill);
+
+	DEALLOCATE_LOCAL(ppt);
+	DEALLOCATE_LOCAL(pwidth);
+}
+
+/* Solid, or tiled with a tile of the drawable's depth */
+static void accel_poly_fill_rect(DrawablePtr pDraw, GCPtr pGC,
+    int nrectFill, xRectangle *prect)
+{
+	AccelJob job;
+
+	if (pGC->fillStyle == FillTiled && pGC->tileIsPixel)
+		accel_job_init(&job, pDraw, ACCEL_CLIP(pGC), pGC->tile.pixel);
+	else
+		accel_job_init(&job, pDraw, ACCEL_CLIP(pGC), pGC->fgPixel);
+	if (pGC->fillStyle == FillTiled && !pGC->tileIsPixel)
+		accel_job_tile(&job, pGC->tile.pixmap,
+		    pDraw->x + pGC->patOrg.x, pDraw->y + pGC->patOrg.y);
+	job.prect = prect;
+	job.nrect = nrectFill;
+	accel_run(&job);
+}
+
+/*
+ * Big ZPixmap images are copied in here so that they can be banded;
+ * anything else is left to cfb.
+ */
+static void accel_put_image(DrawablePtr pDraw, GCPtr pGC, int depth,
+    int x, int y, int w, int h, int leftPad, int format, char *pImage)
+{
+	AccelJob job;
+	xRectangle rect;
+
+	if (format != ZPixmap || depth != pDraw->depth ||
+	    w * h < ACCEL_PARALLEL_PIXELS || vidc_pool_size() < 2) {
+		(*ACCEL_GC(pGC)->cfbOps->PutImage)(pDraw, pGC, depth, x, y,
+		    w, h, leftPad, format, pImage);
+		return;
+	}
+	rect.x = x;
+	rect.y = y;
+	rect.width = w;
+	rect.height = h;
+	accel_job_init(&job, pDraw, ACCEL_CLIP(pGC), 0);
+	job.paint = accel_paint_image;
+	job.image = (unsigned char *)pImage;
+	job.image_stride = PixmapBytePad(w, depth);
+	job.image_x = pDraw->x + x;
+	job.image_y = pDraw->y + y;
+	job.prect = &rect;
+	job.nrect = 1;
+	accel_run(&job);
+}
+
+/*
+ * Copy the boxes of prgnDst from pptSrc, called back from cfbBitBlt
+ * once it has done the clipping. When source and destination share
+ * storage we go through the boxes and their rows in whichever order
+ * won't overwrite source not yet copied; memmove deals with overlap
+ * within a row.
+ */
+static void accel_do_bitblt(DrawablePtr pSrc, DrawablePtr pDst, int alu,
+    RegionPtr prgnDst, DDXPointPtr pptSrc, unsigned long planemask)
+{
+	int nbox = REGION_NUM_RECTS(prgnDst);
+	BoxPtr pbox = REGION_RECTS(prgnDst);
+	unsigned char *sbase, *dbase, *sp, *dp;
+	int sstride, dstride, bpp = pDst->bitsPerPixel >> 3;
+	int xdir = 1, ydir = 1;
+	int *order;
+	int i, j, k, m, bytes, h;
+
+	if (nbox == 0)
+		return;
+
+	accel_drawable_bits(pSrc, &sbase, &sstride);
+	accel_drawable_bits(pDst, &dbase, &dstride);
+	if (sbase == dbase) {
+		if (pptSrc->y < pbox->y1)
+			ydir = -1;
+		if (pptSrc->x < pbox->x1)
+			xdir = -1;
+	}
+
+	if ((order = (int *)ALLOCATE_LOCAL(nbox * sizeof(int))) == NULL)
+		return;
+
+	/* Bands top to bottom or bottom to top, boxes in each either way */
+	k = 0;
+	if (ydir > 0) {
+		for (i = 0; i < nbox; i = j) {
+			for (j = i + 1; j < nbox && pbox[j].y1 == pbox[i].y1;
+			    j++)
+				;
+			for (m = 0; m < j - i; m++)
+				order[k++] = (xdir > 0) ? i + m : j - 1 - m;
+		}
+	} else {
+		for (j = nbox; j > 0; j = i) {
+			for (i = j - 1; i > 0 && pbox[i - 1].y1 == pbox[j - 1].y1;
+			    i--)
+				;
+			for (m = 0; m < j - i; m++)
+				order[k++] = (xdir > 0) ? i + m : j - 1 - m;
+		}
+	}
+
+	for (k = 0; k < nbox; k++) {
+		BoxPtr b = &pbox[order[k]];
+		DDXPointPtr ps = &pptSrc[order[k]];
+
+		bytes = (b->x2 - b->x1) * bpp;
+		h = b->y2 - b->y1;
+		sp = sbase + ps->y * sstride + ps->x * bpp;
+		dp = dbase + b->y1 * dstride + b->x1 * bpp;
+		if (ydir < 0) {
+			sp += (h - 1) * sstride;
+			dp += (h - 1) * dstride;
+			for (; h--; sp -= sstride, dp -= dstride)
+				memmove(dp, sp, bytes);
+		} else {
+			for (; h--; sp += sstride, dp += dstride)
+				memmove(dp, sp, bytes);
+		}
+	}
+
+	DEALLOCATE_LOCAL(order);
+}
+
+static RegionPtr accel_copy_area(DrawablePtr pSrc, DrawablePtr pDst,
+    GCPtr pGC, int srcx, int srcy, int w, int h, int dstx, int dsty)
+{
+	if (pSrc->bitsPerPixel != pDst->bitsPerPixel)
+		return (*ACCEL_GC(pGC)->cfbOps->CopyArea)(pSrc, pDst, pGC,
+		    srcx, srcy, w, h, dstx, dsty);
+	return (*accel_bitblt)(pSrc, pDst, pGC, srcx, srcy, w, h, dstx, dsty,
+	    accel_do_bitblt, 0L);
+}
+
+/*
+ * Decide, after cfb has validated the GC, whether our ops can be used.
+ * mi's backing store only puts its ops in for windows that have
+ * backing store, and revalidates when a window gains it.
+ */
+static void accel_choose_ops(GCPtr pGC, AccelGCPtr pPriv, DrawablePtr pDraw)
+{
+	unsigned long pm;
+
+	pPriv->cfbOps = pGC->ops;
+	pPriv->fast = FALSE;
+	if (pDraw->bitsPerPixel != 8 && pDraw->bitsPerPixel != 16)
+		return;
+	if (pDraw->type == DRAWABLE_WINDOW &&
+	    ((WindowPtr)pDraw)->backStorage)
+		return;
+	pm = (1UL << pDraw->depth) - 1;
+	if (pGC->alu != GXcopy || (pGC->planemask & pm) != pm)
+		return;
+
+	pPriv->ops = *pGC->ops;
+	pPriv->ops.devPrivate.val = 0;
+	pPriv->ops.CopyArea = accel_copy_area;
+	pPriv->ops.PutImage = accel_put_image;
+	if (pGC->fillStyle == FillSolid) {
+		pPriv->ops.FillSpans = accel_fill_spans;
+		pPriv->ops.PolyFillRect = accel_poly_fill_rect;
+	} else if (pGC->fillStyle == FillTiled)
+		pPriv->ops.PolyFillRect = accel_poly_fill_rect;
+	if (vidc_glyph_cache_kb > 0) {
+		pPriv->ops.ImageGlyphBlt = vidc_glyph_image_blt;
+		if (pGC->fillStyle == FillSolid)
+			pPriv->ops.PolyGlyphBlt = vidc_glyph_poly_blt;
+	}
+	pPriv->fast = TRUE;
+	pGC->ops = &pPriv->ops;
+}
+
+/* For the glyph ops: cfb's ops to fall back on, and the clip */
+GCOps *vidc_accel_cfb_ops(GCPtr pGC)
+{
+	return ACCEL_GC(pGC)->cfbOps;
+}
+
+RegionPtr vidc_accel_clip(GCPtr pGC)
+{
+	return ACCEL_CLIP(pGC);
+}
+
+/*
+ * GC funcs. cfb is given back its own ops while it works on the GC.
+ */
+static void accel_validate_gc(GCPtr, unsigned long, DrawablePtr);
+static void accel_change_gc(GCPtr, unsigned long);
+static void accel_copy_gc(GCPtr, unsigned long, GCPtr);
+static void accel_destroy_gc(GCPtr);
+static void accel_change_clip(GCPtr, int, pointer, int);
+static void accel_destroy_clip(GCPtr);
+static void accel_copy_clip(GCPtr, GCPtr);
+
+static GCFuncs accel_gc_funcs = {
+	accel_validate_gc,
+	accel_change_gc,
+	accel_copy_gc,
+	accel_destroy_gc,
+	accel_change_clip,
+	accel_destroy_clip,
+	accel_copy_clip,
+};
+
+#define GC_FUNC_PROLOGUE(pGC) \
+	AccelGCPtr pPriv = ACCEL_GC(pGC); \
+	(pGC)->funcs = pPriv->wrapFuncs; \
+	if (pPriv->fast) \
+		(pGC)->ops = pPriv->cfbOps
+
+#define GC_FUNC_EPILOGUE(pGC) \
+	pPriv->wrapFuncs = (pGC)->funcs; \
+	(pGC)->funcs = &accel_gc_funcs; \
+	if (pPriv->fast) \
+		(pGC)->ops = &pPriv->ops
+
+static void accel_validate_gc(GCPtr pGC, unsigned long changes,
+    DrawablePtr pDraw)
+{
+	GC_FUNC_PROLOGUE(pGC);
+	(*pGC->funcs->ValidateGC)(pGC, changes, pDraw);
+	pPriv->wrapFuncs = pGC->funcs;
+	pGC->funcs = &accel_gc_funcs;
+	accel_choose_ops(pGC, pPriv, pDraw);
+}
+
+static void accel_change_gc(GCPtr pGC, unsigned long mask)
+{
+	GC_FUNC_PROLOGUE(pGC);
+	(*pGC->funcs->ChangeGC)(pGC, mask);
+	GC_FUNC_EPILOGUE(pGC);
+}
+
+static void accel_copy_gc(GCPtr pGCSrc, unsigned long mask, GCPtr pGCDst)
+{
+	GC_FUNC_PROLOGUE(pGCDst);
+	(*pGCDst->funcs->CopyGC)(pGCSrc, mask, pGCDst);
+	GC_FUNC_EPILOGUE(pGCDst);
+}
+
+static void accel_destroy_gc(GCPtr pGC)
+{
+	GC_FUNC_PROLOGUE(pGC);
+	pPriv->fast = FALSE;
+	(*pGC->funcs->DestroyGC)(pGC);
+	GC_FUNC_EPILOGUE(pGC);
+}
+
+static void accel_change_clip(GCPtr pGC, int type, pointer pvalue,
+    int nrects)
+{
+	GC_FUNC_PROLOGUE(pGC);
+	(*pGC->funcs->ChangeClip)(pGC, type, pvalue, nrects);
+	GC_FUNC_EPILOGUE(pGC);
+}
+
+static void accel_copy_clip(GCPtr pgcDst, GCPtr pgcSrc)
+{
+	GC_FUNC_PROLOGUE(pgcDst);
+	(*pgcDst->funcs->CopyClip)(pgcDst, pgcSrc);
+	GC_FUNC_EPILOGUE(pgcDst);
+}
+
+static void accel_destroy_clip(GCPtr pGC)
+{
+	GC_FUNC_PROLOGUE(pGC);
+	(*pGC->funcs->DestroyClip)(pGC);
+	GC_FUNC_EPILOGUE(pGC);
+}
+
+/*
+ * Screen functions
+ */
+static Bool accel_create_gc(GCPtr pGC)
+{
+	ScreenPtr screen = pGC->pScreen;
+	AccelGCPtr pPriv = ACCEL_GC(pGC);
+	Bool ret;
+
+	screen->CreateGC = accel_create_gc_wrap;
+	if ((ret = (*screen->CreateGC)(pGC)) != FALSE) {
+		pPriv->wrapFuncs = pGC->funcs;
+		pPriv->cfbOps = pGC->ops;
+		pPriv->fast = FALSE;
+		pGC->funcs = &accel_gc_funcs;
+	}
+	screen->CreateGC = accel_create_gc;
+	return ret;
+}
+
+/*
+ * Window backgrounds of a pixel or a tile. Parent relative backgrounds
+ * come back through here for the parent once cfb has found it.
+ */
+static void accel_paint_background(WindowPtr pWin, RegionPtr pRegion,
+    int what)
+{
+	AccelJob job;
+	int bpp = pWin->drawable.bitsPerPixel;
+
+	if (what != PW_BACKGROUND || (bpp != 8 && bpp != 16) ||
+	    (pWin->backgroundState != BackgroundPixel &&
+	    pWin->backgroundState != BackgroundPixmap)) {
+		(*accel_paint_background_wrap)(pWin, pRegion, what);
+		return;
+	}
+	accel_job_init(&job, &pWin->drawable, pRegion,
+	    pWin->background.pixel);
+	if (pWin->backgroundState == BackgroundPixmap)
+		accel_job_tile(&job, pWin->background.pixmap,
+		    pWin->drawable.x, pWin->drawable.y);
+	accel_run(&job);
+}
+
+static Bool accel_close_screen(int index, ScreenPtr screen)
+{
+	screen->CloseScreen = accel_close_screen_wrap;
+	screen->CreateGC = accel_create_gc_wrap;
+	screen->PaintWindowBackground = accel_paint_background_wrap;
+	return (*screen->CloseScreen)(index, screen);
+}
+
+/*
+ * -accelbench: time our fills and copies against cfb's on a scratch
+ * pixmap the size of the screen. The scratch GCs aren't there until
+ * after the screens are set up, so this runs the first time the server
+ * blocks.
+ */
+Bool vidc_accel_bench_wanted = FALSE;
+
+#define ACCEL_BENCH_ROUNDS	10
+#define ACCEL_BENCH_SMALL	1000	/* small rects or copies per round */
+
+/* Time one op over the rounds, returning ns per round */
+static unsigned long long accel_bench_fill(GCOps *ops, DrawablePtr pDraw,
+    GCPtr pGC, int nrect, xRectangle *rects)
+{
+	unsigned long long start;
+	int i;
+
+	start = vidc_trace_now();
+	for (i = 0; i < ACCEL_BENCH_ROUNDS; i++)
+		(*ops->PolyFillRect)(pDraw, pGC, nrect, rects);
+	return (vidc_trace_now() - start) / ACCEL_BENCH_ROUNDS;
+}
+
+static unsigned long long accel_bench_copy(GCOps *ops, DrawablePtr pDraw,
+    GCPtr pGC, int ncopy, xRectangle *rects, int dx, int dy)
+{
+	unsigned long long start;
+	int i, n;
+
+	start = vidc_trace_now();
+	for (i = 0; i < ACCEL_BENCH_ROUNDS; i++)
+		for (n = 0; n < ncopy; n++)
+			(*ops->CopyArea)(pDraw, pDraw, pGC, rects[n].x,
+			    rects[n].y, rects[n].width, rects[n].height,
+			    rects[n].x + dx, rects[n].y + dy);
+	return (vidc_trace_now() - start) / ACCEL_BENCH_ROUNDS;
+}
+
+static void accel_bench_log(char *op, int depth, int pixels,
+    unsigned long long ours, unsigned long long cfb)
+{
+	ErrorF("vidc-accel: op=%s bpp=%d pixels=%d accel_us=%llu cfb_us=%llu "
+	    "speedup=%llu.%02llu\n", op, depth, pixels, ours / 1000,
+	    cfb / 1000, ours ? cfb / ours : 0, ours ? cfb * 100 / ours % 100 : 0);
+}
+
+static void accel_bench_block(pointer data, pointer pTimeout,
+    pointer pReadmask)
+{
+	ScreenPtr screen = (ScreenPtr)data;
+	PixmapPtr pPix;
+	GCPtr pGC;
+	AccelGCPtr pPriv;
+	xRectangle big, *small;
+	unsigned long fg = 1;
+	int w = screen->width, h = screen->height, depth = screen->rootDepth;
+	int n;
+
+	RemoveBlockAndWakeupHandlers(accel_bench_block,
+	    (void (*)())NoopDDA, data);
+
+	if ((small = (xRectangle *)xalloc(ACCEL_BENCH_SMALL *
+	    sizeof(xRectangle))) == NULL)
+		return;
+	pPix = (*screen->CreatePixmap)(screen, w, h, depth);
+	if (pPix == NULL) {
+		xfree(small);
+		return;
+	}
+	if ((pGC = CreateScratchGC(screen, depth)) == NULL) {
+		(*screen->DestroyPixmap)(pPix);
+		xfree(small);
+		return;
+	}
+	ChangeGC(pGC, GCForeground, &fg);
+	ValidateGC(&pPix->drawable, pGC);
+	pPriv = ACCEL_GC(pGC);
+	if (!pPriv->fast) {
+		ErrorF("vidc-accel: no accelerated ops at %d bpp\n", depth);
+		goto out;
+	}
+
+	/* A whole screen, and scattered 16x16 squares */
+	big.x = big.y = 0;
+	big.width = w;
+	big.height = h;
+	for (n = 0; n < ACCEL_BENCH_SMALL; n++) {
+		small[n].x = (n * 37) % (w - 48);
+		small[n].y = (n * 53) % (h - 48);
+		small[n].width = small[n].height = 16;
+	}
+	accel_bench_log("fill_screen", pPix->drawable.bitsPerPixel, w * h,
+	    accel_bench_fill(&pPriv->ops, &pPix->drawable, pGC, 1, &big),
+	    accel_bench_fill(pPriv->cfbOps, &pPix->drawable, pGC, 1, &big));
+	accel_bench_log("fill_16x16", pPix->drawable.bitsPerPixel,
+	    ACCEL_BENCH_SMALL * 256,
+	    accel_bench_fill(&pPriv->ops, &pPix->drawable, pGC,
+	    ACCEL_BENCH_SMALL, small),
+	    accel_bench_fill(pPriv->cfbOps, &pPix->drawable, pGC,
+	    ACCEL_BENCH_SMALL, small));
+
+	/* A screen scrolled down a few lines, and 32x32 squares moved */
+	big.width = w;
+	big.height = h - 8;
+	accel_bench_log("copy_scroll", pPix->drawable.bitsPerPixel,
+	    w * (h - 8),
+	    accel_bench_copy(&pPriv->ops, &pPix->drawable, pGC, 1, &big, 0, 8),
+	    accel_bench_copy(pPriv->cfbOps, &pPix->drawable, pGC, 1, &big,
+	    0, 8));
+	for (n = 0; n < ACCEL_BENCH_SMALL; n++)
+		small[n].width = small[n].height = 32;
+	accel_bench_log("copy_32x32", pPix->drawable.bitsPerPixel,
+	    ACCEL_BENCH_SMALL * 1024,
+	    accel_bench_copy(&pPriv->ops, &pPix->drawable, pGC,
+	    ACCEL_BENCH_SMALL, small, 13, 7),
+	    accel_bench_copy(pPriv->cfbOps, &pPix->drawable, pGC,
+	    ACCEL_BENCH_SMALL, small, 13, 7));
+out:
+	FreeScratchGC(pGC);
+	(*screen->DestroyPixmap)(pPix);
+	xfree(small);
+}
+
+void vidc_accel_bench(ScreenPtr screen)
+{
+	RegisterBlockAndWakeupHandlers(accel_bench_block,
+	    (void (*)())NoopDDA, (pointer)screen);
+}
+
+/*
+ * Put our ops over cfb's. Called straight after cfbScreenInit or
+ * cfb16ScreenInit.
+ */
+Bool vidc_accel_init(ScreenPtr screen, int depth)
+{
+	switch (depth) {
+	case 8:
+		accel_cfb_gc_index = cfbGCPrivateIndex;
+		accel_bitblt = cfbBitBlt;
+		break;
+	case 16:
+		accel_cfb_gc_index = cfb16GCPrivateIndex;
+		accel_bitblt = cfb16BitBlt;
+		break;
+	default:
+		return FALSE;
+	}
+
+	accel_gc_index = AllocateGCPrivateIndex();
+	if (accel_gc_index < 0 ||
+	    !AllocateGCPrivate(screen, accel_gc_index, sizeof(AccelGCRec)))
+		return FALSE;
+
+	accel_close_screen_wrap = screen->CloseScreen;
+	screen->CloseScreen = accel_close_screen;
+	accel_create_gc_wrap = screen->CreateGC;
+	screen->CreateGC = accel_create_gc;
+	accel_paint_background_wrap = screen->PaintWindowBackground;
+	screen->PaintWindowBackground = accel_paint_background;
+
+	if (vidc_glyph_cache_kb > 0 && !vidc_glyph_init(screen))
+		vidc_glyph_cache_kb = 0;
+	return TRUE;
+}
@@ -0,0 +1,160 @@
+/*	$NetBSD$	*/
+
+/*
+ * Copyright (c) 1999 Mark Brinicombe & Neil A. Carson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * X11 driver code for VIDC20
+ */
+
+/*
+ * Bell.
+ *
+ * Ringing the bell used to be a BEEP_GENERATE ioctl straight from the
+ * dispatch loop, so a client spamming XBell could stall every other
+ * client on each one. Bells are now put on a tiny queue and rung by a
+ * helper thread. A bell arriving within vidc_bell_merge_ms of the last
+ * one accepted is merged into it, and when the queue is full further
+ * bells are dropped; either way the dispatch loop never waits on the
+ * device.
+ */
+
+#include <stdio.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/time.h>
+
+/* X11 headers
+ */
+#include "X.h"
+#include "Xproto.h"
+#include "input.h"
+#include "inputstr.h"
+#include "misc.h"
+
+/* Our private definitions */
+#include "private.h"
+
+extern struct _private private;
+
+/*#define DEBUG*/
+
+#ifdef DEBUG
+#define DPRINTF(x) ErrorF x
+#else
+#define DPRINTF(x)
+#endif
+
+#define BELL_QUEUE_LEN	4
+
+/* -bellmerge: bells closer together than this are rung once */
+int vidc_bell_merge_ms = 100;
+
+typedef struct {
+	int percent;
+	int pitch;		/* Hz */
+	int duration;		/* ms */
+} BellRec;
+
+static BellRec bell_queue[BELL_QUEUE_LEN];
+static int bell_head, bell_count;
+static pthread_mutex_t bell_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t bell_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t bell_thread;
+static Bool bell_thread_running = FALSE;
+
+/* When the last bell was accepted, for merging */
+static CARD32 bell_last;
+
+/* Pitch and duration as last set by ChangeKeyboardControl */
+static int bell_pitch = 400;
+static int bell_duration = 100;
+
+static void *bell_service(void *arg)
+{
+	BellRec bell;
+
+	for (;;) {
+		pthread_mutex_lock(&bell_lock);
+		while (bell_count == 0)
+			pthread_cond_wait(&bell_cond, &bell_lock);
+		bell = bell_queue[bell_head];
+		bell_head = (bell_head + 1) % BELL_QUEUE_LEN;
+		bell_count--;
+		pthread_mutex_unlock(&bell_lock);
+
+		private.beep(bell.percent, bell.pitch, bell.duration);
+	}
+	return NULL;
+}
+
+/*
+ * Remember the bell settings from a keyboard control change.
+ */
+void vidc_bell_control(KeybdCtrl *ctrl)
+{
+	if (ctrl->bell_pitch > 0)
+		bell_pitch = ctrl->bell_pitch;
+	if (ctrl->bell_duration > 0)
+		bell_duration = ctrl->bell_duration;
+}
+
+void vidc_bell(int percent, DeviceIntPtr device, pointer ctrl, int unused)
+{
+	KeybdCtrl *kctrl = (KeybdCtrl *)ctrl;
+	CARD32 now;
+
+	DPRINTF(("Bell\n"));
+
+	if (percent == 0 || kctrl->bell == 0)
+		return;
+
+	now = GetTimeInMillis();
+	if (bell_last && (CARD32)(now - bell_last) < vidc_bell_merge_ms) {
+		DPRINTF(("Bell merged\n"));
+		return;
+	}
+
+	if (!bell_thread_running) {
+		if (vidc_thread_create(&bell_thread, bell_service, NULL)) {
+			ErrorF("Can't start bell thread\n");
+			return;
+		}
+		bell_thread_running = TRUE;
+	}
+
+	pthread_mutex_lock(&bell_lock);
+	if (bell_count < BELL_QUEUE_LEN) {
+		BellRec *bell;
+
+		bell = &bell_queue[(bell_head + bell_count) % BELL_QUEUE_LEN];
+		bell->percent = percent;
+		bell->pitch = bell_pitch;
+		bell->duration = bell_duration;
+		bell_count++;
+		bell_last = now;
+		pthread_cond_signal(&bell_cond);
+	}
+	pthread_mutex_unlock(&bell_lock);
+}
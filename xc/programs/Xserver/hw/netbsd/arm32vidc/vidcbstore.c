@@ -0,0 +1,325 @@
+/*	$NetBSD$	*/
+
+/*
+ * Copyright (c) 1999 Mark Brinicombe & Neil A. Carson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * X11 driver code for VIDC20
+ */
+
+/*
+ * Backing store and save-unders.
+ *
+ * mi already implements backing store for cfb and mfb, keeping
+ * obscured areas in ordinary pixmaps in system memory and copying
+ * them back on exposure. Here we turn it and save-unders on, and keep
+ * the memory they use within the -bspool limit.
+ *
+ * The pixmaps mi creates while saving, restoring or resizing a
+ * window's backing store are noted against that window, and their
+ * windows moved to the front of a most recently used list whenever
+ * they are saved or restored. When the total exceeds the limit, the
+ * least recently used windows lose their backing store, from the
+ * block handler so that mi is never reentered. Those windows then get
+ * exposures as if they had never had any. Backing store held only
+ * for a save-under can't be dropped this way; it goes when the popup
+ * does.
+ */
+
+#include <stdio.h>
+#include <sys/types.h>
+
+/* X11 headers
+ */
+#include "X.h"
+#include "Xproto.h"
+#include "misc.h"
+#include "dix.h"
+#include "scrnintstr.h"
+#include "windowstr.h"
+#include "pixmapstr.h"
+#include "regionstr.h"
+
+/* Our private definitions */
+#include "private.h"
+
+/*#define DEBUG*/
+
+#ifdef DEBUG
+#define DPRINTF(x) ErrorF x
+#else
+#define DPRINTF(x)
+#endif
+
+int vidc_bs_pool_kb = 1024;
+
+extern Bool disableBackingStore;
+extern Bool disableSaveUnders;
+
+extern struct _private private;
+
+typedef struct _BSPixmap {
+	struct _BSPixmap	*next;		/* towards least recent */
+	struct _BSPixmap	*prev;		/* towards most recent */
+	PixmapPtr		pPix;
+	WindowPtr		pWin;
+	unsigned long		bytes;
+} BSPixmapRec, *BSPixmapPtr;
+
+static BSPixmapPtr bs_mru, bs_lru;
+static unsigned long bs_bytes, bs_peak, bs_evictions;
+static int bs_npixmaps;
+
+/* The window whose backing store mi is working on, if any */
+static WindowPtr bs_window;
+
+/* Wrapped screen functions */
+static CloseScreenProcPtr	bs_close_screen_wrap;
+static CreatePixmapProcPtr	bs_create_pixmap_wrap;
+static DestroyPixmapProcPtr	bs_destroy_pixmap_wrap;
+static SaveDoomedAreasProcPtr	bs_save_doomed_areas_wrap;
+static RestoreAreasProcPtr	bs_restore_areas_wrap;
+static ResizeWindowProcPtr	bs_resize_window_wrap;
+
+static void bs_unlink(BSPixmapPtr bs)
+{
+	if (bs->prev)
+		bs->prev->next = bs->next;
+	else
+		bs_mru = bs->next;
+	if (bs->next)
+		bs->next->prev = bs->prev;
+	else
+		bs_lru = bs->prev;
+}
+
+static void bs_push(BSPixmapPtr bs)
+{
+	bs->prev = NULL;
+	bs->next = bs_mru;
+	if (bs_mru)
+		bs_mru->prev = bs;
+	else
+		bs_lru = bs;
+	bs_mru = bs;
+}
+
+/* Move a window's pixmaps to the front of the list */
+static void bs_touch(WindowPtr pWin)
+{
+	BSPixmapPtr bs, next;
+
+	for (bs = bs_mru; bs; bs = next) {
+		next = bs->next;
+		if (bs->pWin == pWin && bs != bs_mru) {
+			bs_unlink(bs);
+			bs_push(bs);
+		}
+	}
+}
+
+/*
+ * Take backing store away from the least recently used windows until
+ * we are back within the pool.
+ */
+static void bs_block_handler(pointer data, pointer pTimeout,
+    pointer pReadmask)
+{
+	BSPixmapPtr bs;
+	WindowPtr pWin;
+
+	while (bs_bytes > vidc_bs_pool_kb * 1024) {
+		for (bs = bs_lru; bs; bs = bs->prev)
+			if (bs->pWin->backingStore != NotUseful)
+				break;
+		if (bs == NULL)
+			break;
+		pWin = bs->pWin;
+		DPRINTF(("bs: evicting window %lx\n", pWin->drawable.id));
+		pWin->backingStore = NotUseful;
+		(*pWin->drawable.pScreen->ChangeWindowAttributes)(pWin,
+		    CWBackingStore);
+		bs_evictions++;
+	}
+}
+
+static PixmapPtr bs_create_pixmap(ScreenPtr screen, int width, int height,
+    int depth)
+{
+	PixmapPtr pPix;
+	BSPixmapPtr bs;
+
+	screen->CreatePixmap = bs_create_pixmap_wrap;
+	pPix = (*screen->CreatePixmap)(screen, width, height, depth);
+	screen->CreatePixmap = bs_create_pixmap;
+
+	if (pPix && bs_window &&
+	    (bs = (BSPixmapPtr)xalloc(sizeof(BSPixmapRec))) != NULL) {
+		bs->pPix = pPix;
+		bs->pWin = bs_window;
+		bs->bytes = (unsigned long)pPix->devKind * height;
+		bs_push(bs);
+		bs_bytes += bs->bytes;
+		bs_npixmaps++;
+		if (bs_bytes > bs_peak)
+			bs_peak = bs_bytes;
+	}
+	return pPix;
+}
+
+static Bool bs_destroy_pixmap(PixmapPtr pPix)
+{
+	ScreenPtr screen = pPix->drawable.pScreen;
+	BSPixmapPtr bs;
+	Bool ret;
+
+	/* Only the last reference frees it */
+	if (pPix->refcnt == 1) {
+		for (bs = bs_mru; bs; bs = bs->next) {
+			if (bs->pPix == pPix) {
+				bs_unlink(bs);
+				bs_bytes -= bs->bytes;
+				bs_npixmaps--;
+				xfree(bs);
+				break;
+			}
+		}
+	}
+
+	screen->DestroyPixmap = bs_destroy_pixmap_wrap;
+	ret = (*screen->DestroyPixmap)(pPix);
+	screen->DestroyPixmap = bs_destroy_pixmap;
+	return ret;
+}
+
+static void bs_save_doomed_areas(WindowPtr pWin, RegionPtr prgnSave,
+    int xorg, int yorg)
+{
+	ScreenPtr screen = pWin->drawable.pScreen;
+
+	bs_window = pWin;
+	screen->SaveDoomedAreas = bs_save_doomed_areas_wrap;
+	(*screen->SaveDoomedAreas)(pWin, prgnSave, xorg, yorg);
+	screen->SaveDoomedAreas = bs_save_doomed_areas;
+	bs_window = NULL;
+	bs_touch(pWin);
+}
+
+/*
+ * cfb copies restored areas straight into the screen pixmap, behind
+ * the shadow's back, so mark everything that was exposed as damaged.
+ * Whatever wasn't restored gets painted anyway.
+ */
+static RegionPtr bs_restore_areas(WindowPtr pWin, RegionPtr prgnExposed)
+{
+	ScreenPtr screen = pWin->drawable.pScreen;
+	RegionPtr ret;
+	RegionRec exposed;
+	BoxPtr pbox;
+	int nbox;
+
+	if (private.shadow_base) {
+		REGION_INIT(screen, &exposed, NullBox, 0);
+		REGION_COPY(screen, &exposed, prgnExposed);
+	}
+	bs_window = pWin;
+	screen->RestoreAreas = bs_restore_areas_wrap;
+	ret = (*screen->RestoreAreas)(pWin, prgnExposed);
+	screen->RestoreAreas = bs_restore_areas;
+	bs_window = NULL;
+	bs_touch(pWin);
+	if (private.shadow_base) {
+		nbox = REGION_NUM_RECTS(&exposed);
+		for (pbox = REGION_RECTS(&exposed); nbox--; pbox++)
+			vidc_shadow_damage(pbox);
+		REGION_UNINIT(screen, &exposed);
+	}
+	return ret;
+}
+
+static void bs_resize_window(WindowPtr pWin, int x, int y, unsigned int w,
+    unsigned int h, WindowPtr pSib)
+{
+	ScreenPtr screen = pWin->drawable.pScreen;
+
+	bs_window = pWin;
+	screen->ResizeWindow = bs_resize_window_wrap;
+	(*screen->ResizeWindow)(pWin, x, y, w, h, pSib);
+	screen->ResizeWindow = bs_resize_window;
+	bs_window = NULL;
+}
+
+static Bool bs_close_screen(int index, ScreenPtr screen)
+{
+	screen->CloseScreen = bs_close_screen_wrap;
+	screen->CreatePixmap = bs_create_pixmap_wrap;
+	screen->DestroyPixmap = bs_destroy_pixmap_wrap;
+	screen->SaveDoomedAreas = bs_save_doomed_areas_wrap;
+	screen->RestoreAreas = bs_restore_areas_wrap;
+	screen->ResizeWindow = bs_resize_window_wrap;
+	return (*screen->CloseScreen)(index, screen);
+}
+
+/* Log how much the pool is holding
+ */
+void vidc_bs_stats(void)
+{
+	if (vidc_bs_pool_kb <= 0)
+		return;
+	ErrorF("vidc-bstore: pixmaps=%d bytes=%lu peak=%lu pool=%lu "
+	    "evictions=%lu\n", bs_npixmaps, bs_bytes, bs_peak,
+	    (unsigned long)vidc_bs_pool_kb * 1024, bs_evictions);
+}
+
+/*
+ * Set the backing store policy for the screen. -bs and -su still turn
+ * off their halves, and a pool of 0 turns off both.
+ */
+Bool vidc_bs_init(ScreenPtr screen)
+{
+	if (vidc_bs_pool_kb <= 0) {
+		screen->backingStoreSupport = NotUseful;
+		screen->saveUnderSupport = NotUseful;
+		return TRUE;
+	}
+	screen->backingStoreSupport = disableBackingStore ? NotUseful : Always;
+	screen->saveUnderSupport = disableSaveUnders ? NotUseful : Always;
+
+	bs_close_screen_wrap = screen->CloseScreen;
+	screen->CloseScreen = bs_close_screen;
+	bs_create_pixmap_wrap = screen->CreatePixmap;
+	screen->CreatePixmap = bs_create_pixmap;
+	bs_destroy_pixmap_wrap = screen->DestroyPixmap;
+	screen->DestroyPixmap = bs_destroy_pixmap;
+	bs_save_doomed_areas_wrap = screen->SaveDoomedAreas;
+	screen->SaveDoomedAreas = bs_save_doomed_areas;
+	bs_restore_areas_wrap = screen->RestoreAreas;
+	screen->RestoreAreas = bs_restore_areas;
+	bs_resize_window_wrap = screen->ResizeWindow;
+	screen->ResizeWindow = bs_resize_window;
+
+	RegisterBlockAndWakeupHandlers(bs_block_handler,
+	    (void (*)())NoopDDA, NULL);
+	return TRUE;
+}
@@ -0,0 +1,380 @@
+/*	$NetBSD$	*/
+
+/*
+ * Copyright (c) 1999 Mark Brinicombe & Neil A. Carson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * X11 driver code for VIDC20
+ */
+
+/*
+ * Colour map to window index.
+ *
+ * When a colour map is installed or uninstalled the dix helpers want
+ * to be walked over the entire window tree so that every window using
+ * the map gets a ColormapNotify. With a few hundred windows that is a
+ * noticeable stall on every focus change, so instead we keep a small
+ * hash from colour map ID to the windows whose colormap attribute
+ * refers to it and only visit those.
+ *
+ * The index is kept up to date from CreateWindow, DestroyWindow and
+ * ChangeWindowAttributes. dix can also quietly set a window's colour
+ * map to None when the map is freed (TellNoMap), so entries are
+ * checked against wColormap() as they are used and stale ones dropped.
+ */
+
+#include <stdio.h>
+#include <sys/types.h>
+
+/* X11 headers
+ */
+#include "X.h"
+#include "Xproto.h"
+#include "misc.h"
+#include "scrnintstr.h"
+#include "windowstr.h"
+#include "colormap.h"
+#include "colormapst.h"
+#include "resource.h"
+#include "dixstruct.h"
+
+/* Our private definitions */
+#include "private.h"
+
+extern WindowPtr *WindowTable;
+
+/*#define DEBUG*/
+
+#ifdef DEBUG
+#define DPRINTF(x) ErrorF x
+#else
+#define DPRINTF(x)
+#endif
+
+#define CMAP_HASH_SIZE	64	/* must be a power of two */
+#define CMAP_HASH(mid)	(((mid) ^ ((mid) >> 16)) & (CMAP_HASH_SIZE - 1))
+
+typedef struct _CmapWin {
+	struct _CmapWin *next;
+	struct _CmapWin *prev;
+	WindowPtr pWin;
+	Colormap mid;		/* colour map the window was indexed under */
+} CmapWinRec, *CmapWinPtr;
+
+static CmapWinPtr cmap_hash[CMAP_HASH_SIZE];
+
+/* Window private pointing at the window's index entry */
+static int cmap_win_index = -1;
+
+/* -cmapbench: time notifies on a synthetic window tree at start up */
+Bool vidc_cmap_bench_wanted = FALSE;
+
+#define CMAP_BENCH_WINDOWS	2000
+#define CMAP_BENCH_MAPS		16
+#define CMAP_BENCH_TOPS		50	/* top level windows, the rest below */
+#define CMAP_BENCH_ROUNDS	20
+#define CMAP_BENCH_LISTEN	4	/* one window in this many selects */
+
+#define CMAP_WIN(pWin) \
+	((CmapWinPtr)(pWin)->devPrivates[cmap_win_index].ptr)
+
+/* Wrapped screen functions */
+static CloseScreenProcPtr		cmap_close_screen_wrap;
+static CreateWindowProcPtr		cmap_create_window_wrap;
+static DestroyWindowProcPtr		cmap_destroy_window_wrap;
+static ChangeWindowAttributesProcPtr	cmap_change_attributes_wrap;
+
+static void cmap_unlink(CmapWinPtr entry)
+{
+	if (entry->prev)
+		entry->prev->next = entry->next;
+	else
+		cmap_hash[CMAP_HASH(entry->mid)] = entry->next;
+	if (entry->next)
+		entry->next->prev = entry->prev;
+}
+
+static void cmap_link(CmapWinPtr entry, Colormap mid)
+{
+	CmapWinPtr *head = &cmap_hash[CMAP_HASH(mid)];
+
+	entry->mid = mid;
+	entry->prev = NULL;
+	entry->next = *head;
+	if (*head)
+		(*head)->prev = entry;
+	*head = entry;
+}
+
+/* Put a window under its current colour map, or take it out for None */
+static void cmap_index_window(WindowPtr pWin)
+{
+	CmapWinPtr entry = CMAP_WIN(pWin);
+	Colormap mid = wColormap(pWin);
+
+	if (entry) {
+		if (entry->mid == mid)
+			return;
+		cmap_unlink(entry);
+		if (mid == None) {
+			xfree(entry);
+			pWin->devPrivates[cmap_win_index].ptr = NULL;
+			return;
+		}
+	} else {
+		if (mid == None)
+			return;
+		entry = (CmapWinPtr)xalloc(sizeof(CmapWinRec));
+		if (!entry)
+			return;
+		entry->pWin = pWin;
+		pWin->devPrivates[cmap_win_index].ptr = (pointer)entry;
+	}
+	cmap_link(entry, mid);
+}
+
+/*
+ * Call one of the dix Tell*Map functions for every window using the
+ * colour map, as WalkTree would have done.
+ */
+void vidc_cmap_notify(ScreenPtr screen, Colormap mid,
+    int (*func)(WindowPtr, pointer))
+{
+	CmapWinPtr entry, next;
+	WindowPtr pWin;
+
+	/* No index this generation, do it the slow way */
+	if (cmap_win_index < 0) {
+		WalkTree(screen, func, (pointer) &mid);
+		return;
+	}
+
+	for (entry = cmap_hash[CMAP_HASH(mid)]; entry; entry = next) {
+		next = entry->next;
+		if (entry->mid != mid)
+			continue;
+		pWin = entry->pWin;
+
+		/* TellNoMap may have changed the map behind our back */
+		if (wColormap(pWin) != mid) {
+			cmap_index_window(pWin);
+			continue;
+		}
+
+		/* Nobody listening, skip the event delivery altogether */
+		if (!((pWin->eventMask | wOtherEventMasks(pWin))
+		    & ColormapChangeMask))
+			continue;
+		(*func)(pWin, (pointer) &mid);
+	}
+}
+
+static Bool cmap_create_window(WindowPtr pWin)
+{
+	ScreenPtr screen = pWin->drawable.pScreen;
+	Bool ret;
+
+	pWin->devPrivates[cmap_win_index].ptr = NULL;
+	screen->CreateWindow = cmap_create_window_wrap;
+	ret = (*screen->CreateWindow)(pWin);
+	screen->CreateWindow = cmap_create_window;
+	if (ret)
+		cmap_index_window(pWin);
+	return ret;
+}
+
+static Bool cmap_destroy_window(WindowPtr pWin)
+{
+	ScreenPtr screen = pWin->drawable.pScreen;
+	CmapWinPtr entry = CMAP_WIN(pWin);
+	Bool ret;
+
+	if (entry) {
+		cmap_unlink(entry);
+		xfree(entry);
+		pWin->devPrivates[cmap_win_index].ptr = NULL;
+	}
+	screen->DestroyWindow = cmap_destroy_window_wrap;
+	ret = (*screen->DestroyWindow)(pWin);
+	screen->DestroyWindow = cmap_destroy_window;
+	return ret;
+}
+
+static Bool cmap_change_attributes(WindowPtr pWin, unsigned long mask)
+{
+	ScreenPtr screen = pWin->drawable.pScreen;
+	Bool ret;
+
+	screen->ChangeWindowAttributes = cmap_change_attributes_wrap;
+	ret = (*screen->ChangeWindowAttributes)(pWin, mask);
+	screen->ChangeWindowAttributes = cmap_change_attributes;
+	if (mask & CWColormap)
+		cmap_index_window(pWin);
+	return ret;
+}
+
+static Bool cmap_close_screen(int index, ScreenPtr screen)
+{
+	CmapWinPtr entry, next;
+	int cnt;
+
+	screen->CloseScreen = cmap_close_screen_wrap;
+	screen->CreateWindow = cmap_create_window_wrap;
+	screen->DestroyWindow = cmap_destroy_window_wrap;
+	screen->ChangeWindowAttributes = cmap_change_attributes_wrap;
+
+	/* All the windows should be gone by now, but be tidy */
+	for (cnt = 0; cnt < CMAP_HASH_SIZE; cnt++) {
+		for (entry = cmap_hash[cnt]; entry; entry = next) {
+			next = entry->next;
+			xfree(entry);
+		}
+		cmap_hash[cnt] = NULL;
+	}
+	cmap_win_index = -1;
+
+	return (*screen->CloseScreen)(index, screen);
+}
+
+/*
+ * Set up the index. Must be called before the root window is created.
+ */
+Bool vidc_cmap_init(ScreenPtr screen)
+{
+	int index;
+
+	index = AllocateWindowPrivateIndex();
+	if (index < 0 || !AllocateWindowPrivate(screen, index, 0))
+		return FALSE;
+	cmap_win_index = index;
+
+	cmap_close_screen_wrap = screen->CloseScreen;
+	screen->CloseScreen = cmap_close_screen;
+	cmap_create_window_wrap = screen->CreateWindow;
+	screen->CreateWindow = cmap_create_window;
+	cmap_destroy_window_wrap = screen->DestroyWindow;
+	screen->DestroyWindow = cmap_destroy_window;
+	cmap_change_attributes_wrap = screen->ChangeWindowAttributes;
+	screen->ChangeWindowAttributes = cmap_change_attributes;
+	return TRUE;
+}
+
+/* What the dix Tell*Map functions do first: find the windows using mid */
+static unsigned long cmap_bench_hits;
+
+static int cmap_bench_visit(WindowPtr pWin, pointer value)
+{
+	if (wColormap(pWin) == *(Colormap *)value)
+		cmap_bench_hits++;
+	return WT_WALKCHILDREN;
+}
+
+/*
+ * Build a tree of CMAP_BENCH_WINDOWS windows spread over
+ * CMAP_BENCH_MAPS colour maps, one in CMAP_BENCH_LISTEN of them
+ * selecting ColormapNotify for the server client, time notifying each map through the
+ * index against walking the tree, log both and tear it all down.
+ * Runs from the first block handler, once the root window exists.
+ */
+static void cmap_bench_block(pointer data, pointer pTimeout,
+    pointer pReadmask)
+{
+	ScreenPtr screen = (ScreenPtr)data;
+	WindowPtr root = WindowTable[screen->myNum];
+	WindowPtr win[CMAP_BENCH_TOPS], pWin;
+	ColormapPtr def, pmap;
+	Colormap maps[CMAP_BENCH_MAPS];
+	XID wids[CMAP_BENCH_WINDOWS], vlist[2];
+	unsigned long long start, indexed, walked;
+	unsigned long index_hits, walk_hits;
+	int nmaps, nwins, nlisten = 0, i, r, error;
+
+	RemoveBlockAndWakeupHandlers(cmap_bench_block,
+	    (void (*)())NoopDDA, data);
+
+	def = (ColormapPtr)LookupIDByType(screen->defColormap, RT_COLORMAP);
+	if (!def)
+		return;
+	for (nmaps = 0; nmaps < CMAP_BENCH_MAPS; nmaps++) {
+		maps[nmaps] = FakeClientID(0);
+		if (CreateColormap(maps[nmaps], screen, def->pVisual, &pmap,
+		    AllocNone, 0) != Success)
+			break;
+	}
+	for (nwins = 0; nmaps && nwins < CMAP_BENCH_WINDOWS; nwins++) {
+		wids[nwins] = FakeClientID(0);
+		vlist[0] = (nwins % CMAP_BENCH_LISTEN) ? NoEventMask :
+		    ColormapChangeMask;
+		vlist[1] = maps[nwins % nmaps];
+		pWin = CreateWindow(wids[nwins],
+		    nwins < CMAP_BENCH_TOPS ? root :
+		    win[nwins % CMAP_BENCH_TOPS], 0, 0, 10, 10, 0,
+		    InputOutput, CWEventMask | CWColormap, vlist, 0,
+		    serverClient, CopyFromParent, &error);
+		if (!pWin || !AddResource(wids[nwins], RT_WINDOW,
+		    (pointer)pWin))
+			break;
+		if (vlist[0] != NoEventMask)
+			nlisten++;
+		if (nwins < CMAP_BENCH_TOPS)
+			win[nwins] = pWin;
+	}
+
+	cmap_bench_hits = 0;
+	start = vidc_trace_now();
+	for (r = 0; r < CMAP_BENCH_ROUNDS; r++)
+		for (i = 0; i < nmaps; i++)
+			vidc_cmap_notify(screen, maps[i], cmap_bench_visit);
+	indexed = vidc_trace_now() - start;
+	index_hits = cmap_bench_hits;
+
+	cmap_bench_hits = 0;
+	start = vidc_trace_now();
+	for (r = 0; r < CMAP_BENCH_ROUNDS; r++)
+		for (i = 0; i < nmaps; i++)
+			WalkTree(screen, cmap_bench_visit, (pointer)&maps[i]);
+	walked = vidc_trace_now() - start;
+	walk_hits = cmap_bench_hits;
+
+	r = CMAP_BENCH_ROUNDS * (nmaps ? nmaps : 1);
+	ErrorF("vidc-cmap: windows=%d listening=%d maps=%d index_ns=%llu "
+	    "walk_ns=%llu index_visits=%lu walk_visits=%lu\n", nwins,
+	    nlisten, nmaps,
+	    indexed / r, walked / r, index_hits / r, walk_hits / r);
+
+	/* Freeing the top levels takes their children with them */
+	for (i = 0; i < nwins && i < CMAP_BENCH_TOPS; i++)
+		FreeResource(wids[i], RT_NONE);
+	for (i = 0; i < nmaps; i++)
+		FreeResource(maps[i], RT_NONE);
+}
+
+/*
+ * Ask for the bench to be run once the server is up.
+ */
+void vidc_cmap_bench(ScreenPtr screen)
+{
+	RegisterBlockAndWakeupHandlers(cmap_bench_block,
+	    (void (*)())NoopDDA, (pointer)screen);
+}
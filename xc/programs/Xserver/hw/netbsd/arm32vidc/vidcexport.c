@@ -0,0 +1,255 @@
+/*	$NetBSD$	*/
+
+/*
+ * Copyright (c) 1999 Mark Brinicombe & Neil A. Carson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * X11 driver code for VIDC20
+ */
+
+
+/*
+ * Shared memory export of the shadow.
+ *
+ * With -export file, the shadow is mapped from that file rather than
+ * from anonymous memory, behind a header giving its geometry, the
+ * palette and a ring of recently changed rectangles (see vidcexport.h).
+ * Local programs such as screen grabbers can map the same file and
+ * copy just what has changed, without going through the protocol.
+ * Putting the file on a memory file system keeps it out of the disc.
+ *
+ * The server never waits for readers: the header is guarded with a
+ * sequence count and readers retry if it moved under them.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+
+/* X11 headers
+ */
+#include "X.h"
+#include "Xproto.h"
+#include "misc.h"
+#include "scrnintstr.h"
+
+/* Our private definitions */
+#include "private.h"
+#include "vidcexport.h"
+
+extern struct _private private;
+
+/*#define DEBUG*/
+
+#ifdef DEBUG
+#define DPRINTF(x) ErrorF x
+#else
+#define DPRINTF(x)
+#endif
+
+/*
+ * Keep the compiler (and, where there is more than one, the CPUs) from
+ * moving stores across the sequence count.
+ */
+#if defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 1))
+#define EXPORT_BARRIER()	__sync_synchronize()
+#else
+#define EXPORT_BARRIER()	__asm__ __volatile__("" : : : "memory")
+#endif
+
+/* -export file: where to put the shadow, or NULL */
+char *vidc_export_file = NULL;
+
+static int export_fd = -1;
+static char *export_base;
+static int export_size;
+static struct vidc_export_header *header;
+
+/* Rectangle being built up from the spans of one flush */
+static struct vidc_export_rect pending;
+static Bool pending_valid;
+static Bool writing;
+
+static void export_begin(void)
+{
+	if (!writing) {
+		header->seq++;
+		EXPORT_BARRIER();
+		writing = TRUE;
+	}
+}
+
+static void export_end(void)
+{
+	if (writing) {
+		EXPORT_BARRIER();
+		header->seq++;
+		writing = FALSE;
+	}
+}
+
+/*
+ * Map the shadow from the export file, after the header. The mapping
+ * is kept over server resets and only redone if the size changes.
+ */
+char *vidc_export_map(int size, int depth, int stride)
+{
+	int pagesize = getpagesize();
+	int offset = (sizeof(struct vidc_export_header) + pagesize - 1) &
+	    ~(pagesize - 1);
+
+	if (export_fd < 0) {
+		/* The screen may show things that aren't everyone's business */
+		export_fd = open(vidc_export_file, O_RDWR | O_CREAT, 0600);
+		if (export_fd < 0) {
+			ErrorF("vidc-export: %s: %s\n", vidc_export_file,
+			    strerror(errno));
+			return NULL;
+		}
+		fcntl(export_fd, F_SETFD, FD_CLOEXEC);
+	}
+	if (export_base && export_size != offset + size) {
+		munmap(export_base, export_size);
+		export_base = NULL;
+	}
+	if (!export_base) {
+		export_size = offset + size;
+		if (ftruncate(export_fd, export_size) < 0) {
+			ErrorF("vidc-export: %s: %s\n", vidc_export_file,
+			    strerror(errno));
+			return NULL;
+		}
+		export_base = (char *)mmap(NULL, export_size,
+		    PROT_READ | PROT_WRITE, MAP_SHARED, export_fd, 0);
+		if (export_base == (char *)MAP_FAILED) {
+			ErrorF("vidc-export: mmap: %s\n", strerror(errno));
+			export_base = NULL;
+			return NULL;
+		}
+		header = (struct vidc_export_header *)export_base;
+		if (header->magic != VIDC_EXPORT_MAGIC ||
+		    header->version != VIDC_EXPORT_VERSION) {
+			memset(header, 0, sizeof(*header));
+			header->magic = VIDC_EXPORT_MAGIC;
+			header->version = VIDC_EXPORT_VERSION;
+		}
+
+		/*
+		 * A server that died while writing leaves seq odd, which
+		 * would have readers take our writes for quiet spells.
+		 */
+		if (header->seq & 1)
+			header->seq++;
+		writing = FALSE;
+	}
+
+	export_begin();
+	header->layout++;
+	header->data_offset = offset;
+	header->width = private.xres;
+	header->height = private.yres;
+	header->depth = depth;
+	header->stride = stride;
+	export_end();
+	pending_valid = FALSE;
+	return export_base + offset;
+}
+
+/*
+ * Fill in the pixel layout once the visuals are known.
+ */
+void vidc_export_init(ScreenPtr screen)
+{
+	VisualPtr v;
+	int i;
+
+	if (!header)
+		return;
+	export_begin();
+	header->red_mask = header->green_mask = header->blue_mask = 0;
+	for (i = 0, v = screen->visuals; i < screen->numVisuals; i++, v++)
+		if (v->class == TrueColor) {
+			header->red_mask = v->redMask;
+			header->green_mask = v->greenMask;
+			header->blue_mask = v->blueMask;
+			break;
+		}
+	export_end();
+}
+
+static void export_push(struct vidc_export_rect *r)
+{
+	export_begin();
+	header->ring[header->head % VIDC_EXPORT_RING] = *r;
+	EXPORT_BARRIER();
+	header->head++;
+}
+
+/*
+ * A span the flush has just written out. Lines with the same span are
+ * merged into one rectangle.
+ */
+void vidc_export_span(int y, int x1, int x2)
+{
+	if (pending_valid) {
+		if (y == pending.y2 && x1 == pending.x1 && x2 == pending.x2) {
+			pending.y2 = y + 1;
+			return;
+		}
+		export_push(&pending);
+	}
+	pending.x1 = x1;
+	pending.x2 = x2;
+	pending.y1 = y;
+	pending.y2 = y + 1;
+	pending_valid = TRUE;
+}
+
+/*
+ * End of a flush: publish what it changed.
+ */
+void vidc_export_commit(void)
+{
+	if (pending_valid)
+		export_push(&pending);
+	pending_valid = FALSE;
+	export_end();
+}
+
+/*
+ * A palette entry has been written, with 8 bit components.
+ */
+void vidc_export_palette(int index, int r, int g, int b)
+{
+	if (!header || index < 0 || index >= 256)
+		return;
+	export_begin();
+	header->palette[index] = ((r & 0xff) << 16) | ((g & 0xff) << 8) |
+	    (b & 0xff);
+	export_end();
+}
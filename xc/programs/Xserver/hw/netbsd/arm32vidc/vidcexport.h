@@ -0,0 +1,89 @@
+/*	$NetBSD$	*/
+
+/*
+ * Copyright (c) 1999 Mark Brinicombe & Neil A. Carson 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * X11 driver code for VIDC20
+ */
+
+/*
+ * Layout of the file the shadow is exported through with -export.
+ * This is shared with the programs that read it, so it uses no X
+ * types.
+ *
+ * The file starts with this header; the pixels follow at data_offset
+ * (a page boundary), stride bytes per line. Changed areas are appended
+ * to ring[] as the shadow is flushed, rectangle number n going in
+ * ring[n % VIDC_EXPORT_RING] and head counting every rectangle ever
+ * written. The header is protected by seq, which is odd while the
+ * server is changing it. A reader does:
+ *
+ *	again:
+ *		s = seq; if s is odd, wait a little and go to again
+ *		if layout has changed, remap the file and copy everything
+ *		h = head
+ *		if h - last > VIDC_EXPORT_RING, copy everything
+ *		else note ring[last % RING] .. ring[(h - 1) % RING]
+ *		read the palette if needed
+ *		if seq != s, go to again
+ *		last = h
+ *		copy the pixels in the noted rectangles
+ *
+ * The server doesn't wait for readers, so pixels may be changing as
+ * they are copied; anything changed that way turns up in the ring
+ * again after the next flush.
+ */
+
+#ifndef _VIDCEXPORT_H_
+#define _VIDCEXPORT_H_
+
+#define VIDC_EXPORT_MAGIC	0x56494458	/* "VIDX" */
+#define VIDC_EXPORT_VERSION	1
+#define VIDC_EXPORT_RING	256
+
+struct vidc_export_rect {
+	unsigned short	x1, y1;		/* top left, inclusive */
+	unsigned short	x2, y2;		/* bottom right, exclusive */
+};
+
+struct vidc_export_header {
+	unsigned int	magic;
+	unsigned int	version;
+	volatile unsigned int seq;	/* odd while being changed */
+	unsigned int	layout;		/* bumped when the geometry changes */
+	unsigned int	data_offset;	/* of the pixels in the file */
+	unsigned int	width;		/* pixels */
+	unsigned int	height;
+	unsigned int	depth;		/* bits per pixel, 8 or 16 */
+	unsigned int	stride;		/* bytes per line */
+	unsigned int	red_mask;	/* at 16bpp */
+	unsigned int	green_mask;
+	unsigned int	blue_mask;
+	unsigned int	palette[256];	/* 0x00rrggbb, at 8bpp */
+	volatile unsigned int head;	/* rectangles written so far */
+	struct vidc_export_rect ring[VIDC_EXPORT_RING];
+};
+
+#endif /* _VIDCEXPORT_H_ */
@@ -0,0 +1,591 @@
+/*	$NetBSD$	*/
+
+/*
+ * Copyright (c) 1999 Mark Brinicombe & Neil A. Carson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * X11 driver code for VIDC20
+ */
+
+/*
+ * Glyph cache.
+ *
+ * cfb expands each glyph's 1bpp bitmap every time it is drawn. We
+ * instead keep glyphs already expanded to byte masks at the depth
+ * being drawn, 0xff where the glyph is set and 0 elsewhere, laid out
+ * so that rows start at the same position within a word as they will
+ * in the frame buffer. Drawing is then a run of whole word stores.
+ *
+ * Terminal fonts are cached as whole character cells for ImageText,
+ * so every word of the cell is written without reading it back.
+ * Other fonts and PolyText use masks of just the ink.
+ *
+ * The cache is bounded by -glyphcache (in kilobytes) and evicts the
+ * least recently used glyphs. Entries are dropped when their font is
+ * unrealized since its glyph pointers are about to go away.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+
+/* X11 headers
+ */
+#include "X.h"
+#include "Xproto.h"
+#include "misc.h"
+#include "scrnintstr.h"
+#include "windowstr.h"
+#include "pixmapstr.h"
+#include "regionstr.h"
+#include "gcstruct.h"
+#include "fontstruct.h"
+#include "dixfontstr.h"
+#include "servermd.h"
+
+/* Our private definitions */
+#include "private.h"
+
+/*#define DEBUG*/
+
+#ifdef DEBUG
+#define DPRINTF(x) ErrorF x
+#else
+#define DPRINTF(x)
+#endif
+
+#define GLYPH_HASH_SIZE	1024
+
+int vidc_glyph_cache_kb = 256;
+
+extern FontPtr defaultFont;
+
+typedef struct _GlyphEntry {
+	struct _GlyphEntry	*hnext;		/* hash chain */
+	struct _GlyphEntry	*lnext;		/* towards least recent */
+	struct _GlyphEntry	*lprev;		/* towards most recent */
+	FontPtr		font;
+	CharInfoPtr	pci;
+	short		bpp;		/* bytes per pixel */
+	short		phase;		/* byte offset of the first pixel */
+	short		cell;		/* whole cell rather than ink */
+	short		width;		/* pixels */
+	short		words;		/* words per row */
+	short		rows;
+	int		size;
+	CARD32		mask[1];
+} GlyphEntry;
+
+static GlyphEntry *glyph_hash[GLYPH_HASH_SIZE];
+static GlyphEntry *glyph_mru, *glyph_lru;
+static unsigned long glyph_bytes;
+static int glyph_entries;
+
+static unsigned long glyph_hits, glyph_misses, glyph_evictions;
+
+/* Wrapped screen functions */
+static CloseScreenProcPtr	glyph_close_screen_wrap;
+static UnrealizeFontProcPtr	glyph_unrealize_font_wrap;
+
+#define GLYPH_HASH(pci, phase, cell) \
+	((((unsigned long)(pci) >> 3) ^ (phase) ^ ((cell) << 2)) & \
+	    (GLYPH_HASH_SIZE - 1))
+
+static void glyph_lru_unlink(GlyphEntry *e)
+{
+	if (e->lprev)
+		e->lprev->lnext = e->lnext;
+	else
+		glyph_mru = e->lnext;
+	if (e->lnext)
+		e->lnext->lprev = e->lprev;
+	else
+		glyph_lru = e->lprev;
+}
+
+static void glyph_lru_push(GlyphEntry *e)
+{
+	e->lprev = NULL;
+	e->lnext = glyph_mru;
+	if (glyph_mru)
+		glyph_mru->lprev = e;
+	else
+		glyph_lru = e;
+	glyph_mru = e;
+}
+
+static void glyph_free(GlyphEntry *e)
+{
+	GlyphEntry **pp;
+
+	for (pp = &glyph_hash[GLYPH_HASH(e->pci, e->phase, e->cell)];
+	    *pp != e; pp = &(*pp)->hnext)
+		;
+	*pp = e->hnext;
+	glyph_lru_unlink(e);
+	glyph_bytes -= e->size;
+	glyph_entries--;
+	xfree(e);
+}
+
+/* Drop all the glyphs of a font, or all glyphs if font is NULL */
+static void glyph_purge(FontPtr font)
+{
+	GlyphEntry *e, *next;
+
+	for (e = glyph_mru; e; e = next) {
+		next = e->lnext;
+		if (font == NULL || e->font == font)
+			glyph_free(e);
+	}
+}
+
+/*
+ * Expand a glyph into a new entry. For a cell the ink is placed
+ * within the character cell, clipped to it.
+ */
+static GlyphEntry *glyph_expand(FontPtr font, CharInfoPtr pci, int bpp,
+    int phase, Bool cell)
+{
+	GlyphEntry *e;
+	unsigned char *src, *dst;
+	int width, rows, words, size, ix, iy, gw, gh, r, i, b;
+
+	gw = GLYPHWIDTHPIXELS(pci);
+	gh = GLYPHHEIGHTPIXELS(pci);
+	if (cell) {
+		width = pci->metrics.characterWidth;
+		rows = FONTASCENT(font) + FONTDESCENT(font);
+		ix = pci->metrics.leftSideBearing;
+		iy = FONTASCENT(font) - pci->metrics.ascent;
+	} else {
+		width = gw;
+		rows = gh;
+		ix = iy = 0;
+	}
+	if (width <= 0 || rows <= 0)
+		return NULL;
+	words = (phase + width * bpp + 3) >> 2;
+	size = sizeof(GlyphEntry) + (words * rows - 1) * sizeof(CARD32);
+	if (size > vidc_glyph_cache_kb * 1024)
+		return NULL;
+
+	while (glyph_lru && glyph_bytes + size > vidc_glyph_cache_kb * 1024) {
+		glyph_free(glyph_lru);
+		glyph_evictions++;
+	}
+	if ((e = (GlyphEntry *)xalloc(size)) == NULL)
+		return NULL;
+
+	e->font = font;
+	e->pci = pci;
+	e->bpp = bpp;
+	e->phase = phase;
+	e->cell = cell;
+	e->width = width;
+	e->words = words;
+	e->rows = rows;
+	e->size = size;
+	memset(e->mask, 0, words * rows * sizeof(CARD32));
+
+	for (r = 0; r < gh; r++) {
+		if (iy + r < 0 || iy + r >= rows)
+			continue;
+		src = FONTGLYPHBITS(NULL, pci) + r * GLYPHWIDTHBYTESPADDED(pci);
+		dst = (unsigned char *)(e->mask + (iy + r) * words) + phase;
+		for (i = 0; i < gw; i++) {
+#if BITMAP_BIT_ORDER == LSBFirst
+			if (!(src[i >> 3] & (1 << (i & 7))))
+#else
+			if (!(src[i >> 3] & (0x80 >> (i & 7))))
+#endif
+				continue;
+			if (ix + i < 0 || ix + i >= width)
+				continue;
+			for (b = 0; b < bpp; b++)
+				dst[(ix + i) * bpp + b] = 0xff;
+		}
+	}
+
+	e->hnext = glyph_hash[GLYPH_HASH(pci, phase, cell)];
+	glyph_hash[GLYPH_HASH(pci, phase, cell)] = e;
+	glyph_lru_push(e);
+	glyph_bytes += size;
+	glyph_entries++;
+	return e;
+}
+
+static GlyphEntry *glyph_lookup(FontPtr font, CharInfoPtr pci, int bpp,
+    int phase, Bool cell)
+{
+	GlyphEntry *e;
+
+	for (e = glyph_hash[GLYPH_HASH(pci, phase, cell)]; e; e = e->hnext) {
+		if (e->pci == pci && e->font == font && e->phase == phase &&
+		    e->cell == cell && e->bpp == bpp) {
+			glyph_hits++;
+			if (e != glyph_mru) {
+				glyph_lru_unlink(e);
+				glyph_lru_push(e);
+			}
+			return e;
+		}
+	}
+	glyph_misses++;
+	return glyph_expand(font, pci, bpp, phase, cell);
+}
+
+/*
+ * Is the box wholly inside one box of the clip? The clip is sorted by
+ * y1 so we can stop at the first box starting below ours.
+ */
+static Bool glyph_clip_contains(RegionPtr clip, BoxPtr box)
+{
+	int n = REGION_NUM_RECTS(clip);
+	BoxPtr p = REGION_RECTS(clip);
+
+	for (; n--; p++) {
+		if (p->y1 > box->y1)
+			break;
+		if (p->x1 <= box->x1 && p->x2 >= box->x2 && p->y2 >= box->y2)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+static void glyph_drawable_bits(DrawablePtr pDraw, unsigned char **base,
+    int *stride)
+{
+	PixmapPtr pPix;
+
+	if (pDraw->type == DRAWABLE_WINDOW)
+		pPix = (PixmapPtr)pDraw->pScreen->devPrivate;
+	else
+		pPix = (PixmapPtr)pDraw;
+	*base = (unsigned char *)pPix->devPrivate.ptr;
+	*stride = pPix->devKind;
+}
+
+static CARD32 glyph_replicate(unsigned long pixel, int bpp)
+{
+	CARD32 fill;
+
+	if (bpp == 1) {
+		fill = pixel & 0xff;
+		fill |= fill << 8;
+	} else
+		fill = pixel & 0xffff;
+	return fill | (fill << 16);
+}
+
+/*
+ * Write a cell: glyph pixels in fg, the rest in bg. Only the partly
+ * covered words at the ends of each row are read.
+ */
+static void glyph_draw_cell(unsigned char *base, int stride, int x, int y,
+    GlyphEntry *e, CARD32 fg, CARD32 bg)
+{
+	CARD32 *row, *m = e->mask;
+	CARD32 first, last, v;
+	int tail = (e->phase + e->width * e->bpp) & 3;
+	int r, k, n = e->words - 1;
+
+	row = (CARD32 *)(base + y * stride + ((x * e->bpp) & ~3));
+	first = ~(CARD32)0 << (e->phase << 3);
+	last = tail ? ((CARD32)1 << (tail << 3)) - 1 : ~(CARD32)0;
+	if (n == 0)
+		first &= last;
+
+	for (r = e->rows; r--; m += e->words) {
+		v = (fg & m[0]) | (bg & ~m[0]);
+		row[0] = (row[0] & ~first) | (v & first);
+		for (k = 1; k < n; k++)
+			row[k] = (fg & m[k]) | (bg & ~m[k]);
+		if (n > 0) {
+			v = (fg & m[n]) | (bg & ~m[n]);
+			row[n] = (row[n] & ~last) | (v & last);
+		}
+		row = (CARD32 *)((unsigned char *)row + stride);
+	}
+}
+
+/* Write the glyph's set pixels in fg, leaving the rest alone */
+static void glyph_draw_ink(unsigned char *base, int stride, int x, int y,
+    GlyphEntry *e, CARD32 fg)
+{
+	CARD32 *row, *m = e->mask;
+	int r, k;
+
+	row = (CARD32 *)(base + y * stride + ((x * e->bpp) & ~3));
+	for (r = e->rows; r--; m += e->words) {
+		for (k = 0; k < e->words; k++)
+			if (m[k])
+				row[k] = (row[k] & ~m[k]) | (fg & m[k]);
+		row = (CARD32 *)((unsigned char *)row + stride);
+	}
+}
+
+/*
+ * ImageGlyphBlt. Only terminal fonts, drawn whole within one clip
+ * box, are done here; everything else goes to cfb.
+ */
+void vidc_glyph_image_blt(DrawablePtr pDraw, GCPtr pGC, int x, int y,
+    unsigned int nglyph, CharInfoPtr *ppci, pointer pglyphBase)
+{
+	FontPtr font = pGC->font;
+	GCOps *cfbOps = vidc_accel_cfb_ops(pGC);
+	GlyphEntry *e;
+	BoxRec box;
+	unsigned char *base;
+	int stride, bpp = pDraw->bitsPerPixel >> 3;
+	int w, gx, i;
+	CARD32 fg, bg;
+
+	if (!TERMINALFONT(font) || nglyph == 0)
+		goto fallback;
+
+	w = FONTMAXBOUNDS(font, characterWidth);
+	box.x1 = pDraw->x + x;
+	box.y1 = pDraw->y + y - FONTASCENT(font);
+	box.x2 = box.x1 + nglyph * w;
+	box.y2 = pDraw->y + y + FONTDESCENT(font);
+	if (!glyph_clip_contains(vidc_accel_clip(pGC), &box))
+		goto fallback;
+
+	glyph_drawable_bits(pDraw, &base, &stride);
+	fg = glyph_replicate(pGC->fgPixel, bpp);
+	bg = glyph_replicate(pGC->bgPixel, bpp);
+	for (i = 0; i < nglyph; i++) {
+		gx = box.x1 + i * w;
+		e = glyph_lookup(font, ppci[i], bpp, (gx * bpp) & 3, TRUE);
+		if (e)
+			glyph_draw_cell(base, stride, gx, box.y1, e, fg, bg);
+		else
+			(*cfbOps->ImageGlyphBlt)(pDraw, pGC, x + i * w, y, 1,
+			    &ppci[i], pglyphBase);
+	}
+	return;
+
+fallback:
+	(*cfbOps->ImageGlyphBlt)(pDraw, pGC, x, y, nglyph, ppci, pglyphBase);
+}
+
+/*
+ * PolyGlyphBlt for solid fills, again only when the text lies wholly
+ * within one clip box.
+ */
+void vidc_glyph_poly_blt(DrawablePtr pDraw, GCPtr pGC, int x, int y,
+    unsigned int nglyph, CharInfoPtr *ppci, pointer pglyphBase)
+{
+	FontPtr font = pGC->font;
+	GCOps *cfbOps = vidc_accel_cfb_ops(pGC);
+	CharInfoPtr pci;
+	GlyphEntry *e;
+	BoxRec box;
+	unsigned char *base;
+	int stride, bpp = pDraw->bitsPerPixel >> 3;
+	int ox, gx, gy, i;
+	CARD32 fg;
+
+	/* The extents of the ink */
+	box.x1 = box.y1 = MAXSHORT;
+	box.x2 = box.y2 = MINSHORT;
+	ox = pDraw->x + x;
+	for (i = 0; i < nglyph; i++) {
+		pci = ppci[i];
+		if (GLYPHWIDTHPIXELS(pci) && GLYPHHEIGHTPIXELS(pci)) {
+			box.x1 = min(box.x1, ox + pci->metrics.leftSideBearing);
+			box.x2 = max(box.x2, ox + pci->metrics.rightSideBearing);
+			box.y1 = min(box.y1, pDraw->y + y - pci->metrics.ascent);
+			box.y2 = max(box.y2, pDraw->y + y + pci->metrics.descent);
+		}
+		ox += pci->metrics.characterWidth;
+	}
+	if (box.x1 >= box.x2)
+		return;
+	if (!glyph_clip_contains(vidc_accel_clip(pGC), &box)) {
+		(*cfbOps->PolyGlyphBlt)(pDraw, pGC, x, y, nglyph, ppci,
+		    pglyphBase);
+		return;
+	}
+
+	glyph_drawable_bits(pDraw, &base, &stride);
+	fg = glyph_replicate(pGC->fgPixel, bpp);
+	ox = 0;
+	for (i = 0; i < nglyph; i++) {
+		pci = ppci[i];
+		if (GLYPHWIDTHPIXELS(pci) && GLYPHHEIGHTPIXELS(pci)) {
+			gx = pDraw->x + x + ox + pci->metrics.leftSideBearing;
+			gy = pDraw->y + y - pci->metrics.ascent;
+			e = glyph_lookup(font, pci, bpp, (gx * bpp) & 3, FALSE);
+			if (e)
+				glyph_draw_ink(base, stride, gx, gy, e, fg);
+			else
+				(*cfbOps->PolyGlyphBlt)(pDraw, pGC, x + ox, y,
+				    1, &ppci[i], pglyphBase);
+		}
+		ox += pci->metrics.characterWidth;
+	}
+}
+
+static Bool glyph_unrealize_font(ScreenPtr screen, FontPtr font)
+{
+	Bool ret;
+
+	glyph_purge(font);
+	screen->UnrealizeFont = glyph_unrealize_font_wrap;
+	ret = (*screen->UnrealizeFont)(screen, font);
+	screen->UnrealizeFont = glyph_unrealize_font;
+	return ret;
+}
+
+static Bool glyph_close_screen(int index, ScreenPtr screen)
+{
+	glyph_purge(NULL);
+	screen->CloseScreen = glyph_close_screen_wrap;
+	screen->UnrealizeFont = glyph_unrealize_font_wrap;
+	return (*screen->CloseScreen)(index, screen);
+}
+
+/* Log how well the cache is doing
+ */
+void vidc_glyph_stats(void)
+{
+	unsigned long lookups = glyph_hits + glyph_misses;
+
+	if (vidc_glyph_cache_kb <= 0)
+		return;
+	ErrorF("vidc-glyph: hits=%lu misses=%lu evictions=%lu entries=%d "
+	    "bytes=%lu hit_rate=%lu%%\n", glyph_hits, glyph_misses,
+	    glyph_evictions, glyph_entries, glyph_bytes,
+	    lookups ? glyph_hits * 100 / lookups : 0);
+}
+
+/*
+ * -glyphbench: time a screen of ImageText8 in the default font through
+ * the cache and through cfb's ImageGlyphBlt. Fonts aren't open until
+ * after the screens are set up, so this runs the first time the server
+ * blocks.
+ */
+Bool vidc_glyph_bench_wanted = FALSE;
+
+#define GLYPH_BENCH_COLS	80
+#define GLYPH_BENCH_LINES	25
+#define GLYPH_BENCH_ROUNDS	20
+
+static unsigned long long glyph_bench_run(DrawablePtr pDraw, GCPtr pGC,
+    GCOps *ops, char *text, int step)
+{
+	GCOps *saved = pGC->ops;
+	unsigned long long start;
+	int r, l;
+
+	/* mi's ImageText8 calls back through pGC->ops for the glyphs */
+	pGC->ops = ops;
+	start = vidc_trace_now();
+	for (r = 0; r < GLYPH_BENCH_ROUNDS; r++)
+		for (l = 0; l < GLYPH_BENCH_LINES; l++)
+			(*ops->ImageText8)(pDraw, pGC, 0,
+			    l * step + FONTASCENT(pGC->font), GLYPH_BENCH_COLS,
+			    text + (l + r) % 32);
+	pGC->ops = saved;
+	return (vidc_trace_now() - start) / GLYPH_BENCH_ROUNDS;
+}
+
+static void glyph_bench_block(pointer data, pointer pTimeout,
+    pointer pReadmask)
+{
+	ScreenPtr screen = (ScreenPtr)data;
+	unsigned long hits = glyph_hits, misses = glyph_misses;
+	unsigned long vals[2];
+	unsigned long long cached, cfb;
+	PixmapPtr pPix;
+	GCPtr pGC;
+	GCOps ours;
+	char text[GLYPH_BENCH_COLS + 32];
+	int i, w, step;
+
+	RemoveBlockAndWakeupHandlers(glyph_bench_block,
+	    (void (*)())NoopDDA, data);
+
+	if (defaultFont == NULL)
+		return;
+	w = FONTMAXBOUNDS(defaultFont, characterWidth);
+	step = FONTASCENT(defaultFont) + FONTDESCENT(defaultFont);
+	pPix = (*screen->CreatePixmap)(screen, w * GLYPH_BENCH_COLS,
+	    step * GLYPH_BENCH_LINES, screen->rootDepth);
+	if (pPix == NULL)
+		return;
+	if ((pGC = CreateScratchGC(screen, screen->rootDepth)) == NULL) {
+		(*screen->DestroyPixmap)(pPix);
+		return;
+	}
+	vals[0] = 1;
+	vals[1] = 0;
+	ChangeGC(pGC, GCForeground | GCBackground, vals);
+	ValidateGC(&pPix->drawable, pGC);
+
+	for (i = 0; i < sizeof(text); i++)
+		text[i] = ' ' + i % 95;
+
+	/* cfb's ops with just the cached ImageGlyphBlt put in */
+	ours = *vidc_accel_cfb_ops(pGC);
+	ours.ImageGlyphBlt = vidc_glyph_image_blt;
+
+	/* Once through to fill the cache */
+	glyph_bench_run(&pPix->drawable, pGC, &ours, text, step);
+	cached = glyph_bench_run(&pPix->drawable, pGC, &ours, text, step);
+	cfb = glyph_bench_run(&pPix->drawable, pGC, vidc_accel_cfb_ops(pGC),
+	    text, step);
+
+	ErrorF("vidc-glyph: bench font=%dx%d terminal=%d chars=%d "
+	    "cached_us=%llu cfb_us=%llu speedup=%llu.%02llu\n", w, step,
+	    TERMINALFONT(defaultFont) ? 1 : 0,
+	    GLYPH_BENCH_COLS * GLYPH_BENCH_LINES, cached / 1000, cfb / 1000,
+	    cached ? cfb / cached : 0, cached ? cfb * 100 / cached % 100 : 0);
+
+	glyph_hits = hits;
+	glyph_misses = misses;
+	FreeScratchGC(pGC);
+	(*screen->DestroyPixmap)(pPix);
+}
+
+void vidc_glyph_bench(ScreenPtr screen)
+{
+	RegisterBlockAndWakeupHandlers(glyph_bench_block,
+	    (void (*)())NoopDDA, (pointer)screen);
+}
+
+/*
+ * Set up the cache. Called from vidc_accel_init, which puts our glyph
+ * ops in place.
+ */
+Bool vidc_glyph_init(ScreenPtr screen)
+{
+	glyph_close_screen_wrap = screen->CloseScreen;
+	screen->CloseScreen = glyph_close_screen;
+	glyph_unrealize_font_wrap = screen->UnrealizeFont;
+	screen->UnrealizeFont = glyph_unrealize_font;
+	return TRUE;
+}
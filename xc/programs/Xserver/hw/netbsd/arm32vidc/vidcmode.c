@@ -0,0 +1,401 @@
+/*	$NetBSD$	*/
+
+/*
+ * Copyright (c) 1999 Mark Brinicombe & Neil A. Carson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * X11 driver code for VIDC20
+ */
+
+
+/*
+ * Video mode switching.
+ *
+ * -modes gives a list of other modes the console may be switched to
+ * while the server runs, with the mode it started in as the first of
+ * them. Ctrl+Alt+keypad plus and minus step through the list, so the
+ * screen can be dropped to a smaller or shallower mode when memory
+ * bandwidth is short (during video playback, say) and put back after.
+ *
+ * X keeps drawing at the depth the server started with: a mode has to
+ * render at that depth, so 2, 4 and 8bpp modes can be mixed as all
+ * three draw at 8bpp, but 16bpp modes only go with each other. -modes
+ * turns the shadow on so that X is never drawing straight into the
+ * mapping that goes away. A switch reprograms the console, maps the
+ * frame buffer again, reallocates the shadow and its damage tracking,
+ * points the screen pixmap at it, reloads the palette and resizes the
+ * root window, which repaints everything.
+ *
+ * The key only asks for the switch; it is done from the block handler,
+ * out of the way of the drawing and the SIGIO handler.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+
+/* X11 headers
+ */
+#include "X.h"
+#include "Xproto.h"
+#include "misc.h"
+#include "scrnintstr.h"
+#include "windowstr.h"
+#include "pixmapstr.h"
+#include "regionstr.h"
+#include "mipointer.h"
+#include "dix.h"
+
+/* Our private definitions */
+#include "private.h"
+
+extern struct _private private;
+extern WindowPtr *WindowTable;
+extern char *ConnectionInfo;
+
+/*#define DEBUG*/
+
+#ifdef DEBUG
+#define DPRINTF(x) ErrorF x
+#else
+#define DPRINTF(x)
+#endif
+
+#define MODE_MAX	8
+
+/* -modes: WxHxD,... */
+char *vidc_modes_spec;
+
+typedef struct {
+	int	xres;
+	int	yres;
+	int	depth;
+} ModeRec, *ModePtr;
+
+static ModeRec modes[MODE_MAX];
+static int mode_count, mode_current;
+
+/* Screen size in mm at start up, scaled for the other modes */
+static int mode_mm_width, mode_mm_height, mode_xres0, mode_yres0;
+
+/* Steps asked for from the keyboard, not yet taken */
+static volatile sig_atomic_t mode_step;
+
+/* Statistics */
+static unsigned long mode_switches;
+static unsigned long long mode_switch_ns;
+
+/* The depth X draws at for a frame buffer depth */
+#define MODE_RENDER_DEPTH(d)	((d) == 2 || (d) == 4 ? 8 : (d))
+
+/*
+ * Parse -modes against the mode the console is in now. Modes that
+ * can't be drawn at the depth the screen was set up for are dropped.
+ */
+void vidc_mode_init(ScreenPtr screen)
+{
+	char *p = vidc_modes_spec;
+	ModeRec m;
+	int n, i;
+
+	mode_count = 0;
+	mode_current = 0;
+	mode_step = 0;
+	if (p == NULL)
+		return;
+	if (!private.set_mode) {
+		ErrorF("This console can't change modes, ignoring -modes\n");
+		return;
+	}
+	if (!private.shadow_base) {
+		ErrorF("No mode switching without a shadow\n");
+		return;
+	}
+
+	modes[0].xres = private.xres;
+	modes[0].yres = private.yres;
+	modes[0].depth = private.depth;
+	mode_count = 1;
+	mode_xres0 = private.xres;
+	mode_yres0 = private.yres;
+	mode_mm_width = screen->mmWidth;
+	mode_mm_height = screen->mmHeight;
+
+	while (sscanf(p, "%dx%dx%d%n", &m.xres, &m.yres, &m.depth, &n) == 3) {
+		p += n;
+		if (*p == ',')
+			p++;
+		if (MODE_RENDER_DEPTH(m.depth) != private.shadow_depth ||
+		    m.xres <= 0 || m.yres <= 0 || m.xres % (32 / m.depth)) {
+			ErrorF("Mode %dx%dx%d can't be used from a %dbpp "
+			    "screen, ignored\n", m.xres, m.yres, m.depth,
+			    private.shadow_depth);
+			continue;
+		}
+		for (i = 0; i < mode_count; i++)
+			if (modes[i].xres == m.xres &&
+			    modes[i].yres == m.yres &&
+			    modes[i].depth == m.depth)
+				break;
+		if (i < mode_count)
+			continue;
+		if (mode_count == MODE_MAX) {
+			ErrorF("Only %d modes, ignoring the rest\n", MODE_MAX);
+			break;
+		}
+		modes[mode_count++] = m;
+	}
+	if (*p)
+		ErrorF("Can't make sense of -modes from \"%s\"\n", p);
+}
+
+/*
+ * The shallowest frame buffer depth the screen will be shown at.
+ */
+int vidc_mode_min_depth(void)
+{
+	int i, depth = private.depth;
+
+	for (i = 0; i < mode_count; i++)
+		if (modes[i].depth < depth)
+			depth = modes[i].depth;
+	return depth;
+}
+
+/*
+ * Ask for a step through the mode list, from the keyboard. Returns
+ * FALSE if there is nothing to switch between.
+ */
+Bool vidc_mode_next(int step)
+{
+	if (mode_count < 2)
+		return FALSE;
+	mode_step += step;
+	return TRUE;
+}
+
+/*
+ * Take the root window's clip away, or give it back at the screen's
+ * current size. Taking it away and giving it back around a switch
+ * leaves every window exposed, so clients repaint the lot.
+ */
+static void mode_root_clip(ScreenPtr screen, Bool enable)
+{
+	WindowPtr pWin = WindowTable[screen->myNum];
+	WindowPtr pChild, pLayerWin;
+	Bool viewable = pWin->viewable;
+	Bool marked = FALSE;
+	BoxRec box;
+
+	if (viewable) {
+		for (pChild = pWin->firstChild; pChild;
+		    pChild = pChild->nextSib)
+			(void)(*screen->MarkOverlappedWindows)(pChild, pChild,
+			    &pLayerWin);
+		(*screen->MarkWindow)(pWin);
+		marked = TRUE;
+		if (pWin->valdata)
+			pWin->valdata->before.resized = TRUE;
+	}
+
+	if (enable) {
+		box.x1 = 0;
+		box.y1 = 0;
+		box.x2 = screen->width;
+		box.y2 = screen->height;
+		REGION_RESET(screen, &pWin->winSize, &box);
+		REGION_RESET(screen, &pWin->borderSize, &box);
+		if (viewable)
+			REGION_RESET(screen, &pWin->borderClip, &box);
+		pWin->drawable.width = screen->width;
+		pWin->drawable.height = screen->height;
+	} else
+		REGION_EMPTY(screen, &pWin->borderClip);
+	REGION_EMPTY(screen, &pWin->clipList);
+
+	/* Children's sizes are clipped to the root's */
+	ResizeChildrenWinSize(pWin, 0, 0, 0, 0);
+
+	if (viewable) {
+		if (pWin->firstChild)
+			marked |= (*screen->MarkOverlappedWindows)(
+			    pWin->firstChild, pWin->firstChild,
+			    (WindowPtr *)NULL);
+		else {
+			(*screen->MarkWindow)(pWin);
+			marked = TRUE;
+		}
+		if (marked) {
+			(*screen->ValidateTree)(pWin, NullWindow, VTOther);
+			(*screen->HandleExposures)(pWin);
+			if (screen->PostValidateTree)
+				(*screen->PostValidateTree)(pWin, NullWindow,
+				    VTOther);
+		}
+	}
+	if (pWin->realized)
+		WindowsRestructured();
+}
+
+/*
+ * Tell clients about the new root size: new connections get it in the
+ * connection set up, and anyone watching the root gets ConfigureNotify.
+ */
+static void mode_tell_clients(ScreenPtr screen)
+{
+	WindowPtr root = WindowTable[screen->myNum];
+	xConnSetup *setup = (xConnSetup *)ConnectionInfo;
+	xWindowRoot *wr;
+	xEvent event;
+
+	/* Screen 0's root follows the vendor string and pixmap formats */
+	wr = (xWindowRoot *)(ConnectionInfo + sizeof(xConnSetup) +
+	    ((setup->nbytesVendor + 3) & ~3) +
+	    setup->numFormats * sizeof(xPixmapFormat));
+	wr->pixWidth = screen->width;
+	wr->pixHeight = screen->height;
+	wr->mmWidth = screen->mmWidth;
+	wr->mmHeight = screen->mmHeight;
+
+	memset(&event, 0, sizeof(event));
+	event.u.u.type = ConfigureNotify;
+	event.u.configureNotify.window = root->drawable.id;
+	event.u.configureNotify.aboveSibling = None;
+	event.u.configureNotify.width = screen->width;
+	event.u.configureNotify.height = screen->height;
+	DeliverEvents(root, &event, 1, NullWindow);
+}
+
+/*
+ * Keep the pointer on the screen after it has shrunk.
+ */
+static void mode_constrain_pointer(ScreenPtr screen)
+{
+	BoxRec box;
+	int x, y;
+
+	box.x1 = 0;
+	box.y1 = 0;
+	box.x2 = screen->width;
+	box.y2 = screen->height;
+	(*screen->ConstrainCursor)(screen, &box);
+	miPointerPosition(&x, &y);
+	if (x >= screen->width || y >= screen->height)
+		(*screen->SetCursorPosition)(screen, min(x, screen->width - 1),
+		    min(y, screen->height - 1), FALSE);
+}
+
+/*
+ * Switch to mode n of the list.
+ */
+static void mode_switch(ScreenPtr screen, int n)
+{
+	ModePtr m = &modes[n];
+	unsigned long long start = vidc_trace_now(), ns;
+
+	DPRINTF(("mode_switch: %dx%dx%d\n", m->xres, m->yres, m->depth));
+
+	/* A viewer's idea of the screen is about to be wrong */
+	vidc_rfb_mode_changed();
+
+	mode_root_clip(screen, FALSE);
+
+	/*
+	 * If the console won't take the mode it is left in whatever it
+	 * ended up in, and we carry on in that.
+	 */
+	munmap(private.vram_base, private.width * private.yres);
+	if (private.set_mode(m->xres, m->yres, m->depth))
+		mode_current = n;
+	else
+		ErrorF("vidc-mode: console refused %dx%dx%d\n", m->xres,
+		    m->yres, m->depth);
+	if ((private.vram_base = mmap(0, private.width * private.yres,
+	    PROT_READ | PROT_WRITE, MAP_FILE | MAP_SHARED,
+	    private.vram_fd, 0)) == MAP_FAILED)
+		FatalError("Unable to mmap frame buffer\n");
+	if (!vidc_shadow_resize())
+		FatalError("Unable to reallocate shadow frame buffer\n");
+
+	screen->width = private.xres;
+	screen->height = private.yres;
+	screen->mmWidth = mode_mm_width * private.xres / mode_xres0;
+	screen->mmHeight = mode_mm_height * private.yres / mode_yres0;
+	(*screen->ModifyPixmapHeader)((PixmapPtr)screen->devPrivate,
+	    private.xres, private.yres, 0, 0, private.shadow_width,
+	    (pointer)private.shadow_base);
+
+	/* The palette may have been reset, and may have changed size */
+	vidc_palette_forget();
+	if (private.colour_map)
+		vidc_load_colour_map(private.colour_map);
+
+	mode_root_clip(screen, TRUE);
+	mode_tell_clients(screen);
+	mode_constrain_pointer(screen);
+
+	/* The screen block handler has already flushed this time round */
+	vidc_shadow_flush();
+
+	if (vidc_tracing)
+		vidc_trace_event(VIDC_TRACE_MAIN, "ModeSwitch", n, start);
+	ns = vidc_trace_now() - start;
+	mode_switches++;
+	mode_switch_ns += ns;
+	ErrorF("vidc-mode: %dx%dx%d switch_us=%llu\n", private.xres,
+	    private.yres, private.depth, ns / 1000);
+}
+
+/*
+ * Take any switch asked for since the last time round. Called from the
+ * block handler.
+ */
+void vidc_mode_check(void)
+{
+	int step, n;
+
+	if (mode_step == 0)
+		return;
+	VIDC_HOLD_INPUT();
+	step = mode_step;
+	mode_step = 0;
+	vidc_release_input();
+
+	n = (mode_current + step) % mode_count;
+	if (n < 0)
+		n += mode_count;
+	if (n != mode_current)
+		mode_switch(screenInfo.screens[0], n);
+}
+
+void vidc_mode_stats(void)
+{
+	if (mode_count < 2)
+		return;
+	ErrorF("vidc-mode: mode=%d/%d %dx%dx%d switches=%lu ns=%llu\n",
+	    mode_current, mode_count, private.xres, private.yres,
+	    private.depth, mode_switches, mode_switch_ns);
+}
@@ -0,0 +1,188 @@
+/*	$NetBSD$	*/
+
+/*
+ * Copyright (c) 1999 Mark Brinicombe & Neil A. Carson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * X11 driver code for VIDC20
+ */
+
+/*
+ * Pointer motion delivery.
+ *
+ * The input backends hand their (already accelerated) motion to
+ * vidc_motion() and their key and button events to vidc_enqueue()
+ * rather than going to mi directly. Normally motion is passed straight
+ * on. When the dispatch loop falls behind, say in the middle of a big
+ * PutImage, motion events just pile up in mieq and the pointer then
+ * crawls after the mouse, so under pressure we hold pure motion back
+ * and merge it into a single move. The held motion is delivered before
+ * the next key or button event, so ordering is kept, and otherwise
+ * when the server next gets round to input or blocks.
+ *
+ * Pressure is judged from the number of events queued since input was
+ * last processed and from how long the oldest of them has waited.
+ */
+
+#include <stdio.h>
+#include <signal.h>
+#include <sys/types.h>
+
+/* X11 headers
+ */
+#include "X.h"
+#include "Xproto.h"
+#include "input.h"
+#include "misc.h"
+#include "mipointer.h"
+
+/* Our private definitions */
+#include "private.h"
+
+/*#define DEBUG*/
+
+#ifdef DEBUG
+#define DPRINTF(x) ErrorF x
+#else
+#define DPRINTF(x)
+#endif
+
+/* -motionlag: input unprocessed for this long means we're behind */
+int vidc_motion_lag_ms = 50;
+
+/* Queued events since input was processed that mean we're behind */
+#define MOTION_QUEUE_DEPTH	16
+
+/* Events queued since ProcessInputEvents() last ran, and when the first was */
+static volatile int queued;
+static volatile CARD32 oldest_queued;
+
+/* Motion held back while under pressure */
+static volatile int held_dx, held_dy;
+static volatile CARD32 held_time;
+static volatile Bool held;
+
+/* Statistics: motion handed to us, and moves actually made */
+static unsigned long motion_in, motion_out;
+
+static Bool under_pressure(CARD32 now)
+{
+	if (queued >= MOTION_QUEUE_DEPTH)
+		return TRUE;
+	return (queued && (CARD32)(now - oldest_queued) >=
+	    vidc_motion_lag_ms);
+}
+
+/* Count an event going into mieq */
+static void count_queued(void)
+{
+	if (queued++ == 0)
+		oldest_queued = GetTimeInMillis();
+}
+
+static void deliver_held(void)
+{
+	int dx = held_dx, dy = held_dy;
+
+	held = FALSE;
+	held_dx = held_dy = 0;
+	if (dx || dy) {
+		motion_out++;
+		count_queued();
+		miPointerDeltaCursor(dx, dy, held_time);
+	}
+}
+
+/*
+ * Move the pointer by an accelerated delta.
+ */
+void vidc_motion(int dx, int dy, CARD32 time)
+{
+	motion_in++;
+	if (under_pressure(GetTimeInMillis())) {
+		held_dx += dx;
+		held_dy += dy;
+		held_time = time;
+		held = TRUE;
+		return;
+	}
+	if (held) {
+		dx += held_dx;
+		dy += held_dy;
+		held = FALSE;
+		held_dx = held_dy = 0;
+	}
+	motion_out++;
+	count_queued();
+	miPointerDeltaCursor(dx, dy, time);
+}
+
+/*
+ * Queue a key or button event. These are never merged; any motion we
+ * are holding goes first so the event happens in the right place.
+ */
+void vidc_enqueue(xEvent *event)
+{
+	if (held)
+		deliver_held();
+	count_queued();
+	mieqEnqueue(event);
+}
+
+/*
+ * Called from ProcessInputEvents() and the block handler once the
+ * server has caught up with the queue.
+ */
+void vidc_motion_caught_up(void)
+{
+	VIDC_HOLD_INPUT();
+	if (held)
+		deliver_held();
+	queued = 0;
+	vidc_release_input();
+}
+
+static void motion_block_handler(pointer data, pointer pTimeout,
+    pointer pReadmask)
+{
+	if (held)
+		vidc_motion_caught_up();
+}
+
+Bool vidc_motion_init(void)
+{
+	queued = 0;
+	held = FALSE;
+	held_dx = held_dy = 0;
+	return RegisterBlockAndWakeupHandlers(motion_block_handler,
+	    (void (*)())NoopDDA, NULL);
+}
+
+void vidc_motion_stats(void)
+{
+	ErrorF("vidc-stats: motion_in=%lu motion_out=%lu ratio=%lu.%02lu\n",
+	    motion_in, motion_out,
+	    motion_out ? motion_in / motion_out : 0,
+	    motion_out ? (motion_in * 100 / motion_out) % 100 : 0);
+}
@@ -0,0 +1,225 @@
+/*	$NetBSD$	*/
+
+/*
+ * Copyright (c) 1999 Mark Brinicombe & Neil A. Carson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * X11 driver code for VIDC20
+ */
+
+
+/*
+ * A small pool of helper threads for splitting up work the main thread
+ * would otherwise do alone, such as flushing a big shadow update or a
+ * large fill. The work is divided into bands. Each thread taking part,
+ * the main thread included, starts off with an equal run of them and
+ * works from the front of it; one that runs out steals the back half
+ * of the longest run left, so a thread held up by a slow band or late
+ * to wake doesn't hold the rest up. The main thread returns once every
+ * band is done.
+ *
+ * The threads are started once, with -flushthreads, and kept over
+ * server resets. They are created with vidc_thread_create() so never
+ * take the input signals, and the band functions must not call into
+ * the rest of the server.
+ */
+
+#include <stdio.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+/* X11 headers
+ */
+#include "X.h"
+#include "Xproto.h"
+#include "misc.h"
+
+/* Our private definitions */
+#include "private.h"
+
+/*#define DEBUG*/
+
+#ifdef DEBUG
+#define DPRINTF(x) ErrorF x
+#else
+#define DPRINTF(x)
+#endif
+
+#define POOL_MAX_THREADS	16
+
+/* -flushthreads: threads, including the main one, to spread work over */
+int vidc_pool_threads = 1;
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+static pthread_t pool_thread[POOL_MAX_THREADS];
+static int pool_workers;
+
+/* The current job, guarded by pool_lock */
+static unsigned long pool_job;
+static VidcPoolFunc pool_func;
+static void *pool_arg;
+static int pool_bands;
+static int pool_users;		/* threads taking part */
+static int pool_busy;		/* helpers not finished yet */
+
+/* The run of bands each thread still has to do */
+static int pool_next[POOL_MAX_THREADS];
+static int pool_end[POOL_MAX_THREADS];
+
+/* Statistics */
+static unsigned long pool_jobs, pool_steals;
+
+/*
+ * Take the next band for thread self, stealing if need be. Called with
+ * pool_lock held; returns -1 once there is nothing left.
+ */
+static int pool_take(int self)
+{
+	int i, n, victim = -1, most = 0;
+
+	if (pool_next[self] < pool_end[self])
+		return pool_next[self]++;
+	for (i = 0; i < pool_users; i++)
+		if (pool_end[i] - pool_next[i] > most) {
+			most = pool_end[i] - pool_next[i];
+			victim = i;
+		}
+	if (victim < 0)
+		return -1;
+	n = (most + 1) / 2;
+	pool_end[victim] -= n;
+	pool_next[self] = pool_end[victim];
+	pool_end[self] = pool_next[self] + n;
+	pool_steals++;
+	return pool_next[self]++;
+}
+
+/*
+ * Do bands until there are none left. Called and returns with
+ * pool_lock held.
+ */
+static void pool_work_on(int self)
+{
+	VidcPoolFunc func = pool_func;
+	void *arg = pool_arg;
+	int nbands = pool_bands;
+	int band;
+
+	while ((band = pool_take(self)) >= 0) {
+		pthread_mutex_unlock(&pool_lock);
+		(*func)(arg, band, nbands);
+		pthread_mutex_lock(&pool_lock);
+	}
+}
+
+static void *pool_worker(void *arg)
+{
+	int self = (int)(long)arg;
+	unsigned long seen = 0;
+
+	pthread_mutex_lock(&pool_lock);
+	for (;;) {
+		while (pool_job == seen)
+			pthread_cond_wait(&pool_work, &pool_lock);
+		seen = pool_job;
+		if (self >= pool_users)
+			continue;
+		pool_work_on(self);
+		if (--pool_busy == 0)
+			pthread_cond_signal(&pool_done);
+	}
+	/* NOTREACHED */
+	return NULL;
+}
+
+/*
+ * Start the helper threads, the first time round.
+ */
+Bool vidc_pool_init(void)
+{
+	if (vidc_pool_threads > POOL_MAX_THREADS)
+		vidc_pool_threads = POOL_MAX_THREADS;
+	while (pool_workers < vidc_pool_threads - 1) {
+		if (vidc_thread_create(&pool_thread[pool_workers], pool_worker,
+		    (void *)(long)(pool_workers + 1)) != 0) {
+			ErrorF("vidc-pool: only %d threads\n",
+			    pool_workers + 1);
+			return pool_workers > 0;
+		}
+		pool_workers++;
+	}
+	return TRUE;
+}
+
+/* Threads work can be spread over, counting the main thread */
+int vidc_pool_size(void)
+{
+	return pool_workers + 1;
+}
+
+/*
+ * Run func over nbands bands and wait for them all. No more threads
+ * than bands take part, so nbands can also be used to limit them.
+ */
+void vidc_pool_run(VidcPoolFunc func, void *arg, int nbands)
+{
+	int i, users = pool_workers + 1;
+
+	if (users > nbands)
+		users = nbands;
+	if (users <= 1) {
+		for (i = 0; i < nbands; i++)
+			(*func)(arg, i, nbands);
+		return;
+	}
+
+	pthread_mutex_lock(&pool_lock);
+	pool_func = func;
+	pool_arg = arg;
+	pool_bands = nbands;
+	pool_users = users;
+	pool_busy = users - 1;
+	for (i = 0; i < users; i++) {
+		pool_next[i] = nbands * i / users;
+		pool_end[i] = nbands * (i + 1) / users;
+	}
+	pool_jobs++;
+	pool_job++;
+	pthread_cond_broadcast(&pool_work);
+
+	pool_work_on(0);
+	while (pool_busy)
+		pthread_cond_wait(&pool_done, &pool_lock);
+	pthread_mutex_unlock(&pool_lock);
+}
+
+void vidc_pool_stats(void)
+{
+	if (pool_workers == 0)
+		return;
+	ErrorF("vidc-pool: threads=%d jobs=%lu steals=%lu\n",
+	    pool_workers + 1, pool_jobs, pool_steals);
+}
@@ -0,0 +1,642 @@
+/*	$NetBSD$	*/
+
+/*
+ * Copyright (c) 1999 Mark Brinicombe & Neil A. Carson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * X11 driver code for VIDC20
+ */
+
+/*
+ * Drawing op profiling.
+ *
+ * With -profile we wrap the screen and GC ops straight on top of
+ * cfb/mfb and keep a count of calls, pixels touched and nanoseconds
+ * spent for each of the interesting ones. The totals are written to
+ * the log along with the other statistics on SIGUSR1. Without
+ * -profile nothing is wrapped, so it costs nothing. The same wrappers
+ * feed the timeline trace when -trace is given.
+ *
+ * Ops we don't count still have to be wrapped so that we stay in
+ * place over the underlying layer's ops switching.
+ */
+
+#include <stdio.h>
+#include <sys/types.h>
+
+/* X11 headers
+ */
+#include "X.h"
+#include "Xproto.h"
+#include "misc.h"
+#include "scrnintstr.h"
+#include "windowstr.h"
+#include "pixmapstr.h"
+#include "regionstr.h"
+#include "gcstruct.h"
+#include "fontstruct.h"
+#include "dixfontstr.h"
+
+/* Our private definitions */
+#include "private.h"
+
+/*#define DEBUG*/
+
+#ifdef DEBUG
+#define DPRINTF(x) ErrorF x
+#else
+#define DPRINTF(x)
+#endif
+
+Bool vidc_profile = FALSE;
+
+enum {
+	PROF_COPY_WINDOW,
+	PROF_PAINT_BACKGROUND,
+	PROF_PAINT_BORDER,
+	PROF_CREATE_GC,
+	PROF_FILL_SPANS,
+	PROF_POLY_FILL_RECT,
+	PROF_COPY_AREA,
+	PROF_PUT_IMAGE,
+	PROF_POLY_TEXT8,
+	PROF_POLY_TEXT16,
+	PROF_IMAGE_TEXT8,
+	PROF_IMAGE_TEXT16,
+	PROF_IMAGE_GLYPH_BLT,
+	PROF_POLY_GLYPH_BLT,
+	PROF_NOPS
+};
+
+static char *prof_names[PROF_NOPS] = {
+	"CopyWindow",
+	"PaintWindowBackground",
+	"PaintWindowBorder",
+	"CreateGC",
+	"FillSpans",
+	"PolyFillRect",
+	"CopyArea",
+	"PutImage",
+	"PolyText8",
+	"PolyText16",
+	"ImageText8",
+	"ImageText16",
+	"ImageGlyphBlt",
+	"PolyGlyphBlt",
+};
+
+static struct {
+	unsigned long calls;
+	unsigned long long pixels;
+	unsigned long long ns;
+} prof_counts[PROF_NOPS];
+
+#define PROF_START()	unsigned long long _prof_t = vidc_trace_now()
+#define PROF_END(op, npixels) { \
+	prof_counts[op].ns += vidc_trace_now() - _prof_t; \
+	prof_counts[op].calls++; \
+	prof_counts[op].pixels += (npixels); \
+	if (vidc_tracing) \
+		vidc_trace_event(VIDC_TRACE_MAIN, prof_names[op], -1, _prof_t); \
+}
+
+/* Wrapped screen functions */
+static CloseScreenProcPtr		prof_close_screen_wrap;
+static CreateGCProcPtr			prof_create_gc_wrap;
+static PaintWindowBackgroundProcPtr	prof_paint_background_wrap;
+static PaintWindowBorderProcPtr		prof_paint_border_wrap;
+static CopyWindowProcPtr		prof_copy_window_wrap;
+
+typedef struct {
+	GCFuncs	*wrapFuncs;
+	GCOps	*wrapOps;
+} ProfGCRec, *ProfGCPtr;
+
+static int prof_gc_index;
+
+#define PROF_GC(pGC) \
+	((ProfGCPtr)(pGC)->devPrivates[prof_gc_index].ptr)
+
+static unsigned long region_area(RegionPtr rgn)
+{
+	int nbox = REGION_NUM_RECTS(rgn);
+	BoxPtr pbox = REGION_RECTS(rgn);
+	unsigned long area = 0;
+
+	for (; nbox--; pbox++)
+		area += (pbox->x2 - pbox->x1) * (pbox->y2 - pbox->y1);
+	return area;
+}
+
+static unsigned long glyphs_area(unsigned int nglyph, CharInfoPtr *ppci)
+{
+	unsigned long area = 0;
+
+	while (nglyph--) {
+		area += GLYPHWIDTHPIXELS(*ppci) * GLYPHHEIGHTPIXELS(*ppci);
+		ppci++;
+	}
+	return area;
+}
+
+/* Text is counted at the font's maximum bounds */
+#define TEXT_AREA(pGC, count) \
+	((unsigned long)(count) * \
+	 (FONTMAXBOUNDS((pGC)->font, rightSideBearing) - \
+	  FONTMINBOUNDS((pGC)->font, leftSideBearing)) * \
+	 (FONTASCENT((pGC)->font) + FONTDESCENT((pGC)->font)))
+
+/*
+ * GC funcs
+ */
+static void prof_validate_gc(GCPtr, unsigned long, DrawablePtr);
+static void prof_change_gc(GCPtr, unsigned long);
+static void prof_copy_gc(GCPtr, unsigned long, GCPtr);
+static void prof_destroy_gc(GCPtr);
+static void prof_change_clip(GCPtr, int, pointer, int);
+static void prof_destroy_clip(GCPtr);
+static void prof_copy_clip(GCPtr, GCPtr);
+
+static GCFuncs prof_gc_funcs = {
+	prof_validate_gc,
+	prof_change_gc,
+	prof_copy_gc,
+	prof_destroy_gc,
+	prof_change_clip,
+	prof_destroy_clip,
+	prof_copy_clip,
+};
+
+static GCOps prof_gc_ops;
+
+#define GC_FUNC_PROLOGUE(pGC) \
+	ProfGCPtr pPriv = PROF_GC(pGC); \
+	(pGC)->funcs = pPriv->wrapFuncs; \
+	(pGC)->ops = pPriv->wrapOps
+
+#define GC_FUNC_EPILOGUE(pGC) \
+	pPriv->wrapFuncs = (pGC)->funcs; \
+	pPriv->wrapOps = (pGC)->ops; \
+	(pGC)->funcs = &prof_gc_funcs; \
+	(pGC)->ops = &prof_gc_ops
+
+static void prof_validate_gc(GCPtr pGC, unsigned long changes,
+    DrawablePtr pDraw)
+{
+	GC_FUNC_PROLOGUE(pGC);
+	(*pGC->funcs->ValidateGC)(pGC, changes, pDraw);
+	GC_FUNC_EPILOGUE(pGC);
+}
+
+static void prof_change_gc(GCPtr pGC, unsigned long mask)
+{
+	GC_FUNC_PROLOGUE(pGC);
+	(*pGC->funcs->ChangeGC)(pGC, mask);
+	GC_FUNC_EPILOGUE(pGC);
+}
+
+static void prof_copy_gc(GCPtr pGCSrc, unsigned long mask, GCPtr pGCDst)
+{
+	GC_FUNC_PROLOGUE(pGCDst);
+	(*pGCDst->funcs->CopyGC)(pGCSrc, mask, pGCDst);
+	GC_FUNC_EPILOGUE(pGCDst);
+}
+
+static void prof_destroy_gc(GCPtr pGC)
+{
+	GC_FUNC_PROLOGUE(pGC);
+	(*pGC->funcs->DestroyGC)(pGC);
+	GC_FUNC_EPILOGUE(pGC);
+}
+
+static void prof_change_clip(GCPtr pGC, int type, pointer pvalue,
+    int nrects)
+{
+	GC_FUNC_PROLOGUE(pGC);
+	(*pGC->funcs->ChangeClip)(pGC, type, pvalue, nrects);
+	GC_FUNC_EPILOGUE(pGC);
+}
+
+static void prof_copy_clip(GCPtr pgcDst, GCPtr pgcSrc)
+{
+	GC_FUNC_PROLOGUE(pgcDst);
+	(*pgcDst->funcs->CopyClip)(pgcDst, pgcSrc);
+	GC_FUNC_EPILOGUE(pgcDst);
+}
+
+static void prof_destroy_clip(GCPtr pGC)
+{
+	GC_FUNC_PROLOGUE(pGC);
+	(*pGC->funcs->DestroyClip)(pGC);
+	GC_FUNC_EPILOGUE(pGC);
+}
+
+/*
+ * GC ops
+ */
+#define GC_OP_PROLOGUE(pGC) \
+	ProfGCPtr pPriv = PROF_GC(pGC); \
+	GCFuncs *oldFuncs = (pGC)->funcs; \
+	(pGC)->funcs = pPriv->wrapFuncs; \
+	(pGC)->ops = pPriv->wrapOps
+
+#define GC_OP_EPILOGUE(pGC) \
+	pPriv->wrapOps = (pGC)->ops; \
+	(pGC)->funcs = oldFuncs; \
+	(pGC)->ops = &prof_gc_ops
+
+static void prof_fill_spans(DrawablePtr pDraw, GCPtr pGC, int nInit,
+    DDXPointPtr pptInit, int *pwidthInit, int fSorted)
+{
+	unsigned long pixels = 0;
+	int i;
+	PROF_START();
+
+	GC_OP_PROLOGUE(pGC);
+	(*pGC->ops->FillSpans)(pDraw, pGC, nInit, pptInit, pwidthInit,
+	    fSorted);
+	GC_OP_EPILOGUE(pGC);
+
+	for (i = 0; i < nInit; i++)
+		pixels += pwidthInit[i];
+	PROF_END(PROF_FILL_SPANS, pixels);
+}
+
+static void prof_set_spans(DrawablePtr pDraw, GCPtr pGC, char *psrc,
+    DDXPointPtr ppt, int *pwidth, int nspans, int fSorted)
+{
+	GC_OP_PROLOGUE(pGC);
+	(*pGC->ops->SetSpans)(pDraw, pGC, psrc, ppt, pwidth, nspans, fSorted);
+	GC_OP_EPILOGUE(pGC);
+}
+
+static void prof_put_image(DrawablePtr pDraw, GCPtr pGC, int depth,
+    int x, int y, int w, int h, int leftPad, int format, char *pBits)
+{
+	PROF_START();
+
+	GC_OP_PROLOGUE(pGC);
+	(*pGC->ops->PutImage)(pDraw, pGC, depth, x, y, w, h, leftPad,
+	    format, pBits);
+	GC_OP_EPILOGUE(pGC);
+
+	PROF_END(PROF_PUT_IMAGE, (unsigned long)w * h);
+}
+
+static RegionPtr prof_copy_area(DrawablePtr pSrc, DrawablePtr pDst,
+    GCPtr pGC, int srcx, int srcy, int w, int h, int dstx, int dsty)
+{
+	RegionPtr rgn;
+	PROF_START();
+
+	GC_OP_PROLOGUE(pGC);
+	rgn = (*pGC->ops->CopyArea)(pSrc, pDst, pGC, srcx, srcy, w, h,
+	    dstx, dsty);
+	GC_OP_EPILOGUE(pGC);
+
+	PROF_END(PROF_COPY_AREA, (unsigned long)w * h);
+	return rgn;
+}
+
+static RegionPtr prof_copy_plane(DrawablePtr pSrc, DrawablePtr pDst,
+    GCPtr pGC, int srcx, int srcy, int w, int h, int dstx, int dsty,
+    unsigned long plane)
+{
+	RegionPtr rgn;
+
+	GC_OP_PROLOGUE(pGC);
+	rgn = (*pGC->ops->CopyPlane)(pSrc, pDst, pGC, srcx, srcy, w, h,
+	    dstx, dsty, plane);
+	GC_OP_EPILOGUE(pGC);
+	return rgn;
+}
+
+static void prof_poly_point(DrawablePtr pDraw, GCPtr pGC, int mode,
+    int npt, xPoint *pptInit)
+{
+	GC_OP_PROLOGUE(pGC);
+	(*pGC->ops->PolyPoint)(pDraw, pGC, mode, npt, pptInit);
+	GC_OP_EPILOGUE(pGC);
+}
+
+static void prof_poly_lines(DrawablePtr pDraw, GCPtr pGC, int mode,
+    int npt, DDXPointPtr pptInit)
+{
+	GC_OP_PROLOGUE(pGC);
+	(*pGC->ops->Polylines)(pDraw, pGC, mode, npt, pptInit);
+	GC_OP_EPILOGUE(pGC);
+}
+
+static void prof_poly_segment(DrawablePtr pDraw, GCPtr pGC, int nseg,
+    xSegment *pSegs)
+{
+	GC_OP_PROLOGUE(pGC);
+	(*pGC->ops->PolySegment)(pDraw, pGC, nseg, pSegs);
+	GC_OP_EPILOGUE(pGC);
+}
+
+static void prof_poly_rectangle(DrawablePtr pDraw, GCPtr pGC, int nrects,
+    xRectangle *pRects)
+{
+	GC_OP_PROLOGUE(pGC);
+	(*pGC->ops->PolyRectangle)(pDraw, pGC, nrects, pRects);
+	GC_OP_EPILOGUE(pGC);
+}
+
+static void prof_poly_arc(DrawablePtr pDraw, GCPtr pGC, int narcs,
+    xArc *parcs)
+{
+	GC_OP_PROLOGUE(pGC);
+	(*pGC->ops->PolyArc)(pDraw, pGC, narcs, parcs);
+	GC_OP_EPILOGUE(pGC);
+}
+
+static void prof_fill_polygon(DrawablePtr pDraw, GCPtr pGC, int shape,
+    int mode, int count, DDXPointPtr pPts)
+{
+	GC_OP_PROLOGUE(pGC);
+	(*pGC->ops->FillPolygon)(pDraw, pGC, shape, mode, count, pPts);
+	GC_OP_EPILOGUE(pGC);
+}
+
+static void prof_poly_fill_rect(DrawablePtr pDraw, GCPtr pGC,
+    int nrectFill, xRectangle *prectInit)
+{
+	unsigned long pixels = 0;
+	int i;
+	PROF_START();
+
+	GC_OP_PROLOGUE(pGC);
+	(*pGC->ops->PolyFillRect)(pDraw, pGC, nrectFill, prectInit);
+	GC_OP_EPILOGUE(pGC);
+
+	for (i = 0; i < nrectFill; i++)
+		pixels += (unsigned long)prectInit[i].width *
+		    prectInit[i].height;
+	PROF_END(PROF_POLY_FILL_RECT, pixels);
+}
+
+static void prof_poly_fill_arc(DrawablePtr pDraw, GCPtr pGC, int narcs,
+    xArc *parcs)
+{
+	GC_OP_PROLOGUE(pGC);
+	(*pGC->ops->PolyFillArc)(pDraw, pGC, narcs, parcs);
+	GC_OP_EPILOGUE(pGC);
+}
+
+static int prof_poly_text8(DrawablePtr pDraw, GCPtr pGC, int x, int y,
+    int count, char *chars)
+{
+	int ret;
+	PROF_START();
+
+	GC_OP_PROLOGUE(pGC);
+	ret = (*pGC->ops->PolyText8)(pDraw, pGC, x, y, count, chars);
+	GC_OP_EPILOGUE(pGC);
+
+	PROF_END(PROF_POLY_TEXT8, TEXT_AREA(pGC, count));
+	return ret;
+}
+
+static int prof_poly_text16(DrawablePtr pDraw, GCPtr pGC, int x, int y,
+    int count, unsigned short *chars)
+{
+	int ret;
+	PROF_START();
+
+	GC_OP_PROLOGUE(pGC);
+	ret = (*pGC->ops->PolyText16)(pDraw, pGC, x, y, count, chars);
+	GC_OP_EPILOGUE(pGC);
+
+	PROF_END(PROF_POLY_TEXT16, TEXT_AREA(pGC, count));
+	return ret;
+}
+
+static void prof_image_text8(DrawablePtr pDraw, GCPtr pGC, int x, int y,
+    int count, char *chars)
+{
+	PROF_START();
+
+	GC_OP_PROLOGUE(pGC);
+	(*pGC->ops->ImageText8)(pDraw, pGC, x, y, count, chars);
+	GC_OP_EPILOGUE(pGC);
+
+	PROF_END(PROF_IMAGE_TEXT8, TEXT_AREA(pGC, count));
+}
+
+static void prof_image_text16(DrawablePtr pDraw, GCPtr pGC, int x, int y,
+    int count, unsigned short *chars)
+{
+	PROF_START();
+
+	GC_OP_PROLOGUE(pGC);
+	(*pGC->ops->ImageText16)(pDraw, pGC, x, y, count, chars);
+	GC_OP_EPILOGUE(pGC);
+
+	PROF_END(PROF_IMAGE_TEXT16, TEXT_AREA(pGC, count));
+}
+
+static void prof_image_glyph_blt(DrawablePtr pDraw, GCPtr pGC, int x,
+    int y, unsigned int nglyph, CharInfoPtr *ppci, pointer pglyphBase)
+{
+	PROF_START();
+
+	GC_OP_PROLOGUE(pGC);
+	(*pGC->ops->ImageGlyphBlt)(pDraw, pGC, x, y, nglyph, ppci,
+	    pglyphBase);
+	GC_OP_EPILOGUE(pGC);
+
+	PROF_END(PROF_IMAGE_GLYPH_BLT, glyphs_area(nglyph, ppci));
+}
+
+static void prof_poly_glyph_blt(DrawablePtr pDraw, GCPtr pGC, int x,
+    int y, unsigned int nglyph, CharInfoPtr *ppci, pointer pglyphBase)
+{
+	PROF_START();
+
+	GC_OP_PROLOGUE(pGC);
+	(*pGC->ops->PolyGlyphBlt)(pDraw, pGC, x, y, nglyph, ppci,
+	    pglyphBase);
+	GC_OP_EPILOGUE(pGC);
+
+	PROF_END(PROF_POLY_GLYPH_BLT, glyphs_area(nglyph, ppci));
+}
+
+static void prof_push_pixels(GCPtr pGC, PixmapPtr pBitMap,
+    DrawablePtr pDraw, int w, int h, int x, int y)
+{
+	GC_OP_PROLOGUE(pGC);
+	(*pGC->ops->PushPixels)(pGC, pBitMap, pDraw, w, h, x, y);
+	GC_OP_EPILOGUE(pGC);
+}
+
+#ifdef NEED_LINEHELPER
+static void prof_line_helper()
+{
+	FatalError("prof_line_helper called\n");
+}
+#endif
+
+static GCOps prof_gc_ops = {
+	prof_fill_spans,
+	prof_set_spans,
+	prof_put_image,
+	prof_copy_area,
+	prof_copy_plane,
+	prof_poly_point,
+	prof_poly_lines,
+	prof_poly_segment,
+	prof_poly_rectangle,
+	prof_poly_arc,
+	prof_fill_polygon,
+	prof_poly_fill_rect,
+	prof_poly_fill_arc,
+	prof_poly_text8,
+	prof_poly_text16,
+	prof_image_text8,
+	prof_image_text16,
+	prof_image_glyph_blt,
+	prof_poly_glyph_blt,
+	prof_push_pixels
+#ifdef NEED_LINEHELPER
+	, prof_line_helper
+#endif
+};
+
+/*
+ * Screen functions
+ */
+static Bool prof_create_gc(GCPtr pGC)
+{
+	ScreenPtr screen = pGC->pScreen;
+	ProfGCPtr pPriv = PROF_GC(pGC);
+	Bool ret;
+	PROF_START();
+
+	screen->CreateGC = prof_create_gc_wrap;
+	if ((ret = (*screen->CreateGC)(pGC)) != FALSE) {
+		pPriv->wrapFuncs = pGC->funcs;
+		pPriv->wrapOps = pGC->ops;
+		pGC->funcs = &prof_gc_funcs;
+		pGC->ops = &prof_gc_ops;
+	}
+	screen->CreateGC = prof_create_gc;
+
+	PROF_END(PROF_CREATE_GC, 0);
+	return ret;
+}
+
+static void prof_paint_background(WindowPtr pWin, RegionPtr pRegion,
+    int what)
+{
+	ScreenPtr screen = pWin->drawable.pScreen;
+	PROF_START();
+
+	screen->PaintWindowBackground = prof_paint_background_wrap;
+	(*screen->PaintWindowBackground)(pWin, pRegion, what);
+	screen->PaintWindowBackground = prof_paint_background;
+
+	PROF_END(PROF_PAINT_BACKGROUND, region_area(pRegion));
+}
+
+static void prof_paint_border(WindowPtr pWin, RegionPtr pRegion, int what)
+{
+	ScreenPtr screen = pWin->drawable.pScreen;
+	PROF_START();
+
+	screen->PaintWindowBorder = prof_paint_border_wrap;
+	(*screen->PaintWindowBorder)(pWin, pRegion, what);
+	screen->PaintWindowBorder = prof_paint_border;
+
+	PROF_END(PROF_PAINT_BORDER, region_area(pRegion));
+}
+
+static void prof_copy_window(WindowPtr pWin, DDXPointRec ptOldOrg,
+    RegionPtr prgnSrc)
+{
+	ScreenPtr screen = pWin->drawable.pScreen;
+	unsigned long pixels = region_area(prgnSrc);
+	PROF_START();
+
+	screen->CopyWindow = prof_copy_window_wrap;
+	(*screen->CopyWindow)(pWin, ptOldOrg, prgnSrc);
+	screen->CopyWindow = prof_copy_window;
+
+	PROF_END(PROF_COPY_WINDOW, pixels);
+}
+
+static Bool prof_close_screen(int index, ScreenPtr screen)
+{
+	screen->CloseScreen = prof_close_screen_wrap;
+	screen->CreateGC = prof_create_gc_wrap;
+	screen->PaintWindowBackground = prof_paint_background_wrap;
+	screen->PaintWindowBorder = prof_paint_border_wrap;
+	screen->CopyWindow = prof_copy_window_wrap;
+	return (*screen->CloseScreen)(index, screen);
+}
+
+/*
+ * Log the totals so far.
+ */
+void vidc_prof_dump(void)
+{
+	int op;
+
+	if (!vidc_profile)
+		return;
+	for (op = 0; op < PROF_NOPS; op++) {
+		if (prof_counts[op].calls == 0)
+			continue;
+		ErrorF("vidc-prof: op=%s calls=%lu pixels=%llu ns=%llu "
+		    "ns_per_call=%llu\n", prof_names[op],
+		    prof_counts[op].calls, prof_counts[op].pixels,
+		    prof_counts[op].ns,
+		    prof_counts[op].ns / prof_counts[op].calls);
+	}
+}
+
+/*
+ * Install the profiling wrappers. Called straight after the frame
+ * buffer screen has been initialised, only if -profile or -trace was
+ * given.
+ */
+Bool vidc_prof_init(ScreenPtr screen)
+{
+	prof_gc_index = AllocateGCPrivateIndex();
+	if (prof_gc_index < 0 ||
+	    !AllocateGCPrivate(screen, prof_gc_index, sizeof(ProfGCRec)))
+		return FALSE;
+
+	prof_close_screen_wrap = screen->CloseScreen;
+	screen->CloseScreen = prof_close_screen;
+	prof_create_gc_wrap = screen->CreateGC;
+	screen->CreateGC = prof_create_gc;
+	prof_paint_background_wrap = screen->PaintWindowBackground;
+	screen->PaintWindowBackground = prof_paint_background;
+	prof_paint_border_wrap = screen->PaintWindowBorder;
+	screen->PaintWindowBorder = prof_paint_border;
+	prof_copy_window_wrap = screen->CopyWindow;
+	screen->CopyWindow = prof_copy_window;
+	return TRUE;
+}
@@ -0,0 +1,345 @@
+/*	$NetBSD$	*/
+
+/*
+ * Copyright (c) 1999 Mark Brinicombe & Neil A. Carson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * X11 driver code for VIDC20
+ */
+
+/*
+ * Input record and replay.
+ *
+ * -inputrecord file logs every raw record read from the mouse and the
+ * keyboard, with the time it was read, so that input related problems
+ * can be taken away and reproduced. -inputreplay file feeds such a log
+ * back in through a pair of pipes standing in for the devices, so the
+ * records go through exactly the same decode code. Replay is in real
+ * time unless -replayfast is also given, in which case the records are
+ * pushed as fast as the server will take them. When the log runs out
+ * the event rate and the CPU time spent decoding each event are logged.
+ *
+ * The log is a VIDC_REC_MAGIC header followed by records of a RecHdr
+ * and the raw device record. The raw records are in the native layout,
+ * so logs are only good on the kind of machine that wrote them, and
+ * have to be replayed with the same input backend (-wscons or not).
+ */
+
+#include <stdio.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+/* X11 headers
+ */
+#include "X.h"
+#include "Xproto.h"
+#include "misc.h"
+#include "dix.h"
+
+/* Our private definitions */
+#include "private.h"
+
+/*#define DEBUG*/
+
+#ifdef DEBUG
+#define DPRINTF(x) ErrorF x
+#else
+#define DPRINTF(x)
+#endif
+
+extern struct _private private;
+
+#define VIDC_REC_MAGIC	"VIDCREC1"
+
+typedef struct {
+	CARD8	type;		/* VIDC_REC_MOUSE or VIDC_REC_KBD */
+	CARD8	pad;
+	CARD16	len;		/* bytes of raw record following */
+	CARD32	sec;		/* when it was read */
+	CARD32	usec;
+} RecHdr;
+
+/* Largest raw record we'll take */
+#define REC_MAX		64
+
+int vidc_record_mode = VIDC_REC_OFF;
+char *vidc_record_file;
+Bool vidc_replay_fast = FALSE;
+
+/*
+ * Recording: records are buffered, and written out when the buffer
+ * fills and each time the server blocks, so a crash loses little.
+ */
+static int record_fd = -1;
+static char record_buf[4096];
+static int record_len;
+
+/* Replay */
+static pthread_t replay_thread;
+static int replay_mouse_pipe[2] = { -1, -1 };
+static int replay_kbd_pipe[2] = { -1, -1 };
+static volatile unsigned long replay_fed;	/* records written to pipes */
+static volatile Bool replay_done;		/* feeder reached the end */
+static unsigned long replay_seen;		/* records decoded */
+static struct timeval replay_start, replay_end;
+static long long replay_cpu_ns;
+
+/* Write the record buffer out; input must be held or in the handler */
+static void record_flush(void)
+{
+	char *p = record_buf;
+	int n;
+
+	while (record_len > 0) {
+		n = write(record_fd, p, record_len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			/* Give up rather than stall input */
+			close(record_fd);
+			record_fd = -1;
+			vidc_record_mode = VIDC_REC_OFF;
+			break;
+		}
+		p += n;
+		record_len -= n;
+	}
+	record_len = 0;
+}
+
+/*
+ * Called by the backends for every raw record they read. Runs from the
+ * SIGIO handler, so only sticks to memory and write().
+ */
+void vidc_record_input(int type, void *data, int len)
+{
+	RecHdr hdr;
+	struct timeval tv;
+
+	if (vidc_record_mode == VIDC_REC_REPLAY) {
+		replay_seen++;
+		return;
+	}
+	if (record_fd < 0 || len > REC_MAX)
+		return;
+
+	if (record_len + sizeof(hdr) + len > sizeof(record_buf))
+		record_flush();
+	gettimeofday(&tv, 0);
+	hdr.type = type;
+	hdr.pad = 0;
+	hdr.len = len;
+	hdr.sec = tv.tv_sec;
+	hdr.usec = tv.tv_usec;
+	memcpy(record_buf + record_len, &hdr, sizeof(hdr));
+	memcpy(record_buf + record_len + sizeof(hdr), data, len);
+	record_len += sizeof(hdr) + len;
+}
+
+static Bool write_all(int fd, char *p, int len)
+{
+	int n;
+
+	while (len > 0) {
+		n = write(fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return FALSE;
+		p += n;
+		len -= n;
+	}
+	return TRUE;
+}
+
+/*
+ * Feeder thread: push the log down the pipes, keeping the original
+ * spacing unless we are replaying flat out.
+ */
+static void *replay_feed(void *arg)
+{
+	FILE *fp = (FILE *)arg;
+	RecHdr hdr;
+	char data[REC_MAX];
+	long long first = -1, t, elapsed;
+	struct timeval now;
+	int fd;
+
+	gettimeofday(&replay_start, 0);
+	while (fread(&hdr, sizeof(hdr), 1, fp) == 1) {
+		if (hdr.len > REC_MAX || fread(data, hdr.len, 1, fp) != 1)
+			break;
+		t = (long long)hdr.sec * 1000000 + hdr.usec;
+		if (first < 0)
+			first = t;
+		if (!vidc_replay_fast) {
+			gettimeofday(&now, 0);
+			elapsed = (long long)(now.tv_sec - replay_start.tv_sec) *
+			    1000000 + (now.tv_usec - replay_start.tv_usec);
+			if (t - first > elapsed)
+				usleep(t - first - elapsed);
+		}
+		fd = (hdr.type == VIDC_REC_MOUSE) ? replay_mouse_pipe[1] :
+		    replay_kbd_pipe[1];
+		if (!write_all(fd, data, hdr.len))
+			break;
+		replay_fed++;
+	}
+	fclose(fp);
+	replay_done = TRUE;
+	return NULL;
+}
+
+static int make_pipe(int *fds)
+{
+	if (pipe(fds) != 0)
+		return -1;
+	fcntl(fds[0], F_SETOWN, getpid());
+	return fds[0];
+}
+
+/*
+ * Set up for replay, returning the fds to use for the mouse and the
+ * keyboard in place of the real devices.
+ */
+Bool vidc_replay_open(int *mouse_fd, int *kbd_fd)
+{
+	FILE *fp;
+	char magic[sizeof(VIDC_REC_MAGIC) - 1];
+
+	if ((fp = fopen(vidc_record_file, "r")) == NULL ||
+	    fread(magic, sizeof(magic), 1, fp) != 1 ||
+	    memcmp(magic, VIDC_REC_MAGIC, sizeof(magic)) != 0) {
+		ErrorF("%s is not an input log\n", vidc_record_file);
+		if (fp)
+			fclose(fp);
+		return FALSE;
+	}
+	if ((*mouse_fd = make_pipe(replay_mouse_pipe)) < 0 ||
+	    (*kbd_fd = make_pipe(replay_kbd_pipe)) < 0) {
+		fclose(fp);
+		return FALSE;
+	}
+	if (vidc_thread_create(&replay_thread, replay_feed, fp) != 0) {
+		fclose(fp);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/*
+ * Start recording to the log file.
+ */
+Bool vidc_record_open(void)
+{
+	record_fd = open(vidc_record_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (record_fd < 0) {
+		ErrorF("Can't create input log %s\n", vidc_record_file);
+		return FALSE;
+	}
+	record_len = 0;
+	return write_all(record_fd, VIDC_REC_MAGIC,
+	    sizeof(VIDC_REC_MAGIC) - 1);
+}
+
+/*
+ * Write out whatever has been recorded so far. Called from the block
+ * handler.
+ */
+void vidc_record_sync(void)
+{
+	if (record_fd < 0 || record_len == 0)
+		return;
+	VIDC_HOLD_INPUT();
+	record_flush();
+	vidc_release_input();
+}
+
+void vidc_record_close(void)
+{
+	if (record_fd < 0)
+		return;
+	VIDC_HOLD_INPUT();
+	record_flush();
+	if (record_fd >= 0)
+		close(record_fd);
+	record_fd = -1;
+	vidc_release_input();
+}
+
+static long long cpu_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * SIGIO handler body while replaying: decode as usual, but keep count
+ * of the CPU time it takes.
+ */
+void vidc_replay_io(void)
+{
+	long long start = cpu_ns();
+
+	private.mouse_io();
+	private.kbd_io();
+	replay_cpu_ns += cpu_ns() - start;
+	if (replay_done && replay_seen >= replay_fed && replay_end.tv_sec == 0)
+		gettimeofday(&replay_end, 0);
+}
+
+/*
+ * Report once everything fed has been decoded. Called from the block
+ * handler.
+ */
+void vidc_replay_check(void)
+{
+	static Bool reported = FALSE;
+	long long wall_us;
+
+	if (reported || !replay_done || replay_seen < replay_fed)
+		return;
+	if (replay_end.tv_sec == 0)
+		gettimeofday(&replay_end, 0);
+	reported = TRUE;
+
+	wall_us = (long long)(replay_end.tv_sec - replay_start.tv_sec) *
+	    1000000 + (replay_end.tv_usec - replay_start.tv_usec);
+	if (wall_us <= 0)
+		wall_us = 1;
+	ErrorF("vidc-replay: events=%lu wall_us=%lld events_per_sec=%lld "
+	    "cpu_ns_per_event=%lld mode=%s\n", replay_seen, wall_us,
+	    (long long)replay_seen * 1000000 / wall_us,
+	    replay_seen ? replay_cpu_ns / (long long)replay_seen : 0,
+	    vidc_replay_fast ? "fast" : "realtime");
+}
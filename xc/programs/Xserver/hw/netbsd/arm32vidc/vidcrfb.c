@@ -0,0 +1,1067 @@
+/*	$NetBSD$	*/
+
+/*
+ * Copyright (c) 1999 Mark Brinicombe & Neil A. Carson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * X11 driver code for VIDC20
+ */
+
+/*
+ * A minimal RFB (VNC) server, so that a unit can be looked at and
+ * driven over the network.
+ *
+ * One viewer at a time is served, speaking protocol 3.3 with no
+ * authentication, so by default we only listen on the loopback
+ * address and -rfball has to be given to listen everywhere (tunnel
+ * it). Updates carry only what has changed: with a shadow the damage
+ * the shadow code collects is passed on to us as well, otherwise the
+ * frame buffer is compared against itself with the tile hashes. Each
+ * rectangle goes as RRE when the viewer takes it and that comes out
+ * smaller, and raw otherwise. At 8bpp the viewer is given the colour
+ * map if it wants one, or the pixels are translated through it.
+ *
+ * Keys and buttons from the viewer are queued through vidc_enqueue()
+ * and motion through vidc_motion(), just as the console devices are.
+ *
+ * Without a viewer the only cost is the listening socket in the select
+ * mask; nothing is recorded for us until a viewer has connected.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+/* X11 headers
+ */
+#include "X.h"
+#include "Xproto.h"
+#include "input.h"
+#include "inputstr.h"
+#include "misc.h"
+#include "scrnintstr.h"
+#include "colormapst.h"
+#include "mipointer.h"
+
+/* Our private definitions */
+#include "private.h"
+
+extern struct _private private;
+
+/*#define DEBUG*/
+
+#ifdef DEBUG
+#define DPRINTF(x) ErrorF x
+#else
+#define DPRINTF(x)
+#endif
+
+#define RFB_VERSION		"RFB 003.003\n"
+#define RFB_VERSION_LEN		12
+
+/* Client to server messages */
+#define RFB_SET_PIXEL_FORMAT	0
+#define RFB_SET_ENCODINGS	2
+#define RFB_UPDATE_REQUEST	3
+#define RFB_KEY_EVENT		4
+#define RFB_POINTER_EVENT	5
+#define RFB_CUT_TEXT		6
+
+/* Server to client messages */
+#define RFB_UPDATE		0
+#define RFB_SET_COLOURS		1
+
+#define RFB_ENC_RAW		0
+#define RFB_ENC_RRE		2
+
+#define RFB_MAX_RECTS		64	/* more than this and send the extents */
+#define RFB_SCAN_MS		40	/* tile scans at most this often */
+#define RFB_OUTPUT_MS		10	/* poll this often while output waits */
+#define RFB_IN_SIZE		4096
+
+/* Connection states */
+#define RFB_NONE		0
+#define RFB_VERSION_WAIT	1	/* waiting for the viewer's version */
+#define RFB_INIT_WAIT		2	/* waiting for ClientInit */
+#define RFB_NORMAL		3
+
+/* -rfb port: listen for viewers, 0 for not at all */
+int vidc_rfb_port = 0;
+
+/* -rfball: listen on every interface, not just loopback */
+Bool vidc_rfb_any = FALSE;
+
+/* Set while a viewer is connected and wants damage */
+Bool vidc_rfb_active = FALSE;
+
+typedef struct {
+	int	bpp;		/* bytes per pixel */
+	Bool	big_endian;
+	Bool	true_colour;
+	int	red_max, green_max, blue_max;
+	int	red_shift, green_shift, blue_shift;
+} RfbFormat;
+
+static int listen_fd = -1;
+static int viewer_fd = -1;
+static int state = RFB_NONE;
+
+static unsigned char in_buf[RFB_IN_SIZE];
+static int in_len;
+static int in_skip;		/* cut text still to be thrown away */
+
+static unsigned char *out_buf;
+static int out_len, out_pos, out_size;
+
+static RfbFormat format;	/* what the viewer wants */
+static Bool use_rre;
+static Bool update_wanted;
+static Bool colours_changed;
+
+/* The frame buffer we export */
+static unsigned char *src_base;
+static int src_stride, src_depth;
+
+/* Native pixel to the viewer's pixel */
+static CARD32 *trans;
+static int trans_size;
+
+/* Damage, as a span on each scanline as the shadow keeps it */
+static short *dirty_x1, *dirty_x2;
+static int dirty_y1, dirty_y2;
+
+/* Without a shadow the tile hashes find the changes */
+static VidcTilesPtr tiles;
+static BoxPtr tile_boxes;
+static CARD32 last_scan;
+
+static int buttons;
+
+/* Statistics */
+static unsigned long rfb_updates, rfb_raw_rects, rfb_rre_rects;
+static unsigned long long rfb_bytes, rfb_encode_ns;
+
+static void rfb_close_viewer(char *why)
+{
+	if (viewer_fd >= 0) {
+		ErrorF("vidc-rfb: viewer closed: %s\n", why);
+		close(viewer_fd);
+	}
+	viewer_fd = -1;
+	state = RFB_NONE;
+	vidc_rfb_active = FALSE;
+	in_len = in_skip = 0;
+	out_len = out_pos = 0;
+	if (dirty_x1)
+		xfree(dirty_x1);
+	if (dirty_x2)
+		xfree(dirty_x2);
+	dirty_x1 = dirty_x2 = NULL;
+	if (trans)
+		xfree(trans);
+	trans = NULL;
+	if (tiles)
+		vidc_tile_destroy(tiles);
+	tiles = NULL;
+	if (tile_boxes)
+		xfree(tile_boxes);
+	tile_boxes = NULL;
+}
+
+/*
+ * Make room for n more bytes of output and return where they go.
+ */
+static unsigned char *rfb_reserve(int n)
+{
+	unsigned char *p;
+
+	if (out_len + n > out_size) {
+		int size = out_size ? out_size : 65536;
+
+		while (size < out_len + n)
+			size *= 2;
+		p = (unsigned char *)xrealloc(out_buf, size);
+		if (p == NULL)
+			return NULL;
+		out_buf = p;
+		out_size = size;
+	}
+	p = out_buf + out_len;
+	out_len += n;
+	return p;
+}
+
+static unsigned char *rfb_put16(unsigned char *p, int v)
+{
+	*p++ = v >> 8;
+	*p++ = v;
+	return p;
+}
+
+static unsigned char *rfb_put32(unsigned char *p, CARD32 v)
+{
+	*p++ = v >> 24;
+	*p++ = v >> 16;
+	*p++ = v >> 8;
+	*p++ = v;
+	return p;
+}
+
+#define RFB_GET16(p)	(((p)[0] << 8) | (p)[1])
+#define RFB_GET32(p)	(((CARD32)(p)[0] << 24) | ((p)[1] << 16) | \
+			    ((p)[2] << 8) | (p)[3])
+
+static unsigned char *rfb_put_pixel(unsigned char *p, CARD32 v)
+{
+	switch (format.bpp) {
+	case 1:
+		*p++ = v;
+		break;
+	case 2:
+		if (format.big_endian) {
+			*p++ = v >> 8;
+			*p++ = v;
+		} else {
+			*p++ = v;
+			*p++ = v >> 8;
+		}
+		break;
+	default:
+		if (format.big_endian)
+			return rfb_put32(p, v);
+		*p++ = v;
+		*p++ = v >> 8;
+		*p++ = v >> 16;
+		*p++ = v >> 24;
+		break;
+	}
+	return p;
+}
+
+/*
+ * Send what we can of the output without blocking.
+ */
+static void rfb_write(void)
+{
+	int n;
+
+	while (out_pos < out_len) {
+		n = write(viewer_fd, out_buf + out_pos, out_len - out_pos);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN)
+				rfb_close_viewer(strerror(errno));
+			return;
+		}
+		out_pos += n;
+		rfb_bytes += n;
+	}
+	out_len = out_pos = 0;
+}
+
+/*
+ * Where the frame buffer is and what it looks like. The packed modes
+ * are exported from their 8bpp shadow.
+ */
+static void rfb_find_source(void)
+{
+	if (private.shadow_base) {
+		src_base = (unsigned char *)private.shadow_base;
+		src_stride = private.shadow_width;
+		src_depth = private.shadow_depth;
+	} else {
+		src_base = (unsigned char *)private.vram_base;
+		src_stride = private.width;
+		src_depth = private.depth;
+	}
+}
+
+static CARD32 rfb_scale(unsigned long v, unsigned long from, int to)
+{
+	return from ? (v * to + from / 2) / from : 0;
+}
+
+/*
+ * Work out the viewer's pixel for each of ours.
+ */
+static Bool rfb_build_trans(void)
+{
+	ColormapPtr map = private.colour_map;
+	VisualPtr v;
+	EntryPtr e;
+	CARD32 r, g, b, p;
+	int i, size = 1 << src_depth;
+
+	if (trans == NULL || trans_size != size) {
+		if (trans)
+			xfree(trans);
+		trans = (CARD32 *)xalloc(size * sizeof(CARD32));
+		if (trans == NULL)
+			return FALSE;
+		trans_size = size;
+	}
+	if (!format.true_colour) {
+		/* Colour map format, which we only offer at 8bpp */
+		for (i = 0; i < size; i++)
+			trans[i] = i;
+		return TRUE;
+	}
+	for (i = 0; i < size; i++) {
+		r = g = b = 0;
+		if (map == NULL)
+			;
+		else if (src_depth == 16) {
+			v = map->pVisual;
+			r = rfb_scale((i & v->redMask) >> v->offsetRed,
+			    v->redMask >> v->offsetRed, format.red_max);
+			g = rfb_scale((i & v->greenMask) >> v->offsetGreen,
+			    v->greenMask >> v->offsetGreen, format.green_max);
+			b = rfb_scale((i & v->blueMask) >> v->offsetBlue,
+			    v->blueMask >> v->offsetBlue, format.blue_max);
+		} else if (i < map->pVisual->ColormapEntries) {
+			e = &map->red[i];
+			if (e->fShared) {
+				r = e->co.shco.red->color;
+				g = e->co.shco.green->color;
+				b = e->co.shco.blue->color;
+			} else {
+				r = e->co.local.red;
+				g = e->co.local.green;
+				b = e->co.local.blue;
+			}
+			r = rfb_scale(r, 65535, format.red_max);
+			g = rfb_scale(g, 65535, format.green_max);
+			b = rfb_scale(b, 65535, format.blue_max);
+		}
+		p = (r << format.red_shift) | (g << format.green_shift) |
+		    (b << format.blue_shift);
+		trans[i] = p;
+	}
+	return TRUE;
+}
+
+/*
+ * Give a colour map viewer our palette.
+ */
+static void rfb_send_colours(void)
+{
+	ColormapPtr map = private.colour_map;
+	EntryPtr e;
+	unsigned char *p;
+	int i, n = VIDC_PALETTE_SIZE;
+
+	if (map == NULL)
+		return;
+	if (n > map->pVisual->ColormapEntries)
+		n = map->pVisual->ColormapEntries;
+	if ((p = rfb_reserve(6 + n * 6)) == NULL)
+		return;
+	*p++ = RFB_SET_COLOURS;
+	*p++ = 0;
+	p = rfb_put16(p, 0);
+	p = rfb_put16(p, n);
+	for (i = 0; i < n; i++) {
+		e = &map->red[i];
+		if (e->fShared) {
+			p = rfb_put16(p, e->co.shco.red->color);
+			p = rfb_put16(p, e->co.shco.green->color);
+			p = rfb_put16(p, e->co.shco.blue->color);
+		} else {
+			p = rfb_put16(p, e->co.local.red);
+			p = rfb_put16(p, e->co.local.green);
+			p = rfb_put16(p, e->co.local.blue);
+		}
+	}
+}
+
+/*
+ * Note a changed area. Called by the shadow code for everything it
+ * flushes while a viewer is connected.
+ */
+void vidc_rfb_damage(int x1, int y1, int x2, int y2)
+{
+	int y;
+
+	if (!vidc_rfb_active)
+		return;
+	if (x1 < 0)
+		x1 = 0;
+	if (y1 < 0)
+		y1 = 0;
+	if (x2 > private.xres)
+		x2 = private.xres;
+	if (y2 > private.yres)
+		y2 = private.yres;
+	if (x1 >= x2 || y1 >= y2)
+		return;
+
+	if (y1 < dirty_y1)
+		dirty_y1 = y1;
+	if (y2 > dirty_y2)
+		dirty_y2 = y2;
+	for (y = y1; y < y2; y++) {
+		if (dirty_x2[y] == 0) {
+			dirty_x1[y] = x1;
+			dirty_x2[y] = x2;
+			continue;
+		}
+		if (x1 < dirty_x1[y])
+			dirty_x1[y] = x1;
+		if (x2 > dirty_x2[y])
+			dirty_x2[y] = x2;
+	}
+}
+
+/*
+ * The palette has changed: the viewer needs new colours, or if it
+ * has its own pixel format, the whole screen again.
+ */
+void vidc_rfb_colours_changed(void)
+{
+	if (vidc_rfb_active)
+		colours_changed = TRUE;
+}
+
+/*
+ * The screen has changed size or depth. The protocol has no way to tell
+ * a viewer that, so it is dropped and has to connect again.
+ */
+void vidc_rfb_mode_changed(void)
+{
+	if (viewer_fd >= 0)
+		rfb_close_viewer("screen mode changed");
+}
+
+/*
+ * Turn the dirty spans into rectangles. Lines with the same span are
+ * merged; if that leaves too many, neighbouring lines are merged
+ * whatever their spans.
+ */
+static int rfb_collect(BoxPtr boxes, Bool coarse)
+{
+	int y, n = 0;
+	BoxPtr b = NULL;
+
+	for (y = dirty_y1; y < dirty_y2; y++) {
+		if (dirty_x2[y] == 0) {
+			b = NULL;
+			continue;
+		}
+		if (b && (coarse || (dirty_x1[y] == b->x1 &&
+		    dirty_x2[y] == b->x2))) {
+			if (dirty_x1[y] < b->x1)
+				b->x1 = dirty_x1[y];
+			if (dirty_x2[y] > b->x2)
+				b->x2 = dirty_x2[y];
+			b->y2 = y + 1;
+			continue;
+		}
+		if (n == RFB_MAX_RECTS)
+			return -1;
+		b = &boxes[n++];
+		b->x1 = dirty_x1[y];
+		b->x2 = dirty_x2[y];
+		b->y1 = y;
+		b->y2 = y + 1;
+	}
+	return n;
+}
+
+#define RFB_SRC(x, line) \
+	(src_depth == 16 ? ((CARD16 *)(line))[x] : (line)[x])
+
+static unsigned char *rfb_rect_header(unsigned char *p, BoxPtr b, int enc)
+{
+	p = rfb_put16(p, b->x1);
+	p = rfb_put16(p, b->y1);
+	p = rfb_put16(p, b->x2 - b->x1);
+	p = rfb_put16(p, b->y2 - b->y1);
+	return rfb_put32(p, enc);
+}
+
+static void rfb_send_raw(BoxPtr b)
+{
+	int w = b->x2 - b->x1, h = b->y2 - b->y1;
+	unsigned char *line, *p;
+	int x, y;
+
+	if ((p = rfb_reserve(12 + w * h * format.bpp)) == NULL) {
+		rfb_close_viewer("out of memory");
+		return;
+	}
+	p = rfb_rect_header(p, b, RFB_ENC_RAW);
+	line = src_base + b->y1 * src_stride;
+	for (y = 0; y < h; y++, line += src_stride)
+		for (x = b->x1; x < b->x2; x++)
+			p = rfb_put_pixel(p, trans[RFB_SRC(x, line)]);
+	rfb_raw_rects++;
+}
+
+/*
+ * RRE with the top left pixel as the background and a subrectangle
+ * for each run along a line of anything else. Returns FALSE if that
+ * would come out bigger than raw.
+ */
+static Bool rfb_send_rre(BoxPtr b)
+{
+	int w = b->x2 - b->x1, h = b->y2 - b->y1;
+	int raw = w * h * format.bpp;
+	unsigned char *line, *p;
+	CARD32 bg, pix;
+	int x, y, start, nsub = 0;
+
+	line = src_base + b->y1 * src_stride;
+	bg = RFB_SRC(b->x1, line);
+	for (y = 0; y < h; y++, line += src_stride)
+		for (x = b->x1; x < b->x2; ) {
+			pix = RFB_SRC(x, line);
+			if (pix == bg) {
+				x++;
+				continue;
+			}
+			while (++x < b->x2 && RFB_SRC(x, line) == pix)
+				;
+			nsub++;
+			if (4 + format.bpp + nsub * (format.bpp + 8) >= raw)
+				return FALSE;
+		}
+
+	if ((p = rfb_reserve(12 + 4 + format.bpp +
+	    nsub * (format.bpp + 8))) == NULL) {
+		rfb_close_viewer("out of memory");
+		return TRUE;
+	}
+	p = rfb_rect_header(p, b, RFB_ENC_RRE);
+	p = rfb_put32(p, nsub);
+	p = rfb_put_pixel(p, trans[bg]);
+	line = src_base + b->y1 * src_stride;
+	for (y = 0; y < h; y++, line += src_stride)
+		for (x = b->x1; x < b->x2; ) {
+			pix = RFB_SRC(x, line);
+			if (pix == bg) {
+				x++;
+				continue;
+			}
+			start = x;
+			while (++x < b->x2 && RFB_SRC(x, line) == pix)
+				;
+			p = rfb_put_pixel(p, trans[pix]);
+			p = rfb_put16(p, start - b->x1);
+			p = rfb_put16(p, y);
+			p = rfb_put16(p, x - start);
+			p = rfb_put16(p, 1);
+		}
+	rfb_rre_rects++;
+	return TRUE;
+}
+
+/*
+ * Send everything that has changed as one update.
+ */
+static void rfb_send_update(void)
+{
+	BoxRec boxes[RFB_MAX_RECTS];
+	unsigned long long start = vidc_trace_now();
+	unsigned char *p;
+	int i, n;
+
+	n = rfb_collect(boxes, FALSE);
+	if (n < 0)
+		n = rfb_collect(boxes, TRUE);
+	if (n < 0) {
+		boxes[0].x1 = 0;
+		boxes[0].x2 = private.xres;
+		boxes[0].y1 = dirty_y1;
+		boxes[0].y2 = dirty_y2;
+		n = 1;
+	}
+	for (i = dirty_y1; i < dirty_y2; i++)
+		dirty_x2[i] = 0;
+	dirty_y1 = private.yres;
+	dirty_y2 = 0;
+	if (n == 0)
+		return;
+
+	if ((p = rfb_reserve(4)) == NULL) {
+		rfb_close_viewer("out of memory");
+		return;
+	}
+	*p++ = RFB_UPDATE;
+	*p++ = 0;
+	rfb_put16(p, n);
+	for (i = 0; i < n && viewer_fd >= 0; i++)
+		if (!use_rre || !rfb_send_rre(&boxes[i]))
+			rfb_send_raw(&boxes[i]);
+	update_wanted = FALSE;
+	rfb_updates++;
+	rfb_encode_ns += vidc_trace_now() - start;
+}
+
+static void rfb_server_init(void)
+{
+	VisualPtr v = private.colour_map ? private.colour_map->pVisual : NULL;
+	static char name[] = "vidc";
+	unsigned char *p;
+
+	rfb_find_source();
+	if (src_depth < 8) {
+		rfb_close_viewer("packed modes are only exported with -shadow");
+		return;
+	}
+	memset(&format, 0, sizeof(format));
+	format.bpp = src_depth >> 3;
+	if (src_depth == 16 && v) {
+		format.true_colour = TRUE;
+		format.red_max = v->redMask >> v->offsetRed;
+		format.green_max = v->greenMask >> v->offsetGreen;
+		format.blue_max = v->blueMask >> v->offsetBlue;
+		format.red_shift = v->offsetRed;
+		format.green_shift = v->offsetGreen;
+		format.blue_shift = v->offsetBlue;
+	}
+
+	dirty_x1 = (short *)Xcalloc(private.yres * sizeof(short));
+	dirty_x2 = (short *)Xcalloc(private.yres * sizeof(short));
+	if (dirty_x1 == NULL || dirty_x2 == NULL || !rfb_build_trans()) {
+		rfb_close_viewer("out of memory");
+		return;
+	}
+	if (!private.shadow_base) {
+		tiles = vidc_tile_create(src_base, src_stride, private.xres,
+		    private.yres, src_depth);
+		if (tiles)
+			tile_boxes = (BoxPtr)xalloc(vidc_tile_max_boxes(tiles) *
+			    sizeof(BoxRec));
+		if (tiles == NULL || tile_boxes == NULL) {
+			rfb_close_viewer("out of memory");
+			return;
+		}
+	}
+
+	if ((p = rfb_reserve(24 + sizeof(name) - 1)) == NULL) {
+		rfb_close_viewer("out of memory");
+		return;
+	}
+	p = rfb_put16(p, private.xres);
+	p = rfb_put16(p, private.yres);
+	*p++ = src_depth;
+	*p++ = src_depth;
+	*p++ = 0;			/* little endian */
+	*p++ = format.true_colour;
+	p = rfb_put16(p, format.red_max);
+	p = rfb_put16(p, format.green_max);
+	p = rfb_put16(p, format.blue_max);
+	*p++ = format.red_shift;
+	*p++ = format.green_shift;
+	*p++ = format.blue_shift;
+	*p++ = 0;
+	*p++ = 0;
+	*p++ = 0;
+	p = rfb_put32(p, sizeof(name) - 1);
+	memcpy(p, name, sizeof(name) - 1);
+
+	dirty_y1 = private.yres;
+	dirty_y2 = 0;
+	use_rre = FALSE;
+	update_wanted = FALSE;
+	colours_changed = FALSE;
+	buttons = 0;
+	state = RFB_NORMAL;
+	vidc_rfb_active = TRUE;
+	if (!format.true_colour)
+		rfb_send_colours();
+	vidc_rfb_damage(0, 0, private.xres, private.yres);
+	ErrorF("vidc-rfb: viewer connected, %dx%d at %dbpp\n",
+	    private.xres, private.yres, src_depth);
+}
+
+static void rfb_set_pixel_format(unsigned char *m)
+{
+	int bpp = m[4];
+
+	if (bpp != 8 && bpp != 16 && bpp != 32) {
+		rfb_close_viewer("unsupported pixel format");
+		return;
+	}
+	if (!m[7] && src_depth != 8) {
+		rfb_close_viewer("colour map format at 16bpp");
+		return;
+	}
+	format.bpp = bpp >> 3;
+	format.big_endian = m[6] != 0;
+	format.true_colour = m[7] != 0;
+	format.red_max = RFB_GET16(m + 8);
+	format.green_max = RFB_GET16(m + 10);
+	format.blue_max = RFB_GET16(m + 12);
+	format.red_shift = m[14];
+	format.green_shift = m[15];
+	format.blue_shift = m[16];
+	if (!rfb_build_trans()) {
+		rfb_close_viewer("out of memory");
+		return;
+	}
+	if (!format.true_colour)
+		rfb_send_colours();
+	vidc_rfb_damage(0, 0, private.xres, private.yres);
+}
+
+/*
+ * Find the keycode for a keysym, looking at the unshifted and shifted
+ * columns of the keyboard map.
+ */
+static int rfb_keycode(KeySym sym)
+{
+	DeviceIntPtr kbd = (DeviceIntPtr)private.kbd_dev;
+	KeySymsPtr keys;
+	int code, col, width;
+
+	if (kbd == NULL || kbd->key == NULL)
+		return 0;
+	keys = &kbd->key->curKeySyms;
+	width = keys->mapWidth < 2 ? keys->mapWidth : 2;
+	for (col = 0; col < width; col++)
+		for (code = keys->minKeyCode; code <= keys->maxKeyCode; code++)
+			if (keys->map[(code - keys->minKeyCode) *
+			    keys->mapWidth + col] == sym)
+				return code;
+	return 0;
+}
+
+/*
+ * Remote input goes in exactly as the console's would, with console
+ * input held off so the two don't tread on each other.
+ */
+static void rfb_key_event(Bool down, KeySym sym)
+{
+	xEvent x_event;
+	int code;
+
+	if ((code = rfb_keycode(sym)) == 0) {
+		DPRINTF(("vidc-rfb: no keycode for keysym 0x%lx\n", sym));
+		return;
+	}
+	x_event.u.u.type = down ? KeyPress : KeyRelease;
+	x_event.u.u.detail = code;
+	x_event.u.keyButtonPointer.time = GetTimeInMillis();
+	VIDC_HOLD_INPUT();
+	vidc_enqueue(&x_event);
+	vidc_release_input();
+}
+
+static void rfb_pointer_event(int mask, int x, int y)
+{
+	xEvent x_event;
+	int cx, cy, i;
+
+	if (private.mouse_dev == NULL)
+		return;
+	/* Held motion has to be in place before we work out the delta */
+	vidc_motion_caught_up();
+	VIDC_HOLD_INPUT();
+	x_event.u.keyButtonPointer.time = GetTimeInMillis();
+	miPointerPosition(&cx, &cy);
+	if (x != cx || y != cy)
+		vidc_motion(x - cx, y - cy, x_event.u.keyButtonPointer.time);
+	/* Bits 0-2 are left, middle and right, 3 and 4 the wheel */
+	for (i = 0; i < 5; i++) {
+		if (((buttons ^ mask) & (1 << i)) == 0)
+			continue;
+		x_event.u.u.detail = i + 1;
+		x_event.u.u.type = (mask & (1 << i)) ?
+		    ButtonPress : ButtonRelease;
+		vidc_enqueue(&x_event);
+	}
+	buttons = mask;
+	vidc_release_input();
+}
+
+/*
+ * Deal with whatever whole messages have arrived. Returns the number
+ * of bytes used.
+ */
+static int rfb_message(unsigned char *m, int len)
+{
+	unsigned char *p;
+	int n, x, y, w, h;
+
+	switch (state) {
+	case RFB_VERSION_WAIT:
+		if (len < RFB_VERSION_LEN)
+			return 0;
+		if (memcmp(m, "RFB 003.", 8) != 0) {
+			rfb_close_viewer("not an RFB viewer");
+			return len;
+		}
+		/* We only do 3.3, and any later viewer falls back to it */
+		if ((p = rfb_reserve(4)) == NULL) {
+			rfb_close_viewer("out of memory");
+			return len;
+		}
+		rfb_put32(p, 1);		/* no authentication */
+		state = RFB_INIT_WAIT;
+		return RFB_VERSION_LEN;
+	case RFB_INIT_WAIT:
+		/* The shared flag means nothing with one viewer at a time */
+		rfb_server_init();
+		return 1;
+	}
+
+	switch (m[0]) {
+	case RFB_SET_PIXEL_FORMAT:
+		if (len < 20)
+			return 0;
+		rfb_set_pixel_format(m);
+		return 20;
+	case RFB_SET_ENCODINGS:
+		if (len < 4)
+			return 0;
+		n = RFB_GET16(m + 2);
+		if (4 + n * 4 > RFB_IN_SIZE) {
+			rfb_close_viewer("too many encodings");
+			return len;
+		}
+		if (len < 4 + n * 4)
+			return 0;
+		use_rre = FALSE;
+		for (x = 0; x < n; x++)
+			if (RFB_GET32(m + 4 + x * 4) == RFB_ENC_RRE)
+				use_rre = TRUE;
+		return 4 + n * 4;
+	case RFB_UPDATE_REQUEST:
+		if (len < 10)
+			return 0;
+		update_wanted = TRUE;
+		if (!m[1]) {
+			x = RFB_GET16(m + 2);
+			y = RFB_GET16(m + 4);
+			w = RFB_GET16(m + 6);
+			h = RFB_GET16(m + 8);
+			vidc_rfb_damage(x, y, x + w, y + h);
+		}
+		return 10;
+	case RFB_KEY_EVENT:
+		if (len < 8)
+			return 0;
+		rfb_key_event(m[1], RFB_GET32(m + 4));
+		return 8;
+	case RFB_POINTER_EVENT:
+		if (len < 6)
+			return 0;
+		rfb_pointer_event(m[1], RFB_GET16(m + 2), RFB_GET16(m + 4));
+		return 6;
+	case RFB_CUT_TEXT:
+		/* There is no cut buffer here to put it in */
+		if (len < 8)
+			return 0;
+		in_skip = RFB_GET32(m + 4);
+		return 8;
+	default:
+		rfb_close_viewer("unknown message");
+		return len;
+	}
+}
+
+static void rfb_read(void)
+{
+	int n, used;
+
+	n = read(viewer_fd, in_buf + in_len, RFB_IN_SIZE - in_len);
+	if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+		rfb_close_viewer(n ? strerror(errno) : "end of file");
+		return;
+	}
+	if (n < 0)
+		return;
+	in_len += n;
+
+	used = 0;
+	while (viewer_fd >= 0 && used < in_len) {
+		if (in_skip) {
+			n = in_len - used < in_skip ? in_len - used : in_skip;
+			in_skip -= n;
+			used += n;
+			continue;
+		}
+		if ((n = rfb_message(in_buf + used, in_len - used)) == 0)
+			break;
+		used += n;
+	}
+	if (viewer_fd < 0)
+		return;
+	memmove(in_buf, in_buf + used, in_len - used);
+	in_len -= used;
+}
+
+static void rfb_accept(void)
+{
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	unsigned char *p;
+	int fd, on = 1;
+
+	if ((fd = accept(listen_fd, (struct sockaddr *)&addr, &len)) < 0)
+		return;
+	/* A new viewer takes over from the old one */
+	if (viewer_fd >= 0)
+		rfb_close_viewer("replaced by a new viewer");
+	ErrorF("vidc-rfb: viewer from %s\n", inet_ntoa(addr.sin_addr));
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+	viewer_fd = fd;
+	state = RFB_VERSION_WAIT;
+	if ((p = rfb_reserve(RFB_VERSION_LEN)) == NULL) {
+		rfb_close_viewer("out of memory");
+		return;
+	}
+	memcpy(p, RFB_VERSION, RFB_VERSION_LEN);
+	rfb_write();
+}
+
+/*
+ * Never let select sleep for longer than ms.
+ */
+static void rfb_timeout(pointer pTimeout, int ms)
+{
+	static struct timeval tv;
+	struct timeval **tvp = (struct timeval **)pTimeout;
+
+	if (*tvp && (*tvp)->tv_sec * 1000 + (*tvp)->tv_usec / 1000 <= ms)
+		return;
+	tv.tv_sec = ms / 1000;
+	tv.tv_usec = (ms % 1000) * 1000;
+	*tvp = &tv;
+}
+
+static void rfb_block_handler(pointer data, pointer pTimeout,
+    pointer pReadmask)
+{
+	CARD32 now, since;
+	int i, n;
+
+	FD_SET(listen_fd, (fd_set *)pReadmask);
+	if (viewer_fd < 0)
+		return;
+	FD_SET(viewer_fd, (fd_set *)pReadmask);
+
+	if (state == RFB_NORMAL && colours_changed) {
+		colours_changed = FALSE;
+		if (!format.true_colour)
+			rfb_send_colours();
+		else if (rfb_build_trans())
+			vidc_rfb_damage(0, 0, private.xres, private.yres);
+	}
+	if (state == RFB_NORMAL && update_wanted && out_len == 0 && tiles) {
+		now = GetTimeInMillis();
+		since = now - last_scan;
+		if (since < RFB_SCAN_MS)
+			rfb_timeout(pTimeout, RFB_SCAN_MS - since);
+		else {
+			last_scan = now;
+			n = vidc_tile_scan(tiles, tile_boxes);
+			for (i = 0; i < n; i++)
+				vidc_rfb_damage(tile_boxes[i].x1,
+				    tile_boxes[i].y1, tile_boxes[i].x2,
+				    tile_boxes[i].y2);
+			/* Look again shortly while the viewer is waiting */
+			rfb_timeout(pTimeout, RFB_SCAN_MS);
+		}
+	}
+	if (state == RFB_NORMAL && update_wanted && out_len == 0 &&
+	    dirty_y1 < dirty_y2)
+		rfb_send_update();
+	if (viewer_fd >= 0 && out_len) {
+		rfb_write();
+		if (out_len)
+			rfb_timeout(pTimeout, RFB_OUTPUT_MS);
+	}
+}
+
+static void rfb_wakeup_handler(pointer data, int result, pointer pReadmask)
+{
+	if (result <= 0)
+		return;
+	if (FD_ISSET(listen_fd, (fd_set *)pReadmask))
+		rfb_accept();
+	if (viewer_fd >= 0 && FD_ISSET(viewer_fd, (fd_set *)pReadmask))
+		rfb_read();
+}
+
+/*
+ * Start listening, the first time round, and hook into the select
+ * loop. A viewer from the last server generation is dropped as the
+ * screen it was looking at has gone.
+ */
+Bool vidc_rfb_init(void)
+{
+	struct sockaddr_in addr;
+	int on = 1;
+
+	rfb_close_viewer("server reset");
+	if (listen_fd < 0) {
+		if ((listen_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+			ErrorF("vidc-rfb: socket: %s\n", strerror(errno));
+			return FALSE;
+		}
+		setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on,
+		    sizeof(on));
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(vidc_rfb_port);
+		addr.sin_addr.s_addr = htonl(vidc_rfb_any ? INADDR_ANY :
+		    INADDR_LOOPBACK);
+		if (bind(listen_fd, (struct sockaddr *)&addr,
+		    sizeof(addr)) < 0 || listen(listen_fd, 1) < 0) {
+			ErrorF("vidc-rfb: port %d: %s\n", vidc_rfb_port,
+			    strerror(errno));
+			close(listen_fd);
+			listen_fd = -1;
+			return FALSE;
+		}
+		fcntl(listen_fd, F_SETFL, O_NONBLOCK);
+		fcntl(listen_fd, F_SETFD, FD_CLOEXEC);
+		ErrorF("vidc-rfb: listening on port %d\n", vidc_rfb_port);
+	}
+	return RegisterBlockAndWakeupHandlers(rfb_block_handler,
+	    rfb_wakeup_handler, NULL);
+}
+
+void vidc_rfb_stats(void)
+{
+	if (listen_fd < 0)
+		return;
+	ErrorF("vidc-rfb: viewer=%d updates=%lu raw=%lu rre=%lu bytes=%llu "
+	    "encode_ns=%llu\n", viewer_fd >= 0, rfb_updates, rfb_raw_rects,
+	    rfb_rre_rects, rfb_bytes, rfb_encode_ns);
+}
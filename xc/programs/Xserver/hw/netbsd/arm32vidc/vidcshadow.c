@@ -0,0 +1,1259 @@
+/*	$NetBSD$	*/
+
+/*
+ * Copyright (c) 1999 Mark Brinicombe & Neil A. Carson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * X11 driver code for VIDC20
+ */
+
+/*
+ * RAM shadow frame buffer.
+ *
+ * The VIDC20 can scan out 2 and 4 bpp modes but cfb can only draw at
+ * 8bpp, so for those modes the server renders into an 8bpp buffer in
+ * system memory and we pack the dirty spans down into the frame buffer
+ * from the block handler. The same machinery can be used at 8 and 16
+ * bpp (-shadow) in which case the spans are simply copied across.
+ *
+ * Damage is gathered by wrapping the GC ops and the screen functions
+ * that draw without a GC, in much the same way as misprite does it.
+ * For each scanline we only remember the leftmost and rightmost dirty
+ * pixel; that is cheap to update and is all the flush needs.
+ *
+ * Drawing that bypasses the wrapped ops isn't seen that way, so with
+ * -shadowfault damage is found with the MMU instead: the shadow is
+ * kept read only and the first write to each page after a flush
+ * faults. The SIGSEGV handler notes the page and makes it writable;
+ * the flush turns dirty pages into dirty spans and protects them
+ * again. Nothing else is wrapped in that mode. The kernel can't write
+ * into the shadow for us (read() would fail with EFAULT), but nothing
+ * in the server does that.
+ *
+ * With -export the shadow is mapped from a file other programs can
+ * map too, and each flush tells vidcexport.c what it wrote out.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+
+/* X11 headers
+ */
+#include "X.h"
+#include "Xproto.h"
+#include "misc.h"
+#include "scrnintstr.h"
+#include "windowstr.h"
+#include "pixmapstr.h"
+#include "regionstr.h"
+#include "gcstruct.h"
+#include "fontstruct.h"
+#include "dixfontstr.h"
+#include "colormap.h"
+#include "mi.h"
+
+/* Our private definitions */
+#include "private.h"
+
+/*#define DEBUG*/
+
+#ifdef DEBUG
+#define DPRINTF(x) ErrorF x
+#else
+#define DPRINTF(x)
+#endif
+
+extern struct _private private;
+
+/* Set by -shadow to use a shadow at 8 and 16bpp as well */
+Bool vidc_shadow_wanted = FALSE;
+
+/* How damage is found, -shadowfault picks page faults */
+int vidc_shadow_damage_mode = VIDC_DAMAGE_OPS;
+
+/* Shadow buffer, kept across server generations */
+static char *shadow_base_kept;
+static int shadow_size;
+
+/*
+ * Fault mode: a byte per page, set when the page is written after a
+ * flush. The pool threads fault too; a byte each means their stores
+ * never share a read-modify-write.
+ */
+static unsigned char *shadow_dirty_pages;
+static int shadow_pagesize;
+static struct sigaction shadow_old_segv;
+
+/* Statistics */
+static unsigned long shadow_flushes, shadow_faults;
+static unsigned long long shadow_flush_bytes, shadow_flush_ns;
+
+/* Dirty span for each scanline, x2 == 0 means clean */
+static short *dirty_x1;
+static short *dirty_x2;
+static int dirty_y1, dirty_y2;
+
+/* Pixels per frame buffer word at the scanout depth */
+static int shadow_ppw;
+
+/* Flushes writing less than this stay on the main thread */
+#define SHADOW_PARALLEL_BYTES	(64 * 1024)
+
+/* Flush bands start on a frame buffer cache line */
+#define SHADOW_CACHE_LINE	64
+
+/* Lines in a band are a multiple of this, to keep them aligned */
+static int shadow_band_lines;
+
+/* Threads a big flush is spread over */
+static int shadow_flush_threads = 1;
+
+/* -flushbench: time flushes on 1 to -flushthreads threads */
+Bool vidc_shadow_bench_wanted = FALSE;
+
+/* Pack/copy kernel used by the flush */
+static void (*shadow_copy_line)(unsigned char *src, CARD32 *dst, int nwords);
+
+/*
+ * Translation from an 8bpp shadow pixel to the scanout pixel. The
+ * colour visuals offer no more colours than the frame buffer holds
+ * (see vidc.c), so this only strips bits from pixels no colour map
+ * hands out.
+ */
+static CARD32 shadow_pixel_tab[256];
+
+/* Wrapped screen functions */
+static CloseScreenProcPtr		shadow_close_screen_wrap;
+static CreateGCProcPtr			shadow_create_gc_wrap;
+static PaintWindowBackgroundProcPtr	shadow_paint_background_wrap;
+static PaintWindowBorderProcPtr		shadow_paint_border_wrap;
+static CopyWindowProcPtr		shadow_copy_window_wrap;
+static ScreenBlockHandlerProcPtr	shadow_block_handler_wrap;
+
+/* Per GC private holding the wrapped funcs and ops */
+typedef struct {
+	GCFuncs	*wrapFuncs;
+	GCOps	*wrapOps;
+} ShadowGCRec, *ShadowGCPtr;
+
+static int shadow_gc_index;
+
+#define SHADOW_GC(pGC) \
+	((ShadowGCPtr)(pGC)->devPrivates[shadow_gc_index].ptr)
+
+/*
+ * Packing kernels. Pixels are stored least significant bits first
+ * within a frame buffer word, as the VIDC20 reads them.
+ */
+static void shadow_pack2(unsigned char *src, CARD32 *dst, int nwords)
+{
+	register CARD32 *tab = shadow_pixel_tab;
+	register CARD32 w;
+	register int i;
+
+	while (nwords--) {
+		w = 0;
+		for (i = 0; i < 32; i += 8) {
+			w |= (tab[src[0]] << i) |
+			    (tab[src[1]] << (i + 2)) |
+			    (tab[src[2]] << (i + 4)) |
+			    (tab[src[3]] << (i + 6));
+			src += 4;
+		}
+		*dst++ = w;
+	}
+}
+
+static void shadow_pack4(unsigned char *src, CARD32 *dst, int nwords)
+{
+	register CARD32 *tab = shadow_pixel_tab;
+
+	while (nwords--) {
+		*dst++ = tab[src[0]] | (tab[src[1]] << 4) |
+		    (tab[src[2]] << 8) | (tab[src[3]] << 12) |
+		    (tab[src[4]] << 16) | (tab[src[5]] << 20) |
+		    (tab[src[6]] << 24) | (tab[src[7]] << 28);
+		src += 8;
+	}
+}
+
+static void shadow_copy(unsigned char *src, CARD32 *dst, int nwords)
+{
+	register CARD32 *s = (CARD32 *)src;
+
+	while (nwords >= 4) {
+		dst[0] = s[0];
+		dst[1] = s[1];
+		dst[2] = s[2];
+		dst[3] = s[3];
+		dst += 4;
+		s += 4;
+		nwords -= 4;
+	}
+	while (nwords--)
+		*dst++ = *s++;
+}
+
+/*
+ * Record a damaged box, in screen coordinates.
+ */
+void vidc_shadow_damage(BoxPtr box)
+{
+	int x1 = box->x1, y1 = box->y1, x2 = box->x2, y2 = box->y2;
+	int y;
+
+	if (x1 < 0)
+		x1 = 0;
+	if (y1 < 0)
+		y1 = 0;
+	if (x2 > private.xres)
+		x2 = private.xres;
+	if (y2 > private.yres)
+		y2 = private.yres;
+	if (x1 >= x2 || y1 >= y2)
+		return;
+	if (vidc_rfb_active)
+		vidc_rfb_damage(x1, y1, x2, y2);
+
+	if (y1 < dirty_y1)
+		dirty_y1 = y1;
+	if (y2 > dirty_y2)
+		dirty_y2 = y2;
+	for (y = y1; y < y2; y++) {
+		if (dirty_x2[y] == 0) {
+			dirty_x1[y] = x1;
+			dirty_x2[y] = x2;
+			continue;
+		}
+		if (x1 < dirty_x1[y])
+			dirty_x1[y] = x1;
+		if (x2 > dirty_x2[y])
+			dirty_x2[y] = x2;
+	}
+}
+
+/*
+ * A write to a protected shadow page. Anything else is handed back to
+ * the previous handler by putting it back and letting the fault
+ * happen again.
+ */
+static void shadow_fault_handler(int sig, siginfo_t *info, void *ctx)
+{
+	char *addr = (char *)info->si_addr;
+	int page;
+
+	if (addr < shadow_base_kept || addr >= shadow_base_kept + shadow_size) {
+		sigaction(SIGSEGV, &shadow_old_segv, NULL);
+		return;
+	}
+	page = (addr - shadow_base_kept) / shadow_pagesize;
+	shadow_dirty_pages[page] = 1;
+	shadow_faults++;	/* only a statistic, racing threads may lose one */
+	mprotect(shadow_base_kept + page * shadow_pagesize, shadow_pagesize,
+	    PROT_READ | PROT_WRITE);
+}
+
+/*
+ * Turn the pages written since the last flush into dirty spans and
+ * protect them again.
+ */
+static void shadow_fault_collect(void)
+{
+	int npages = (shadow_size + shadow_pagesize - 1) / shadow_pagesize;
+	int sbpp = private.shadow_depth >> 3;
+	int page, last, start, end, y1, y2;
+	BoxRec box;
+
+	for (page = 0; page < npages; page = last) {
+		if (!shadow_dirty_pages[page]) {
+			last = page + 1;
+			continue;
+		}
+		for (last = page + 1; last < npages && shadow_dirty_pages[last];
+		    last++)
+			;
+
+		start = page * shadow_pagesize;
+		end = min(last * shadow_pagesize, private.shadow_width *
+		    private.yres);
+		mprotect(shadow_base_kept + start, (last - page) *
+		    shadow_pagesize, PROT_READ);
+		if (start >= end)
+			continue;
+
+		/* Partial first row, whole rows, partial last row */
+		y1 = start / private.shadow_width;
+		y2 = (end - 1) / private.shadow_width;
+		box.x1 = (start % private.shadow_width) / sbpp;
+		box.y1 = y1;
+		box.x2 = private.xres;
+		box.y2 = y1 + 1;
+		if (y1 == y2)
+			box.x2 = ((end - 1) % private.shadow_width) / sbpp + 1;
+		vidc_shadow_damage(&box);
+		if (y1 == y2)
+			continue;
+		box.x1 = 0;
+		box.y1 = y1 + 1;
+		box.y2 = y2;
+		vidc_shadow_damage(&box);
+		box.y1 = y2;
+		box.x2 = ((end - 1) % private.shadow_width) / sbpp + 1;
+		box.y2 = y2 + 1;
+		vidc_shadow_damage(&box);
+	}
+	memset(shadow_dirty_pages, 0, npages);
+}
+
+/*
+ * Copy out the dirty spans in one band of the dirty lines. This may
+ * be running on a pool thread alongside the others.
+ */
+static void shadow_flush_band(void *arg, int band, int nbands)
+{
+	int sbpp = private.shadow_depth >> 3;
+	int base = dirty_y1 - dirty_y1 % shadow_band_lines;
+	int per = (dirty_y2 - base + nbands - 1) / nbands;
+	int y, y2, x1, x2;
+	unsigned char *src;
+	CARD32 *dst;
+
+	per = (per + shadow_band_lines - 1) / shadow_band_lines *
+	    shadow_band_lines;
+	y = max(base + band * per, dirty_y1);
+	y2 = min(base + (band + 1) * per, dirty_y2);
+	for (; y < y2; y++) {
+		if (dirty_x2[y] == 0)
+			continue;
+		x1 = dirty_x1[y] & ~(shadow_ppw - 1);
+		x2 = (dirty_x2[y] + shadow_ppw - 1) & ~(shadow_ppw - 1);
+		src = (unsigned char *)private.shadow_base +
+		    y * private.shadow_width + x1 * sbpp;
+		dst = (CARD32 *)(private.vram_base + y * private.width) +
+		    x1 / shadow_ppw;
+		(*shadow_copy_line)(src, dst, (x2 - x1) / shadow_ppw);
+		dirty_x2[y] = 0;
+	}
+}
+
+/*
+ * Copy all the dirty spans out to the frame buffer. Big updates are
+ * split into bands of lines over the pool threads.
+ */
+void vidc_shadow_flush(void)
+{
+	int y, x1, x2;
+	int sbpp = private.shadow_depth >> 3;
+	unsigned long bytes = 0;
+	unsigned long long start;
+
+	if (vidc_shadow_damage_mode == VIDC_DAMAGE_FAULT)
+		shadow_fault_collect();
+	if (dirty_y1 >= dirty_y2)
+		return;
+	start = vidc_trace_now();
+
+	/* Size up the work, and tell the export what is going out */
+	for (y = dirty_y1; y < dirty_y2; y++) {
+		if (dirty_x2[y] == 0)
+			continue;
+		x1 = dirty_x1[y] & ~(shadow_ppw - 1);
+		x2 = (dirty_x2[y] + shadow_ppw - 1) & ~(shadow_ppw - 1);
+		bytes += (x2 - x1) * sbpp;
+		if (vidc_export_file)
+			vidc_export_span(y, dirty_x1[y], dirty_x2[y]);
+	}
+	if (vidc_export_file)
+		vidc_export_commit();
+	shadow_flush_bytes += bytes;
+
+	vidc_pool_run(shadow_flush_band, NULL,
+	    bytes >= SHADOW_PARALLEL_BYTES ? shadow_flush_threads : 1);
+
+	dirty_y1 = private.yres;
+	dirty_y2 = 0;
+	shadow_flushes++;
+	shadow_flush_ns += vidc_trace_now() - start;
+	if (vidc_tracing)
+		vidc_trace_event(VIDC_TRACE_MAIN, "ShadowFlush", -1, start);
+}
+
+/*
+ * Damage a box given in screen coordinates, clipped to the window.
+ * Drawing to pixmaps never reaches the screen so is ignored.
+ */
+static void shadow_damage_screen(DrawablePtr pDraw, int x1, int y1,
+    int x2, int y2)
+{
+	BoxRec box;
+	BoxPtr extents;
+
+	if (pDraw->type != DRAWABLE_WINDOW)
+		return;
+
+	extents = REGION_EXTENTS(pDraw->pScreen,
+	    &((WindowPtr)pDraw)->borderClip);
+	box.x1 = max(x1, extents->x1);
+	box.y1 = max(y1, extents->y1);
+	box.x2 = min(x2, extents->x2);
+	box.y2 = min(y2, extents->y2);
+	if (box.x1 < box.x2 && box.y1 < box.y2)
+		vidc_shadow_damage(&box);
+}
+
+/* The same for a box in drawable coordinates */
+static void shadow_damage_drawable(DrawablePtr pDraw, int x1, int y1,
+    int x2, int y2)
+{
+	shadow_damage_screen(pDraw, x1 + pDraw->x, y1 + pDraw->y,
+	    x2 + pDraw->x, y2 + pDraw->y);
+}
+
+#define SHADOW_DAMAGE_ALL(pDraw) \
+	shadow_damage_drawable(pDraw, -MAXSHORT, -MAXSHORT, MAXSHORT, MAXSHORT)
+
+/* Bounding box of a point list, returns FALSE when there are none */
+static Bool shadow_points_extents(int npt, DDXPointPtr ppt, int pad,
+    int *x1, int *y1, int *x2, int *y2)
+{
+	int minx, miny, maxx, maxy;
+
+	if (npt <= 0)
+		return FALSE;
+	minx = maxx = ppt->x;
+	miny = maxy = ppt->y;
+	while (--npt) {
+		ppt++;
+		if (ppt->x < minx)
+			minx = ppt->x;
+		else if (ppt->x > maxx)
+			maxx = ppt->x;
+		if (ppt->y < miny)
+			miny = ppt->y;
+		else if (ppt->y > maxy)
+			maxy = ppt->y;
+	}
+	*x1 = minx - pad;
+	*y1 = miny - pad;
+	*x2 = maxx + pad + 1;
+	*y2 = maxy + pad + 1;
+	return TRUE;
+}
+
+/* Lines wider than a pixel can grow miters, so give up on those */
+#define LINE_PAD(pGC)	((pGC)->lineWidth <= 1 ? 1 : -1)
+
+/*
+ * GC funcs
+ */
+static void shadow_validate_gc(GCPtr, unsigned long, DrawablePtr);
+static void shadow_change_gc(GCPtr, unsigned long);
+static void shadow_copy_gc(GCPtr, unsigned long, GCPtr);
+static void shadow_destroy_gc(GCPtr);
+static void shadow_change_clip(GCPtr, int, pointer, int);
+static void shadow_destroy_clip(GCPtr);
+static void shadow_copy_clip(GCPtr, GCPtr);
+
+static GCFuncs shadow_gc_funcs = {
+	shadow_validate_gc,
+	shadow_change_gc,
+	shadow_copy_gc,
+	shadow_destroy_gc,
+	shadow_change_clip,
+	shadow_destroy_clip,
+	shadow_copy_clip,
+};
+
+static GCOps shadow_gc_ops;
+
+#define GC_FUNC_PROLOGUE(pGC) \
+	ShadowGCPtr pPriv = SHADOW_GC(pGC); \
+	(pGC)->funcs = pPriv->wrapFuncs; \
+	if (pPriv->wrapOps) \
+		(pGC)->ops = pPriv->wrapOps
+
+#define GC_FUNC_EPILOGUE(pGC) \
+	pPriv->wrapFuncs = (pGC)->funcs; \
+	(pGC)->funcs = &shadow_gc_funcs; \
+	if (pPriv->wrapOps) { \
+		pPriv->wrapOps = (pGC)->ops; \
+		(pGC)->ops = &shadow_gc_ops; \
+	}
+
+static void shadow_validate_gc(GCPtr pGC, unsigned long changes,
+    DrawablePtr pDraw)
+{
+	GC_FUNC_PROLOGUE(pGC);
+	(*pGC->funcs->ValidateGC)(pGC, changes, pDraw);
+	/* Only GCs drawing to windows need their ops wrapped */
+	pPriv->wrapOps = NULL;
+	if (pDraw->type == DRAWABLE_WINDOW)
+		pPriv->wrapOps = pGC->ops;
+	GC_FUNC_EPILOGUE(pGC);
+}
+
+static void shadow_change_gc(GCPtr pGC, unsigned long mask)
+{
+	GC_FUNC_PROLOGUE(pGC);
+	(*pGC->funcs->ChangeGC)(pGC, mask);
+	GC_FUNC_EPILOGUE(pGC);
+}
+
+static void shadow_copy_gc(GCPtr pGCSrc, unsigned long mask, GCPtr pGCDst)
+{
+	GC_FUNC_PROLOGUE(pGCDst);
+	(*pGCDst->funcs->CopyGC)(pGCSrc, mask, pGCDst);
+	GC_FUNC_EPILOGUE(pGCDst);
+}
+
+static void shadow_destroy_gc(GCPtr pGC)
+{
+	GC_FUNC_PROLOGUE(pGC);
+	(*pGC->funcs->DestroyGC)(pGC);
+	GC_FUNC_EPILOGUE(pGC);
+}
+
+static void shadow_change_clip(GCPtr pGC, int type, pointer pvalue,
+    int nrects)
+{
+	GC_FUNC_PROLOGUE(pGC);
+	(*pGC->funcs->ChangeClip)(pGC, type, pvalue, nrects);
+	GC_FUNC_EPILOGUE(pGC);
+}
+
+static void shadow_copy_clip(GCPtr pgcDst, GCPtr pgcSrc)
+{
+	GC_FUNC_PROLOGUE(pgcDst);
+	(*pgcDst->funcs->CopyClip)(pgcDst, pgcSrc);
+	GC_FUNC_EPILOGUE(pgcDst);
+}
+
+static void shadow_destroy_clip(GCPtr pGC)
+{
+	GC_FUNC_PROLOGUE(pGC);
+	(*pGC->funcs->DestroyClip)(pGC);
+	GC_FUNC_EPILOGUE(pGC);
+}
+
+/*
+ * GC ops. Each one draws through the wrapped ops and then records
+ * the area it may have touched.
+ */
+#define GC_OP_PROLOGUE(pGC) \
+	ShadowGCPtr pPriv = SHADOW_GC(pGC); \
+	GCFuncs *oldFuncs = (pGC)->funcs; \
+	(pGC)->funcs = pPriv->wrapFuncs; \
+	(pGC)->ops = pPriv->wrapOps
+
+#define GC_OP_EPILOGUE(pGC) \
+	pPriv->wrapOps = (pGC)->ops; \
+	(pGC)->funcs = oldFuncs; \
+	(pGC)->ops = &shadow_gc_ops
+
+static void shadow_fill_spans(DrawablePtr pDraw, GCPtr pGC, int nInit,
+    DDXPointPtr pptInit, int *pwidthInit, int fSorted)
+{
+	int x1, y1, x2, y2, i, w;
+
+	GC_OP_PROLOGUE(pGC);
+	(*pGC->ops->FillSpans)(pDraw, pGC, nInit, pptInit, pwidthInit,
+	    fSorted);
+	GC_OP_EPILOGUE(pGC);
+
+	if (shadow_points_extents(nInit, pptInit, 0, &x1, &y1, &x2, &y2)) {
+		for (w = 0, i = 0; i < nInit; i++)
+			if (pwidthInit[i] > w)
+				w = pwidthInit[i];
+		/* Spans come already translated to the screen */
+		shadow_damage_screen(pDraw, x1, y1, x2 + w, y2);
+	}
+}
+
+static void shadow_set_spans(DrawablePtr pDraw, GCPtr pGC, char *psrc,
+    DDXPointPtr ppt, int *pwidth, int nspans, int fSorted)
+{
+	int x1, y1, x2, y2, i, w;
+
+	GC_OP_PROLOGUE(pGC);
+	(*pGC->ops->SetSpans)(pDraw, pGC, psrc, ppt, pwidth, nspans, fSorted);
+	GC_OP_EPILOGUE(pGC);
+
+	if (shadow_points_extents(nspans, ppt, 0, &x1, &y1, &x2, &y2)) {
+		for (w = 0, i = 0; i < nspans; i++)
+			if (pwidth[i] > w)
+				w = pwidth[i];
+		shadow_damage_screen(pDraw, x1, y1, x2 + w, y2);
+	}
+}
+
+static void shadow_put_image(DrawablePtr pDraw, GCPtr pGC, int depth,
+    int x, int y, int w, int h, int leftPad, int format, char *pBits)
+{
+	GC_OP_PROLOGUE(pGC);
+	(*pGC->ops->PutImage)(pDraw, pGC, depth, x, y, w, h, leftPad,
+	    format, pBits);
+	GC_OP_EPILOGUE(pGC);
+
+	shadow_damage_drawable(pDraw, x, y, x + w, y + h);
+}
+
+static RegionPtr shadow_copy_area(DrawablePtr pSrc, DrawablePtr pDst,
+    GCPtr pGC, int srcx, int srcy, int w, int h, int dstx, int dsty)
+{
+	RegionPtr rgn;
+
+	GC_OP_PROLOGUE(pGC);
+	rgn = (*pGC->ops->CopyArea)(pSrc, pDst, pGC, srcx, srcy, w, h,
+	    dstx, dsty);
+	GC_OP_EPILOGUE(pGC);
+
+	shadow_damage_drawable(pDst, dstx, dsty, dstx + w, dsty + h);
+	return rgn;
+}
+
+static RegionPtr shadow_copy_plane(DrawablePtr pSrc, DrawablePtr pDst,
+    GCPtr pGC, int srcx, int srcy, int w, int h, int dstx, int dsty,
+    unsigned long plane)
+{
+	RegionPtr rgn;
+
+	GC_OP_PROLOGUE(pGC);
+	rgn = (*pGC->ops->CopyPlane)(pSrc, pDst, pGC, srcx, srcy, w, h,
+	    dstx, dsty, plane);
+	GC_OP_EPILOGUE(pGC);
+
+	shadow_damage_drawable(pDst, dstx, dsty, dstx + w, dsty + h);
+	return rgn;
+}
+
+static void shadow_poly_point(DrawablePtr pDraw, GCPtr pGC, int mode,
+    int npt, xPoint *pptInit)
+{
+	int x1, y1, x2, y2;
+
+	GC_OP_PROLOGUE(pGC);
+	(*pGC->ops->PolyPoint)(pDraw, pGC, mode, npt, pptInit);
+	GC_OP_EPILOGUE(pGC);
+
+	if (mode != CoordModeOrigin)
+		SHADOW_DAMAGE_ALL(pDraw);
+	else if (shadow_points_extents(npt, (DDXPointPtr)pptInit, 0,
+	    &x1, &y1, &x2, &y2))
+		shadow_damage_drawable(pDraw, x1, y1, x2, y2);
+}
+
+static void shadow_poly_lines(DrawablePtr pDraw, GCPtr pGC, int mode,
+    int npt, DDXPointPtr pptInit)
+{
+	int x1, y1, x2, y2;
+	int pad = LINE_PAD(pGC);
+
+	GC_OP_PROLOGUE(pGC);
+	(*pGC->ops->Polylines)(pDraw, pGC, mode, npt, pptInit);
+	GC_OP_EPILOGUE(pGC);
+
+	if (mode != CoordModeOrigin || pad < 0)
+		SHADOW_DAMAGE_ALL(pDraw);
+	else if (shadow_points_extents(npt, pptInit, pad, &x1, &y1, &x2, &y2))
+		shadow_damage_drawable(pDraw, x1, y1, x2, y2);
+}
+
+static void shadow_poly_segment(DrawablePtr pDraw, GCPtr pGC, int nseg,
+    xSegment *pSegs)
+{
+	int x1, y1, x2, y2;
+	int pad = LINE_PAD(pGC);
+
+	GC_OP_PROLOGUE(pGC);
+	(*pGC->ops->PolySegment)(pDraw, pGC, nseg, pSegs);
+	GC_OP_EPILOGUE(pGC);
+
+	/* A segment is just a pair of points */
+	if (pad < 0)
+		SHADOW_DAMAGE_ALL(pDraw);
+	else if (shadow_points_extents(nseg * 2, (DDXPointPtr)pSegs, pad,
+	    &x1, &y1, &x2, &y2))
+		shadow_damage_drawable(pDraw, x1, y1, x2, y2);
+}
+
+/* Bounding box of a list of rectangles or arcs, both start x, y, w, h */
+#define RECTS_EXTENTS(n, p, pad, x1, y1, x2, y2) { \
+	int _i; \
+	x1 = y1 = MAXSHORT; \
+	x2 = y2 = -MAXSHORT; \
+	for (_i = 0; _i < (n); _i++) { \
+		if ((p)[_i].x < x1) \
+			x1 = (p)[_i].x; \
+		if ((p)[_i].y < y1) \
+			y1 = (p)[_i].y; \
+		if ((p)[_i].x + (int)(p)[_i].width > x2) \
+			x2 = (p)[_i].x + (int)(p)[_i].width; \
+		if ((p)[_i].y + (int)(p)[_i].height > y2) \
+			y2 = (p)[_i].y + (int)(p)[_i].height; \
+	} \
+	x1 -= (pad); y1 -= (pad); x2 += (pad); y2 += (pad); \
+}
+
+static void shadow_poly_rectangle(DrawablePtr pDraw, GCPtr pGC, int nrects,
+    xRectangle *pRects)
+{
+	int x1, y1, x2, y2;
+	int pad = LINE_PAD(pGC);
+
+	GC_OP_PROLOGUE(pGC);
+	(*pGC->ops->PolyRectangle)(pDraw, pGC, nrects, pRects);
+	GC_OP_EPILOGUE(pGC);
+
+	if (pad < 0) {
+		SHADOW_DAMAGE_ALL(pDraw);
+		return;
+	}
+	RECTS_EXTENTS(nrects, pRects, pad, x1, y1, x2, y2);
+	shadow_damage_drawable(pDraw, x1, y1, x2, y2);
+}
+
+static void shadow_poly_arc(DrawablePtr pDraw, GCPtr pGC, int narcs,
+    xArc *parcs)
+{
+	int x1, y1, x2, y2;
+	int pad = LINE_PAD(pGC);
+
+	GC_OP_PROLOGUE(pGC);
+	(*pGC->ops->PolyArc)(pDraw, pGC, narcs, parcs);
+	GC_OP_EPILOGUE(pGC);
+
+	if (pad < 0) {
+		SHADOW_DAMAGE_ALL(pDraw);
+		return;
+	}
+	RECTS_EXTENTS(narcs, parcs, pad, x1, y1, x2, y2);
+	shadow_damage_drawable(pDraw, x1, y1, x2, y2);
+}
+
+static void shadow_fill_polygon(DrawablePtr pDraw, GCPtr pGC, int shape,
+    int mode, int count, DDXPointPtr pPts)
+{
+	int x1, y1, x2, y2;
+
+	GC_OP_PROLOGUE(pGC);
+	(*pGC->ops->FillPolygon)(pDraw, pGC, shape, mode, count, pPts);
+	GC_OP_EPILOGUE(pGC);
+
+	if (mode != CoordModeOrigin)
+		SHADOW_DAMAGE_ALL(pDraw);
+	else if (shadow_points_extents(count, pPts, 0, &x1, &y1, &x2, &y2))
+		shadow_damage_drawable(pDraw, x1, y1, x2, y2);
+}
+
+static void shadow_poly_fill_rect(DrawablePtr pDraw, GCPtr pGC,
+    int nrectFill, xRectangle *prectInit)
+{
+	int x1, y1, x2, y2;
+
+	GC_OP_PROLOGUE(pGC);
+	(*pGC->ops->PolyFillRect)(pDraw, pGC, nrectFill, prectInit);
+	GC_OP_EPILOGUE(pGC);
+
+	RECTS_EXTENTS(nrectFill, prectInit, 0, x1, y1, x2, y2);
+	shadow_damage_drawable(pDraw, x1, y1, x2, y2);
+}
+
+static void shadow_poly_fill_arc(DrawablePtr pDraw, GCPtr pGC, int narcs,
+    xArc *parcs)
+{
+	int x1, y1, x2, y2;
+
+	GC_OP_PROLOGUE(pGC);
+	(*pGC->ops->PolyFillArc)(pDraw, pGC, narcs, parcs);
+	GC_OP_EPILOGUE(pGC);
+
+	RECTS_EXTENTS(narcs, parcs, 1, x1, y1, x2, y2);
+	shadow_damage_drawable(pDraw, x1, y1, x2, y2);
+}
+
+/*
+ * Text is damaged using the font's maximum bounds, which is a little
+ * generous but saves looking up every glyph.
+ */
+static void shadow_damage_text(DrawablePtr pDraw, GCPtr pGC, int x, int y,
+    int count)
+{
+	FontPtr font = pGC->font;
+	int w = FONTMAXBOUNDS(font, characterWidth);
+	int ascent, descent;
+
+	if (w < 0)
+		w = -w;
+	ascent = max(FONTASCENT(font), FONTMAXBOUNDS(font, ascent));
+	descent = max(FONTDESCENT(font), FONTMAXBOUNDS(font, descent));
+	shadow_damage_drawable(pDraw,
+	    x + min(0, FONTMINBOUNDS(font, leftSideBearing)) - w,
+	    y - ascent,
+	    x + count * w + max(w, FONTMAXBOUNDS(font, rightSideBearing)),
+	    y + descent);
+}
+
+static int shadow_poly_text8(DrawablePtr pDraw, GCPtr pGC, int x, int y,
+    int count, char *chars)
+{
+	int ret;
+
+	GC_OP_PROLOGUE(pGC);
+	ret = (*pGC->ops->PolyText8)(pDraw, pGC, x, y, count, chars);
+	GC_OP_EPILOGUE(pGC);
+
+	shadow_damage_text(pDraw, pGC, x, y, count);
+	return ret;
+}
+
+static int shadow_poly_text16(DrawablePtr pDraw, GCPtr pGC, int x, int y,
+    int count, unsigned short *chars)
+{
+	int ret;
+
+	GC_OP_PROLOGUE(pGC);
+	ret = (*pGC->ops->PolyText16)(pDraw, pGC, x, y, count, chars);
+	GC_OP_EPILOGUE(pGC);
+
+	shadow_damage_text(pDraw, pGC, x, y, count);
+	return ret;
+}
+
+static void shadow_image_text8(DrawablePtr pDraw, GCPtr pGC, int x, int y,
+    int count, char *chars)
+{
+	GC_OP_PROLOGUE(pGC);
+	(*pGC->ops->ImageText8)(pDraw, pGC, x, y, count, chars);
+	GC_OP_EPILOGUE(pGC);
+
+	shadow_damage_text(pDraw, pGC, x, y, count);
+}
+
+static void shadow_image_text16(DrawablePtr pDraw, GCPtr pGC, int x, int y,
+    int count, unsigned short *chars)
+{
+	GC_OP_PROLOGUE(pGC);
+	(*pGC->ops->ImageText16)(pDraw, pGC, x, y, count, chars);
+	GC_OP_EPILOGUE(pGC);
+
+	shadow_damage_text(pDraw, pGC, x, y, count);
+}
+
+static void shadow_image_glyph_blt(DrawablePtr pDraw, GCPtr pGC, int x,
+    int y, unsigned int nglyph, CharInfoPtr *ppci, pointer pglyphBase)
+{
+	GC_OP_PROLOGUE(pGC);
+	(*pGC->ops->ImageGlyphBlt)(pDraw, pGC, x, y, nglyph, ppci,
+	    pglyphBase);
+	GC_OP_EPILOGUE(pGC);
+
+	shadow_damage_text(pDraw, pGC, x, y, nglyph);
+}
+
+static void shadow_poly_glyph_blt(DrawablePtr pDraw, GCPtr pGC, int x,
+    int y, unsigned int nglyph, CharInfoPtr *ppci, pointer pglyphBase)
+{
+	GC_OP_PROLOGUE(pGC);
+	(*pGC->ops->PolyGlyphBlt)(pDraw, pGC, x, y, nglyph, ppci,
+	    pglyphBase);
+	GC_OP_EPILOGUE(pGC);
+
+	shadow_damage_text(pDraw, pGC, x, y, nglyph);
+}
+
+static void shadow_push_pixels(GCPtr pGC, PixmapPtr pBitMap,
+    DrawablePtr pDraw, int w, int h, int x, int y)
+{
+	GC_OP_PROLOGUE(pGC);
+	(*pGC->ops->PushPixels)(pGC, pBitMap, pDraw, w, h, x, y);
+	GC_OP_EPILOGUE(pGC);
+
+	shadow_damage_drawable(pDraw, x, y, x + w, y + h);
+}
+
+#ifdef NEED_LINEHELPER
+static void shadow_line_helper()
+{
+	FatalError("shadow_line_helper called\n");
+}
+#endif
+
+static GCOps shadow_gc_ops = {
+	shadow_fill_spans,
+	shadow_set_spans,
+	shadow_put_image,
+	shadow_copy_area,
+	shadow_copy_plane,
+	shadow_poly_point,
+	shadow_poly_lines,
+	shadow_poly_segment,
+	shadow_poly_rectangle,
+	shadow_poly_arc,
+	shadow_fill_polygon,
+	shadow_poly_fill_rect,
+	shadow_poly_fill_arc,
+	shadow_poly_text8,
+	shadow_poly_text16,
+	shadow_image_text8,
+	shadow_image_text16,
+	shadow_image_glyph_blt,
+	shadow_poly_glyph_blt,
+	shadow_push_pixels
+#ifdef NEED_LINEHELPER
+	, shadow_line_helper
+#endif
+};
+
+/*
+ * Screen functions
+ */
+static Bool shadow_create_gc(GCPtr pGC)
+{
+	ScreenPtr screen = pGC->pScreen;
+	ShadowGCPtr pPriv = SHADOW_GC(pGC);
+	Bool ret;
+
+	screen->CreateGC = shadow_create_gc_wrap;
+	if ((ret = (*screen->CreateGC)(pGC)) != FALSE) {
+		pPriv->wrapOps = NULL;
+		pPriv->wrapFuncs = pGC->funcs;
+		pGC->funcs = &shadow_gc_funcs;
+	}
+	screen->CreateGC = shadow_create_gc;
+	return ret;
+}
+
+static void shadow_damage_region(RegionPtr rgn)
+{
+	int nbox = REGION_NUM_RECTS(rgn);
+	BoxPtr pbox = REGION_RECTS(rgn);
+
+	while (nbox--)
+		vidc_shadow_damage(pbox++);
+}
+
+static void shadow_paint_background(WindowPtr pWin, RegionPtr pRegion,
+    int what)
+{
+	ScreenPtr screen = pWin->drawable.pScreen;
+
+	screen->PaintWindowBackground = shadow_paint_background_wrap;
+	(*screen->PaintWindowBackground)(pWin, pRegion, what);
+	screen->PaintWindowBackground = shadow_paint_background;
+	shadow_damage_region(pRegion);
+}
+
+static void shadow_paint_border(WindowPtr pWin, RegionPtr pRegion, int what)
+{
+	ScreenPtr screen = pWin->drawable.pScreen;
+
+	screen->PaintWindowBorder = shadow_paint_border_wrap;
+	(*screen->PaintWindowBorder)(pWin, pRegion, what);
+	screen->PaintWindowBorder = shadow_paint_border;
+	shadow_damage_region(pRegion);
+}
+
+static void shadow_copy_window(WindowPtr pWin, DDXPointRec ptOldOrg,
+    RegionPtr prgnSrc)
+{
+	ScreenPtr screen = pWin->drawable.pScreen;
+
+	screen->CopyWindow = shadow_copy_window_wrap;
+	(*screen->CopyWindow)(pWin, ptOldOrg, prgnSrc);
+	screen->CopyWindow = shadow_copy_window;
+
+	/* The destination is wherever the window now is */
+	vidc_shadow_damage(REGION_EXTENTS(screen, &pWin->borderClip));
+}
+
+static void shadow_block_handler(int index, pointer blockData,
+    pointer pTimeout, pointer pReadmask)
+{
+	ScreenPtr screen = screenInfo.screens[index];
+
+	/* Let misprite put the cursor back before we flush */
+	screen->BlockHandler = shadow_block_handler_wrap;
+	(*screen->BlockHandler)(index, blockData, pTimeout, pReadmask);
+	screen->BlockHandler = shadow_block_handler;
+
+	vidc_shadow_flush();
+}
+
+static Bool shadow_close_screen(int index, ScreenPtr screen)
+{
+	Bool ret;
+
+	screen->CloseScreen = shadow_close_screen_wrap;
+	screen->CreateGC = shadow_create_gc_wrap;
+	screen->PaintWindowBackground = shadow_paint_background_wrap;
+	screen->PaintWindowBorder = shadow_paint_border_wrap;
+	screen->CopyWindow = shadow_copy_window_wrap;
+	screen->BlockHandler = shadow_block_handler_wrap;
+	ret = (*screen->CloseScreen)(index, screen);
+
+	if (vidc_shadow_damage_mode == VIDC_DAMAGE_FAULT) {
+		mprotect(shadow_base_kept, shadow_size, PROT_READ | PROT_WRITE);
+		sigaction(SIGSEGV, &shadow_old_segv, NULL);
+		xfree(shadow_dirty_pages);
+		shadow_dirty_pages = NULL;
+	}
+
+	/* The shadow itself is kept for the next server generation */
+	xfree(dirty_x1);
+	xfree(dirty_x2);
+	dirty_x1 = dirty_x2 = NULL;
+
+	return ret;
+}
+
+/* Log what the flushes have cost
+ */
+void vidc_shadow_stats(void)
+{
+	if (!private.shadow_base)
+		return;
+	ErrorF("vidc-shadow: mode=%s flushes=%lu bytes=%llu ns=%llu "
+	    "faults=%lu\n",
+	    vidc_shadow_damage_mode == VIDC_DAMAGE_FAULT ? "fault" : "ops",
+	    shadow_flushes, shadow_flush_bytes, shadow_flush_ns,
+	    shadow_faults);
+}
+
+/*
+ * Time full screen flushes on each number of threads from one up to
+ * -flushthreads and log the scaling.
+ */
+void vidc_shadow_bench(void)
+{
+	BoxRec box;
+	unsigned long flushes = shadow_flushes;
+	unsigned long long bytes = shadow_flush_bytes, ns = shadow_flush_ns;
+	unsigned long long start, one = 0, t;
+	int threads, i;
+
+	box.x1 = box.y1 = 0;
+	box.x2 = private.xres;
+	box.y2 = private.yres;
+	for (threads = 1; threads <= vidc_pool_size(); threads++) {
+		shadow_flush_threads = threads;
+		start = vidc_trace_now();
+		for (i = 0; i < 10; i++) {
+			vidc_shadow_damage(&box);
+			vidc_shadow_flush();
+		}
+		t = (vidc_trace_now() - start) / 10;
+		if (threads == 1)
+			one = t;
+		ErrorF("vidc-flush: threads=%d frame_us=%llu MB_per_s=%llu "
+		    "speedup=%llu.%02llu\n", threads, t / 1000,
+		    t ? (unsigned long long)private.width * private.yres *
+		    1000 / t : 0, t ? one / t : 0, t ? one * 100 / t % 100 : 0);
+	}
+	shadow_flush_threads = vidc_pool_size();
+	shadow_flushes = flushes;
+	shadow_flush_bytes = bytes;
+	shadow_flush_ns = ns;
+}
+
+/*
+ * Allocate the shadow for rendering at the given depth. Called before
+ * the cfb screen is initialised on top of it. The shadow is mapped
+ * rather than allocated so that it is page aligned for -shadowfault.
+ */
+Bool vidc_shadow_alloc(int depth)
+{
+	int width = (private.xres * depth) / 8;
+	int size;
+
+	shadow_pagesize = getpagesize();
+	size = (width * private.yres + shadow_pagesize - 1) &
+	    ~(shadow_pagesize - 1);
+
+	if (vidc_export_file) {
+		/* The shadow lives in the export file, behind its header */
+		shadow_base_kept = vidc_export_map(size, depth, width);
+		if (!shadow_base_kept)
+			return FALSE;
+		shadow_size = size;
+	}
+
+	/* Reuse the buffer from the last server generation if it fits */
+	if (shadow_base_kept && size != shadow_size) {
+		munmap(shadow_base_kept, shadow_size);
+		shadow_base_kept = NULL;
+	}
+	if (!shadow_base_kept) {
+		shadow_size = size;
+		shadow_base_kept = (char *)mmap(NULL, shadow_size,
+		    PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+		if (shadow_base_kept == (char *)MAP_FAILED) {
+			shadow_base_kept = NULL;
+			return FALSE;
+		}
+	}
+	private.shadow_depth = depth;
+	private.shadow_width = width;
+	private.shadow_base = shadow_base_kept;
+	memset(private.shadow_base, 0, private.shadow_width * private.yres);
+	return TRUE;
+}
+
+/*
+ * Set up the flush and the dirty tracking for the current frame buffer
+ * geometry.
+ */
+static Bool shadow_setup(void)
+{
+	int cnt;
+
+	shadow_ppw = 32 / private.depth;
+	switch (private.depth) {
+	case 2:
+		shadow_copy_line = shadow_pack2;
+		break;
+	case 4:
+		shadow_copy_line = shadow_pack4;
+		break;
+	case 8:
+	case 16:
+		shadow_copy_line = shadow_copy;
+		break;
+	default:
+		ErrorF("Can't shadow a %d bpp frame buffer\n", private.depth);
+		return FALSE;
+	}
+	for (cnt = 0; cnt < 256; cnt++)
+		shadow_pixel_tab[cnt] = cnt & ((1 << min(private.depth, 8)) - 1);
+
+	/* Enough lines that the next band starts on a new cache line */
+	for (shadow_band_lines = 1;
+	    (shadow_band_lines * private.width) % SHADOW_CACHE_LINE;
+	    shadow_band_lines++)
+		;
+	shadow_flush_threads = vidc_pool_size();
+
+	if (private.xres % shadow_ppw) {
+		ErrorF("Frame buffer width %d isn't a multiple of %d pixels\n",
+		    private.xres, shadow_ppw);
+		return FALSE;
+	}
+
+	dirty_x1 = (short *)xalloc(private.yres * sizeof(short));
+	dirty_x2 = (short *)xalloc(private.yres * sizeof(short));
+	if (!dirty_x1 || !dirty_x2)
+		return FALSE;
+	memset(dirty_x2, 0, private.yres * sizeof(short));
+	dirty_y1 = private.yres;
+	dirty_y2 = 0;
+
+	if (vidc_shadow_damage_mode == VIDC_DAMAGE_FAULT) {
+		int npages = (shadow_size + shadow_pagesize - 1) /
+		    shadow_pagesize;
+
+		shadow_dirty_pages = (unsigned char *)xalloc(npages);
+		if (!shadow_dirty_pages)
+			return FALSE;
+		/* Everything needs to go out the first time */
+		memset(shadow_dirty_pages, 1, npages);
+	}
+	return TRUE;
+}
+
+/*
+ * Hook the screen so that drawing to the shadow is tracked and flushed.
+ * Called once the cfb and mi layers are in place.
+ */
+Bool vidc_shadow_init(ScreenPtr screen)
+{
+	if (!shadow_setup())
+		return FALSE;
+
+	if (vidc_shadow_damage_mode == VIDC_DAMAGE_FAULT) {
+		struct sigaction sa;
+
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_sigaction = shadow_fault_handler;
+		sa.sa_flags = SA_SIGINFO | SA_RESTART;
+		sigemptyset(&sa.sa_mask);
+		if (sigaction(SIGSEGV, &sa, &shadow_old_segv) < 0)
+			return FALSE;
+
+		shadow_close_screen_wrap = screen->CloseScreen;
+		screen->CloseScreen = shadow_close_screen;
+		shadow_block_handler_wrap = screen->BlockHandler;
+		screen->BlockHandler = shadow_block_handler;
+		shadow_create_gc_wrap = screen->CreateGC;
+		shadow_paint_background_wrap = screen->PaintWindowBackground;
+		shadow_paint_border_wrap = screen->PaintWindowBorder;
+		shadow_copy_window_wrap = screen->CopyWindow;
+		return TRUE;
+	}
+
+	shadow_gc_index = AllocateGCPrivateIndex();
+	if (shadow_gc_index < 0 ||
+	    !AllocateGCPrivate(screen, shadow_gc_index, sizeof(ShadowGCRec)))
+		return FALSE;
+
+	shadow_close_screen_wrap = screen->CloseScreen;
+	screen->CloseScreen = shadow_close_screen;
+	shadow_create_gc_wrap = screen->CreateGC;
+	screen->CreateGC = shadow_create_gc;
+	shadow_paint_background_wrap = screen->PaintWindowBackground;
+	screen->PaintWindowBackground = shadow_paint_background;
+	shadow_paint_border_wrap = screen->PaintWindowBorder;
+	screen->PaintWindowBorder = shadow_paint_border;
+	shadow_copy_window_wrap = screen->CopyWindow;
+	screen->CopyWindow = shadow_copy_window;
+	shadow_block_handler_wrap = screen->BlockHandler;
+	screen->BlockHandler = shadow_block_handler;
+
+	DPRINTF(("vidc_shadow_init: %d bpp shadow for %d bpp frame buffer\n",
+	    private.shadow_depth, private.depth));
+	return TRUE;
+}
+
+/*
+ * The frame buffer has changed mode under the shadow. Reallocate it and
+ * the dirty tracking for the new geometry; the caller repoints the
+ * screen pixmap and has everything repainted.
+ */
+Bool vidc_shadow_resize(void)
+{
+	xfree(dirty_x1);
+	xfree(dirty_x2);
+	dirty_x1 = dirty_x2 = NULL;
+	if (vidc_shadow_damage_mode == VIDC_DAMAGE_FAULT) {
+		/* The old buffer may be kept, and is cleared first */
+		mprotect(shadow_base_kept, shadow_size, PROT_READ | PROT_WRITE);
+		xfree(shadow_dirty_pages);
+		shadow_dirty_pages = NULL;
+	}
+	if (!vidc_shadow_alloc(private.shadow_depth))
+		return FALSE;
+	return shadow_setup();
+}
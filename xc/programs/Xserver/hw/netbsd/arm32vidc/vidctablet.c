@@ -0,0 +1,474 @@
+/*	$NetBSD$	*/
+
+/*
+ * Copyright (c) 1999 Mark Brinicombe & Neil A. Carson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * X11 driver code for VIDC20
+ */
+
+/*
+ * XInput tablet.
+ *
+ * An absolute pen tablet with x, y and pressure valuators and three
+ * buttons (tip, and the two barrel buttons), read from an evdev style
+ * device given with -tablet. It is an extension device and leaves the
+ * core pointer alone.
+ *
+ * The extension events a tablet sends are a device event followed by
+ * a valuator event. mieq only carries single core events, so these
+ * have a queue of their own, filled from SIGIO and given to dix from
+ * ProcessInputEvents(). Events from the two queues are only ordered
+ * with respect to each other to within one ProcessInputEvents().
+ *
+ * Tablets report at a few hundred Hz, so the per-report cost is kept
+ * down: the device is read a batch of events per read(), and every
+ * report goes into the motion history but only the last position in
+ * each batch is queued as a DeviceMotionNotify. Clients that want every
+ * sample get them from XGetDeviceMotionEvents(). Button and proximity
+ * changes flush the motion before them, so they land where they
+ * happened.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* X11 headers
+ */
+#include "X.h"
+#include "Xproto.h"
+#include "XI.h"
+#include "XIproto.h"
+#include "misc.h"
+#include "input.h"
+#include "inputstr.h"
+#include "scrnintstr.h"
+#include "extinit.h"
+#include "exevents.h"
+#include "exglobals.h"
+
+/* Our private definitions */
+#include "private.h"
+#include "fbdevcons.h"
+
+extern struct _private private;
+
+/*#define DEBUG*/
+
+#ifdef DEBUG
+#define DPRINTF(x) ErrorF x
+#else
+#define DPRINTF(x)
+#endif
+
+#define TABLET_AXES	3		/* x, y and pressure */
+#define TABLET_BUTTONS	3
+#define TABLET_BATCH	64		/* evdev events per read */
+#define TABLET_QUEUE	128		/* event pairs waiting for dix */
+#define TABLET_HISTORY	256		/* reports kept for motion history */
+
+#define TVTOMILLI(tv)	((tv).tv_usec / 1000 + (tv).tv_sec * 1000)
+
+char *vidc_tablet_path;
+
+static DeviceIntPtr tablet_dev;
+static int tablet_fd = -1;
+static struct fb_input_event tablet_buf[TABLET_BATCH];
+
+/* evdev axis for each valuator, and its range if the device won't say */
+static int tablet_codes[TABLET_AXES] = {
+	FB_ABS_X, FB_ABS_Y, FB_ABS_PRESSURE
+};
+static struct fb_absinfo tablet_info[TABLET_AXES] = {
+	{ 0, 0, 32767 }, { 0, 0, 32767 }, { 0, 0, 1023 }
+};
+
+/* Where the pen is as of the last report, and what is held down */
+static int tablet_axes[TABLET_AXES];
+static int tablet_buttons;
+static Bool tablet_prox;
+
+/* Changes seen since the last SYN_REPORT */
+static Bool frame_moved;
+static int frame_buttons;
+static int frame_prox = -1;
+
+/* A device event and the valuator event that goes with it */
+typedef struct {
+	int	nevents;
+	xEvent	event[2];
+} TabletEvent;
+
+static TabletEvent tablet_queue[TABLET_QUEUE];
+static volatile int tq_head, tq_tail;
+
+/* Each report: the time, then the valuators */
+static INT32 tablet_history[TABLET_HISTORY][1 + TABLET_AXES];
+static int th_next, th_count;
+
+static unsigned long tablet_reads, tablet_reports, tablet_queued;
+static unsigned long tablet_dropped;
+
+/*
+ * Queue an extension event carrying the current valuators. Runs from
+ * the SIGIO handler.
+ */
+static void tablet_enqueue(int type, int detail, CARD32 time)
+{
+	TabletEvent *e;
+	deviceKeyButtonPointer *k;
+	deviceValuator *v;
+	ScreenPtr screen = screenInfo.screens[0];
+	int next = (tq_tail + 1) % TABLET_QUEUE;
+	int range;
+
+	if (tablet_dev == NULL || !tablet_dev->public.on)
+		return;
+	if (next == tq_head) {
+		tablet_dropped++;
+		return;
+	}
+	e = &tablet_queue[tq_tail];
+	memset(e->event, 0, sizeof(e->event));
+
+	k = (deviceKeyButtonPointer *)&e->event[0];
+	k->type = type;
+	k->detail = detail;
+	k->time = time;
+	k->deviceid = tablet_dev->id | MORE_EVENTS;
+	range = tablet_info[0].maximum - tablet_info[0].minimum + 1;
+	k->root_x = (tablet_axes[0] - tablet_info[0].minimum) *
+	    screen->width / range;
+	range = tablet_info[1].maximum - tablet_info[1].minimum + 1;
+	k->root_y = (tablet_axes[1] - tablet_info[1].minimum) *
+	    screen->height / range;
+
+	v = (deviceValuator *)&e->event[1];
+	v->type = DeviceValuator;
+	v->deviceid = tablet_dev->id;
+	v->num_valuators = TABLET_AXES;
+	v->first_valuator = 0;
+	v->valuator0 = tablet_axes[0];
+	v->valuator1 = tablet_axes[1];
+	v->valuator2 = tablet_axes[2];
+
+	e->nevents = 2;
+	tq_tail = next;
+	tablet_queued++;
+}
+
+/* Keep a report for GetMotionEvents */
+static void tablet_history_add(CARD32 time)
+{
+	INT32 *h = tablet_history[th_next];
+
+	h[0] = time;
+	h[1] = tablet_axes[0];
+	h[2] = tablet_axes[1];
+	h[3] = tablet_axes[2];
+	th_next = (th_next + 1) % TABLET_HISTORY;
+	if (th_count < TABLET_HISTORY)
+		th_count++;
+}
+
+static void tablet_key(int code, int value)
+{
+	int bit;
+
+	switch (code) {
+	case FB_BTN_TOOL_PEN:
+		frame_prox = value != 0;
+		return;
+	case FB_BTN_TOUCH:
+		bit = 1;
+		break;
+	case FB_BTN_STYLUS:
+		bit = 2;
+		break;
+	case FB_BTN_STYLUS2:
+		bit = 4;
+		break;
+	default:
+		return;
+	}
+	if (value)
+		frame_buttons |= bit;
+	else
+		frame_buttons &= ~bit;
+}
+
+/*
+ * Read everything the tablet has. Called from the SIGIO handler.
+ */
+void vidc_tablet_io(void)
+{
+	struct fb_input_event *ev, *end;
+	Bool moved = FALSE;
+	CARD32 time, motion_time = 0;
+	int i, n, changed;
+
+	if (tablet_fd < 0)
+		return;
+	while ((n = read(tablet_fd, tablet_buf, sizeof(tablet_buf))) > 0) {
+		n /= sizeof(struct fb_input_event);
+		tablet_reads++;
+		for (ev = tablet_buf, end = tablet_buf + n; ev < end; ev++) {
+			switch (ev->type) {
+			case FB_EV_ABS:
+				for (i = 0; i < TABLET_AXES; i++)
+					if (ev->code == tablet_codes[i]) {
+						tablet_axes[i] = ev->value;
+						frame_moved = TRUE;
+					}
+				break;
+			case FB_EV_KEY:
+				tablet_key(ev->code, ev->value);
+				break;
+			case FB_EV_SYN:
+				if (ev->code != FB_SYN_REPORT)
+					break;
+				time = TVTOMILLI(ev->time);
+				tablet_reports++;
+				if (frame_moved) {
+					tablet_history_add(time);
+					frame_moved = FALSE;
+					moved = TRUE;
+					motion_time = time;
+				}
+				changed = frame_buttons ^ tablet_buttons;
+				if (changed == 0 && (frame_prox < 0 ||
+				    frame_prox == tablet_prox))
+					break;
+
+				/*
+				 * Get the pen to where things changed. Coming
+				 * into proximity brings the position with it.
+				 */
+				if (frame_prox == 1 && !tablet_prox)
+					tablet_enqueue(ProximityIn, 0, time);
+				else if (moved)
+					tablet_enqueue(DeviceMotionNotify, 0,
+					    motion_time);
+				moved = FALSE;
+				for (i = 0; i < TABLET_BUTTONS; i++)
+					if (changed & (1 << i))
+						tablet_enqueue((frame_buttons &
+						    (1 << i)) ? DeviceButtonPress :
+						    DeviceButtonRelease, i + 1,
+						    time);
+				if (frame_prox == 0 && tablet_prox)
+					tablet_enqueue(ProximityOut, 0, time);
+				tablet_buttons = frame_buttons;
+				if (frame_prox >= 0)
+					tablet_prox = frame_prox;
+				frame_prox = -1;
+				break;
+			}
+		}
+		if (n < TABLET_BATCH)
+			break;
+	}
+	if (moved)
+		tablet_enqueue(DeviceMotionNotify, 0, motion_time);
+}
+
+/*
+ * Hand the queued events to dix. Called from ProcessInputEvents().
+ */
+void vidc_tablet_process(void)
+{
+	TabletEvent *e;
+
+	while (tq_head != tq_tail) {
+		e = &tablet_queue[tq_head];
+		if (tablet_dev != NULL && tablet_dev->public.on)
+			(*tablet_dev->public.processInputProc)(e->event,
+			    tablet_dev, e->nevents);
+		tq_head = (tq_head + 1) % TABLET_QUEUE;
+	}
+}
+
+/*
+ * GetMotionEvents for the tablet: the reports from start to stop, each
+ * as the time followed by the valuators.
+ */
+static int tablet_get_motion(DeviceIntPtr dev, xTimecoord *buff,
+    unsigned long start, unsigned long stop, ScreenPtr screen)
+{
+	INT32 *out = (INT32 *)buff, *h;
+	int i, first, n = 0;
+
+	VIDC_HOLD_INPUT();
+	first = (th_next - th_count + TABLET_HISTORY) % TABLET_HISTORY;
+	for (i = 0; i < th_count; i++) {
+		h = tablet_history[(first + i) % TABLET_HISTORY];
+		if ((CARD32)h[0] < start)
+			continue;
+		if ((CARD32)h[0] > stop)
+			break;
+		memcpy(out, h, sizeof(tablet_history[0]));
+		out += 1 + TABLET_AXES;
+		n++;
+	}
+	vidc_release_input();
+	return n;
+}
+
+/* Ask the device for its axis ranges, keeping the defaults if it can't */
+static void tablet_get_ranges(void)
+{
+#ifdef FB_EVIOCGABS
+	struct fb_absinfo info;
+	int i;
+
+	for (i = 0; i < TABLET_AXES; i++)
+		if (ioctl(tablet_fd, FB_EVIOCGABS(tablet_codes[i]),
+		    &info) == 0 && info.maximum > info.minimum)
+			tablet_info[i] = info;
+#endif
+}
+
+static int tablet_proc(DeviceIntPtr dev, int what)
+{
+	CARD8 map[TABLET_BUTTONS + 1];
+	AxisInfoPtr axis;
+	int i;
+
+	switch (what) {
+	case DEVICE_INIT:
+		/* The fd stays open over a reset, like the core devices' */
+		if (tablet_fd < 0) {
+			if ((tablet_fd = fb_open_input(vidc_tablet_path)) < 0) {
+				ErrorF("Cannot open tablet %s\n",
+				    vidc_tablet_path);
+				return !Success;
+			}
+			tablet_get_ranges();
+		}
+		for (i = 0; i <= TABLET_BUTTONS; i++)
+			map[i] = i;
+		if (!InitValuatorClassDeviceStruct(dev, TABLET_AXES,
+		    tablet_get_motion, TABLET_HISTORY, Absolute) ||
+		    !InitButtonClassDeviceStruct(dev, TABLET_BUTTONS, map) ||
+		    !InitFocusClassDeviceStruct(dev) ||
+		    !InitProximityClassDeviceStruct(dev))
+			return !Success;
+		for (i = 0; i < TABLET_AXES; i++) {
+			axis = &dev->valuator->axes[i];
+			axis->min_value = tablet_info[i].minimum;
+			axis->max_value = tablet_info[i].maximum;
+			/* evdev gives units per mm, X wants them per metre */
+			axis->resolution = tablet_info[i].resolution ?
+			    tablet_info[i].resolution * 1000 : 1;
+			axis->min_resolution = axis->resolution;
+			axis->max_resolution = axis->resolution;
+		}
+		break;
+	case DEVICE_ON:
+		fcntl(tablet_fd, F_SETFL, O_ASYNC | O_NONBLOCK);
+		dev->public.on = TRUE;
+		break;
+	case DEVICE_OFF:
+		dev->public.on = FALSE;
+		break;
+	case DEVICE_CLOSE:
+		dev->public.on = FALSE;
+		tablet_dev = NULL;
+		break;
+	default:
+		break;
+	}
+	return Success;
+}
+
+void vidc_tablet_stats(void)
+{
+	if (vidc_tablet_path == NULL)
+		return;
+	ErrorF("vidc-tablet: reads=%lu reports=%lu queued=%lu dropped=%lu\n",
+	    tablet_reads, tablet_reports, tablet_queued, tablet_dropped);
+}
+
+/*
+ * The XInput DDX entry points. The tablet is our only extension
+ * device.
+ */
+void AddOtherInputDevices(void)
+{
+	DeviceIntPtr dev;
+
+	if (vidc_tablet_path == NULL)
+		return;
+	if ((dev = AddInputDevice((DeviceProc)tablet_proc, TRUE)) == NULL) {
+		ErrorF("Cannot add the tablet\n");
+		return;
+	}
+	AssignTypeAndName(dev, MakeAtom(XI_TABLET, sizeof(XI_TABLET) - 1,
+	    TRUE), "tablet");
+	RegisterOtherDevice(dev);
+	tablet_dev = dev;
+}
+
+void OpenInputDevice(DeviceIntPtr dev, ClientPtr client, int *status)
+{
+	/* dix only lets clients open extension devices, i.e. the tablet */
+	*status = Success;
+}
+
+void CloseInputDevice(DeviceIntPtr dev, ClientPtr client)
+{
+}
+
+/* The tablet is absolute only, and its valuators can't be set */
+int SetDeviceMode(ClientPtr client, DeviceIntPtr dev, int mode)
+{
+	return (dev == tablet_dev && mode == Absolute) ? Success : BadMatch;
+}
+
+int SetDeviceValuators(ClientPtr client, DeviceIntPtr dev, int *valuators,
+    int first_valuator, int num_valuators)
+{
+	return BadMatch;
+}
+
+int ChangeDeviceControl(ClientPtr client, DeviceIntPtr dev, void *control)
+{
+	return BadMatch;
+}
+
+int ChangeKeyboardDevice(DeviceIntPtr old_dev, DeviceIntPtr new_dev)
+{
+	return !Success;
+}
+
+int ChangePointerDevice(DeviceIntPtr old_dev, DeviceIntPtr new_dev,
+    unsigned char x, unsigned char y)
+{
+	return !Success;
+}
@@ -0,0 +1,268 @@
+/*	$NetBSD$	*/
+
+/*
+ * Copyright (c) 1999 Mark Brinicombe & Neil A. Carson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * X11 driver code for VIDC20
+ */
+
+/*
+ * Tile hashing.
+ *
+ * When the server draws straight into VRAM there is no damage to go
+ * on, so anything that wants to know what changed on screen has to
+ * look. This divides a frame buffer into fixed tiles and keeps a hash
+ * of each; a scan rehashes every tile and reports those whose hash
+ * has changed, merged into runs along each row of tiles.
+ *
+ * There is no SIMD unit to use, so the hash runs four independent
+ * rotate-and-xor lanes over the words of each tile row, which keeps
+ * the pipeline busy and costs one instruction per word with the
+ * barrel shifter. A multiply at the end of each row keeps content
+ * that has moved by whole rows from hashing the same.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+
+/* X11 headers
+ */
+#include "X.h"
+#include "Xproto.h"
+#include "misc.h"
+#include "scrnintstr.h"
+
+/* Our private definitions */
+#include "private.h"
+
+extern struct _private private;
+
+/*#define DEBUG*/
+
+#ifdef DEBUG
+#define DPRINTF(x) ErrorF x
+#else
+#define DPRINTF(x)
+#endif
+
+#define TILE_W		32	/* pixels */
+#define TILE_H		32
+
+#define ROTL(x, n)	(((x) << (n)) | ((x) >> (32 - (n))))
+#define TILE_MIX	0x9e3779b1
+
+Bool vidc_tile_bench_wanted = FALSE;
+
+struct _VidcTiles {
+	unsigned char	*base;
+	int		stride;		/* bytes per scanline */
+	int		width;		/* pixels */
+	int		height;
+	int		depth;		/* bits per pixel */
+	int		tiles_x;
+	int		tiles_y;
+	CARD32		*hash;
+};
+
+/*
+ * Hash one tile. nwords is the width of the tile in words, which is
+ * less than a full tile at the right hand edge.
+ */
+static CARD32 tile_hash(unsigned char *p, int stride, int nwords, int rows)
+{
+	register CARD32 a0 = 0, a1 = 0, a2 = 0, a3 = 0;
+	register CARD32 *w;
+	register int n;
+	CARD32 h = 0;
+
+	while (rows--) {
+		w = (CARD32 *)p;
+		for (n = nwords; n >= 4; n -= 4) {
+			a0 = ROTL(a0, 5) ^ w[0];
+			a1 = ROTL(a1, 5) ^ w[1];
+			a2 = ROTL(a2, 5) ^ w[2];
+			a3 = ROTL(a3, 5) ^ w[3];
+			w += 4;
+		}
+		while (n--)
+			a0 = ROTL(a0, 7) ^ *w++;
+		h = (h + (a0 ^ ROTL(a1, 8) ^ ROTL(a2, 16) ^ ROTL(a3, 24))) *
+		    TILE_MIX;
+		p += stride;
+	}
+	return h;
+}
+
+VidcTilesPtr vidc_tile_create(unsigned char *base, int stride, int width,
+    int height, int depth)
+{
+	VidcTilesPtr t;
+
+	if ((TILE_W * depth) & 31) {
+		ErrorF("Can't hash tiles at %d bpp\n", depth);
+		return NULL;
+	}
+	if ((t = (VidcTilesPtr)xalloc(sizeof(*t))) == NULL)
+		return NULL;
+	t->base = base;
+	t->stride = stride;
+	t->width = width;
+	t->height = height;
+	t->depth = depth;
+	t->tiles_x = (width + TILE_W - 1) / TILE_W;
+	t->tiles_y = (height + TILE_H - 1) / TILE_H;
+	t->hash = (CARD32 *)xalloc(t->tiles_x * t->tiles_y * sizeof(CARD32));
+	if (t->hash == NULL) {
+		xfree(t);
+		return NULL;
+	}
+	/* Make the first scan report (almost certainly) everything */
+	memset(t->hash, 0xff, t->tiles_x * t->tiles_y * sizeof(CARD32));
+	return t;
+}
+
+void vidc_tile_destroy(VidcTilesPtr t)
+{
+	xfree(t->hash);
+	xfree(t);
+}
+
+/* Most boxes a scan can return */
+int vidc_tile_max_boxes(VidcTilesPtr t)
+{
+	return (t->tiles_x + 1) / 2 * t->tiles_y;
+}
+
+/*
+ * Rehash every tile. The boxes, in pixels, covering tiles that have
+ * changed since the last scan are stored in boxes, which must have
+ * room for vidc_tile_max_boxes(), and their number is returned. boxes
+ * may be NULL to just bring the hashes up to date.
+ */
+int vidc_tile_scan(VidcTilesPtr t, BoxPtr boxes)
+{
+	CARD32 *hp = t->hash;
+	CARD32 h;
+	unsigned char *row;
+	int tx, ty, rows, nwords, nbox = 0;
+	Bool run;
+
+	for (ty = 0; ty < t->tiles_y; ty++) {
+		row = t->base + ty * TILE_H * t->stride;
+		rows = min(TILE_H, t->height - ty * TILE_H);
+		run = FALSE;
+		for (tx = 0; tx < t->tiles_x; tx++, hp++) {
+			nwords = (min(TILE_W, t->width - tx * TILE_W) *
+			    t->depth + 31) >> 5;
+			h = tile_hash(row + ((tx * TILE_W * t->depth) >> 3),
+			    t->stride, nwords, rows);
+			if (h == *hp) {
+				run = FALSE;
+				continue;
+			}
+			*hp = h;
+			if (boxes == NULL)
+				continue;
+			if (run) {
+				boxes[nbox - 1].x2 = min((tx + 1) * TILE_W,
+				    t->width);
+				continue;
+			}
+			boxes[nbox].x1 = tx * TILE_W;
+			boxes[nbox].y1 = ty * TILE_H;
+			boxes[nbox].x2 = min((tx + 1) * TILE_W, t->width);
+			boxes[nbox].y2 = ty * TILE_H + rows;
+			nbox++;
+			run = TRUE;
+		}
+	}
+	return nbox;
+}
+
+/* Time scans of one buffer, with nothing and with every tile changed */
+static void tile_bench_one(char *what, unsigned char *buf, int stride,
+    int width, int height, int depth, Bool writable)
+{
+	VidcTilesPtr t;
+	BoxPtr boxes;
+	unsigned long long start, same, all = 0;
+	int i, n, nbox;
+
+	if ((t = vidc_tile_create(buf, stride, width, height, depth)) == NULL)
+		return;
+	if ((boxes = (BoxPtr)xalloc(vidc_tile_max_boxes(t) *
+	    sizeof(BoxRec))) == NULL) {
+		vidc_tile_destroy(t);
+		return;
+	}
+	vidc_tile_scan(t, boxes);
+
+	start = vidc_trace_now();
+	for (i = 0; i < 10; i++)
+		nbox = vidc_tile_scan(t, boxes);
+	same = (vidc_trace_now() - start) / 10;
+
+	if (writable) {
+		start = vidc_trace_now();
+		for (i = 0; i < 10; i++) {
+			/* Change the first word of every tile */
+			for (n = 0; n < t->tiles_x * t->tiles_y; n++)
+				((CARD32 *)(buf + (n / t->tiles_x) * TILE_H *
+				    stride))[(n % t->tiles_x) * TILE_W *
+				    depth / 32] = i + 1;
+			nbox = vidc_tile_scan(t, boxes);
+		}
+		all = (vidc_trace_now() - start) / 10;
+	}
+
+	ErrorF("vidc-tile: buffer=%s bpp=%d tiles=%d scan_us=%llu "
+	    "scan_all_changed_us=%llu boxes=%d MB_per_s=%llu\n", what,
+	    depth, t->tiles_x * t->tiles_y, same / 1000, all / 1000, nbox,
+	    same ? (unsigned long long)stride * height * 1000 / same : 0);
+	xfree(boxes);
+	vidc_tile_destroy(t);
+}
+
+/*
+ * Time full screen scans over a RAM buffer the size of the screen at
+ * 8 and 16bpp, and over the frame buffer itself, and log them.
+ */
+void vidc_tile_bench(void)
+{
+	unsigned char *buf;
+
+	buf = (unsigned char *)xalloc(private.xres * 2 * private.yres);
+	if (buf != NULL) {
+		memset(buf, 0, private.xres * 2 * private.yres);
+		tile_bench_one("ram", buf, private.xres, private.xres,
+		    private.yres, 8, TRUE);
+		tile_bench_one("ram", buf, private.xres * 2, private.xres,
+		    private.yres, 16, TRUE);
+		xfree(buf);
+	}
+	tile_bench_one("vram", (unsigned char *)private.vram_base,
+	    private.width, private.xres, private.yres, private.depth, FALSE);
+}
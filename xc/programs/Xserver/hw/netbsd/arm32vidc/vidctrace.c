@@ -0,0 +1,238 @@
+/*	$NetBSD$	*/
+
+/*
+ * Copyright (c) 1999 Mark Brinicombe & Neil A. Carson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * X11 driver code for VIDC20
+ */
+
+/*
+ * Timeline tracing.
+ *
+ * With -trace file we keep a ring of recent events, each a name and
+ * a start and end time: requests as they are dispatched, the drawing
+ * ops timed by the profiling wrappers, reads of the input devices,
+ * palette loads and shadow flushes. On SIGUSR2 the ring is written to
+ * the file in the Chrome trace event JSON format, which Perfetto and
+ * chrome://tracing will both load, and then emptied.
+ *
+ * Input is read in the SIGIO handler so it has a ring of its own;
+ * each ring then only ever has one writer and needs no locking.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+
+/* X11 headers
+ */
+#include "X.h"
+#include "Xproto.h"
+#include "misc.h"
+#include "dixstruct.h"
+#include "scrnintstr.h"
+
+/* Our private definitions */
+#include "private.h"
+
+/*#define DEBUG*/
+
+#ifdef DEBUG
+#define DPRINTF(x) ErrorF x
+#else
+#define DPRINTF(x)
+#endif
+
+#define TRACE_MAIN_EVENTS	32768
+#define TRACE_INPUT_EVENTS	4096
+
+Bool vidc_tracing = FALSE;
+char *vidc_trace_file = NULL;
+
+typedef struct {
+	char	*name;
+	int	arg;
+	unsigned long long start;
+	unsigned long long end;
+} TraceEvent;
+
+static struct {
+	TraceEvent	*events;
+	int		size;
+	int		head;
+	Bool		wrapped;
+} trace_ring[2];
+
+static volatile sig_atomic_t trace_requested = 0;
+static unsigned long long trace_epoch;
+
+/* Request handlers we have taken the place of */
+static int (*trace_procs[256])(ClientPtr);
+
+unsigned long long vidc_trace_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Record an event that started at start and finishes now. arg is
+ * appended to the name when it is not negative.
+ */
+void vidc_trace_event(int ring, char *name, int arg,
+    unsigned long long start)
+{
+	TraceEvent *ev = &trace_ring[ring].events[trace_ring[ring].head];
+
+	ev->name = name;
+	ev->arg = arg;
+	ev->start = start;
+	ev->end = vidc_trace_now();
+	if (++trace_ring[ring].head == trace_ring[ring].size) {
+		trace_ring[ring].head = 0;
+		trace_ring[ring].wrapped = TRUE;
+	}
+}
+
+static int trace_dispatch(ClientPtr client)
+{
+	int major = ((xReq *)client->requestBuffer)->reqType;
+	unsigned long long start = vidc_trace_now();
+	int ret;
+
+	ret = (*trace_procs[major])(client);
+	vidc_trace_event(VIDC_TRACE_MAIN, "Request", major, start);
+	return ret;
+}
+
+static void trace_handler(int sig)
+{
+	trace_requested = 1;
+}
+
+static void trace_write_ring(FILE *fp, int ring, int tid)
+{
+	TraceEvent *ev;
+	int i, n;
+
+	i = trace_ring[ring].wrapped ? trace_ring[ring].head : 0;
+	n = trace_ring[ring].wrapped ? trace_ring[ring].size :
+	    trace_ring[ring].head;
+	for (; n--; i = (i + 1) % trace_ring[ring].size) {
+		ev = &trace_ring[ring].events[i];
+		fprintf(fp, ",\n{\"name\":\"%s", ev->name);
+		if (ev->arg >= 0)
+			fprintf(fp, " %d", ev->arg);
+		fprintf(fp, "\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+		    "\"ts\":%llu.%03llu,\"dur\":%llu.%03llu}", tid,
+		    (ev->start - trace_epoch) / 1000,
+		    (ev->start - trace_epoch) % 1000,
+		    (ev->end - ev->start) / 1000,
+		    (ev->end - ev->start) % 1000);
+	}
+	trace_ring[ring].head = 0;
+	trace_ring[ring].wrapped = FALSE;
+}
+
+/*
+ * Write out the rings if SIGUSR2 has asked for them. Called from the
+ * block handler.
+ */
+void vidc_trace_check(void)
+{
+	FILE *fp;
+
+	if (!trace_requested)
+		return;
+	trace_requested = 0;
+
+	if ((fp = fopen(vidc_trace_file, "w")) == NULL) {
+		ErrorF("Can't write trace to %s\n", vidc_trace_file);
+		return;
+	}
+
+	/* Keep the input ring still while we empty it */
+	VIDC_HOLD_INPUT();
+
+	fprintf(fp, "{\"traceEvents\":[");
+	fprintf(fp, "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+	    "\"tid\":1,\"args\":{\"name\":\"dispatch\"}}");
+	fprintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+	    "\"tid\":2,\"args\":{\"name\":\"input\"}}");
+	trace_write_ring(fp, VIDC_TRACE_MAIN, 1);
+	trace_write_ring(fp, VIDC_TRACE_INPUT, 2);
+	fprintf(fp, "\n],\"displayTimeUnit\":\"ns\"}\n");
+
+	vidc_release_input();
+
+	if (fclose(fp) != 0)
+		ErrorF("Error writing trace to %s\n", vidc_trace_file);
+	else
+		ErrorF("vidc-trace: written to %s\n", vidc_trace_file);
+}
+
+/*
+ * Allocate the rings. Called at the top of InitOutput, since the
+ * colour map and flush code records events while the screen is set up.
+ */
+void vidc_trace_alloc(void)
+{
+	int i;
+
+	if (trace_ring[VIDC_TRACE_MAIN].events != NULL)
+		return;
+	trace_ring[VIDC_TRACE_MAIN].size = TRACE_MAIN_EVENTS;
+	trace_ring[VIDC_TRACE_INPUT].size = TRACE_INPUT_EVENTS;
+	for (i = 0; i < 2; i++) {
+		trace_ring[i].events = (TraceEvent *)xalloc(
+		    trace_ring[i].size * sizeof(TraceEvent));
+		if (trace_ring[i].events == NULL)
+			FatalError("Cannot allocate trace buffer\n");
+	}
+	trace_epoch = vidc_trace_now();
+}
+
+/*
+ * Start tracing requests. Called from InitInput each generation, after
+ * the extensions have filled in their request handlers.
+ */
+void vidc_trace_init(void)
+{
+	int i;
+
+	vidc_trace_alloc();
+	for (i = 0; i < 256; i++) {
+		if (ProcVector[i] == trace_dispatch)
+			continue;
+		trace_procs[i] = ProcVector[i];
+		ProcVector[i] = trace_dispatch;
+	}
+
+	signal(SIGUSR2, trace_handler);
+}
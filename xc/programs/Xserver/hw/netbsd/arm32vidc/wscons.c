@@ -0,0 +1,324 @@
+/*	$NetBSD$	*/
+
+/*
+ * Copyright (c) 1999 Mark Brinicombe & Neil A. Carson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * X11 driver code for VIDC20
+ */
+
+/*
+ * wscons input.
+ *
+ * Reads wsmouse and wskbd, which hand out arrays of struct wscons_event
+ * rather than the RiscPC's own records. Each read takes up to a
+ * whole batch of events, which are then decoded in one pass and turned
+ * into the same events the rpc backend queues. That costs one system
+ * call per batch rather than one per event.
+ *
+ * Keycodes are taken to be in the pckbd layout (AT set 1, with the E0
+ * prefixed keys at 0x80 and up) and are mapped onto the XFree86 AT
+ * keycodes the keymap expects.
+ *
+ * -wsmouse and -wskbd name the devices. Any file that produces
+ * wscons_events will do, so a pair of fifos can stand in for them
+ * on a machine without wscons. -wsbench times batched reads against
+ * single-event reads over a pipe.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef __NetBSD__
+#include <dev/wscons/wsconsio.h>
+#else
+/* Enough of wsconsio.h to read events fed from elsewhere */
+struct wscons_event {
+	unsigned int	type;
+	int		value;
+	struct timespec	time;
+};
+
+#define WSCONS_EVENT_KEY_UP		2
+#define WSCONS_EVENT_KEY_DOWN		3
+#define WSCONS_EVENT_MOUSE_UP		4
+#define WSCONS_EVENT_MOUSE_DOWN		5
+#define WSCONS_EVENT_MOUSE_DELTA_X	6
+#define WSCONS_EVENT_MOUSE_DELTA_Y	7
+#define WSCONS_EVENT_MOUSE_DELTA_Z	10
+#endif
+
+/* X11 headers
+ */
+#include "X.h"
+#include "Xproto.h"
+#include "misc.h"
+#include "input.h"
+
+/* Keymap, from XFree86*/
+#include "atKeynames.h"
+
+/* Our private definitions */
+#include "private.h"
+
+extern struct _private private;
+
+/*#define DEBUG*/
+
+#ifdef DEBUG
+#define DPRINTF(x) ErrorF x
+#else
+#define DPRINTF(x)
+#endif
+
+#define WS_BATCH	64		/* events per read */
+
+#define TSTOMILLI(ts)	((ts).tv_nsec / 1000000 + (ts).tv_sec * 1000)
+
+Bool vidc_wscons = FALSE;
+char *vidc_wsmouse_path = "/dev/wsmouse0";
+char *vidc_wskbd_path = "/dev/wskbd0";
+Bool vidc_ws_bench_wanted = FALSE;
+
+static struct wscons_event ws_buf[WS_BATCH];
+
+/* E0 prefixed pckbd keys and the XFree86 AT keycodes they become */
+static struct {
+	int	ws;
+	int	at;
+} ws_extkeys[] = {
+	{ 0x9c, KEY_KP_Enter },	{ 0x9d, KEY_RCtrl },
+	{ 0xb5, KEY_KP_Divide },	{ 0xb7, KEY_Print },
+	{ 0xb8, KEY_AltLang },	{ 0xc6, KEY_Break },
+	{ 0xc7, KEY_Home },	{ 0xc8, KEY_Up },
+	{ 0xc9, KEY_PgUp },	{ 0xcb, KEY_Left },
+	{ 0xcd, KEY_Right },	{ 0xcf, KEY_End },
+	{ 0xd0, KEY_Down },	{ 0xd1, KEY_PgDown },
+	{ 0xd2, KEY_Insert },	{ 0xd3, KEY_Delete },
+	{ 0xdb, KEY_LMeta },	{ 0xdc, KEY_RMeta },
+	{ 0xdd, KEY_Menu },
+};
+
+/* wscons keycode to AT keycode, 0 for keys we don't know */
+static CARD8 ws_keymap[0x100];
+
+/*
+ * Read as many events as are waiting, up to a batch. Returns the
+ * number read, which is 0 once the device is empty.
+ */
+static int ws_read(int fd, int type)
+{
+	int n;
+
+	n = read(fd, ws_buf, sizeof(ws_buf));
+	if (n <= 0)
+		return 0;
+	n /= sizeof(struct wscons_event);
+	if (vidc_record_mode) {
+		int i;
+
+		for (i = 0; i < n; i++)
+			vidc_record_input(type, &ws_buf[i],
+			    sizeof(ws_buf[i]));
+	}
+	return n;
+}
+
+/*
+ * As with the rpc mouse, motion is gathered up across everything read
+ * and only flushed ahead of a button so that clicks land in the right
+ * place. The wheel comes out as buttons 4 and 5.
+ */
+void ws_mouse_io(void)
+{
+	struct wscons_event *ev, *end;
+	int dx = 0, dy = 0, n;
+	CARD32 motion_time = 0;
+	xEvent x_event;
+
+	while ((n = ws_read(private.mouse_fd, VIDC_REC_MOUSE)) > 0) {
+		for (ev = ws_buf, end = ws_buf + n; ev < end; ev++) {
+			x_event.u.keyButtonPointer.time = TSTOMILLI(ev->time);
+			switch (ev->type) {
+			case WSCONS_EVENT_MOUSE_DELTA_X:
+				dx += ev->value;
+				motion_time = x_event.u.keyButtonPointer.time;
+				break;
+			case WSCONS_EVENT_MOUSE_DELTA_Y:
+				dy -= ev->value;
+				motion_time = x_event.u.keyButtonPointer.time;
+				break;
+			case WSCONS_EVENT_MOUSE_UP:
+			case WSCONS_EVENT_MOUSE_DOWN:
+				if (ev->value < 0 || ev->value > 2)
+					break;
+				vidc_pointer_moved(&dx, &dy, motion_time);
+				x_event.u.u.detail = ev->value + 1;
+				x_event.u.u.type =
+				    (ev->type == WSCONS_EVENT_MOUSE_DOWN) ?
+				    ButtonPress : ButtonRelease;
+				vidc_enqueue(&x_event);
+				break;
+			case WSCONS_EVENT_MOUSE_DELTA_Z:
+				if (ev->value == 0)
+					break;
+				vidc_pointer_moved(&dx, &dy, motion_time);
+				x_event.u.u.detail = (ev->value < 0) ? 4 : 5;
+				x_event.u.u.type = ButtonPress;
+				vidc_enqueue(&x_event);
+				x_event.u.u.type = ButtonRelease;
+				vidc_enqueue(&x_event);
+				break;
+			}
+		}
+		if (n < WS_BATCH)
+			break;
+	}
+	vidc_pointer_moved(&dx, &dy, motion_time);
+}
+
+void ws_kbd_io(void)
+{
+	struct wscons_event *ev, *end;
+	xEvent x_event;
+	int n, code;
+
+	while ((n = ws_read(private.kbd_fd, VIDC_REC_KBD)) > 0) {
+		for (ev = ws_buf, end = ws_buf + n; ev < end; ev++) {
+			if (ev->type != WSCONS_EVENT_KEY_DOWN &&
+			    ev->type != WSCONS_EVENT_KEY_UP)
+				continue;
+			if (ev->value < 0 || ev->value >= 0x100 ||
+			    (code = ws_keymap[ev->value]) == 0)
+				continue;
+			x_event.u.keyButtonPointer.time = TSTOMILLI(ev->time);
+			x_event.u.u.type = (ev->type == WSCONS_EVENT_KEY_DOWN) ?
+			    KeyPress : KeyRelease;
+			if (vidc_hot_key(x_event.u.u.type, code))
+				continue;
+			x_event.u.u.detail = code + MIN_KEYCODE;
+			vidc_enqueue(&x_event);
+		}
+		if (n < WS_BATCH)
+			break;
+	}
+}
+
+static int ws_open(char *path)
+{
+	struct wscons_event ev;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY | O_NONBLOCK)) < 0)
+		return -1;
+
+	/* SIGIO is only sent to an owner */
+	fcntl(fd, F_SETOWN, getpid());
+
+	/* Drain anything left over */
+	while (read(fd, &ev, sizeof(ev)) > 0)
+		;
+	return fd;
+}
+
+int ws_init_mouse(void)
+{
+	return ws_open(vidc_wsmouse_path);
+}
+
+int ws_init_kbd(void)
+{
+	int fd, i;
+
+	/* Up to F12, set 1 scancodes are the AT keycodes */
+	for (i = 1; i <= KEY_F12; i++)
+		ws_keymap[i] = i;
+	for (i = 0; i < sizeof(ws_extkeys) / sizeof(ws_extkeys[0]); i++)
+		ws_keymap[ws_extkeys[i].ws] = ws_extkeys[i].at;
+
+	if ((fd = ws_open(vidc_wskbd_path)) < 0)
+		return -1;
+#ifdef WSKBDIO_SETMODE
+	{
+		int mode = WSKBD_TRANSLATED;
+
+		/* Keycodes, not whatever raw bytes the keyboard sends */
+		if (ioctl(fd, WSKBDIO_SETMODE, &mode) != 0)
+			ErrorF("Failed to set wskbd event mode\n");
+	}
+#endif
+	return fd;
+}
+
+/*
+ * Push bursts of key events down a pipe and time reading them back one
+ * event per read() and a batch per read(), and log both.
+ */
+void vidc_ws_bench(void)
+{
+	struct wscons_event burst[WS_BATCH];
+	unsigned long long start, single = 0, batched = 0;
+	int fds[2], i, round;
+
+	if (pipe(fds) != 0) {
+		ErrorF("vidc-ws: can't make a pipe\n");
+		return;
+	}
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	memset(burst, 0, sizeof(burst));
+	for (i = 0; i < WS_BATCH; i++) {
+		burst[i].type = (i & 1) ? WSCONS_EVENT_KEY_UP :
+		    WSCONS_EVENT_KEY_DOWN;
+		burst[i].value = 0x1e + (i >> 1) % 10;
+	}
+	for (round = 0; round < 1000; round++) {
+		if (write(fds[1], burst, sizeof(burst)) != sizeof(burst))
+			break;
+		start = vidc_trace_now();
+		for (i = 0; i < WS_BATCH; i++)
+			if (read(fds[0], ws_buf, sizeof(ws_buf[0])) <= 0)
+				break;
+		single += vidc_trace_now() - start;
+
+		if (write(fds[1], burst, sizeof(burst)) != sizeof(burst))
+			break;
+		start = vidc_trace_now();
+		while (read(fds[0], ws_buf, sizeof(ws_buf)) == sizeof(ws_buf))
+			;
+		batched += vidc_trace_now() - start;
+	}
+	close(fds[0]);
+	close(fds[1]);
+	if (round == 0)
+		return;
+	ErrorF("vidc-ws: events=%d single_ns_per_event=%llu "
+	    "batched_ns_per_event=%llu\n", round * WS_BATCH,
+	    single / (round * WS_BATCH), batched / (round * WS_BATCH));
+}